@@ -58,6 +58,123 @@ typedef struct {
 extern
 void dxc_free_code(DexCode* code);
 
+/// \brief The code unit range of a switch or fill-array-data payload in a
+/// ::DexCompactCode.
+typedef struct {
+  /// The code unit offset of the payload.
+  dx_uint addr;
+  /// The width of the payload in code units.
+  dx_uint size;
+} DexPayloadRange;
+
+/// \brief A read-only form of a code body that keeps the instructions as the
+/// code units of the file, typically a fifth of the size of the decoded
+/// ::DexInstruction list.  String, type, field and method operands stay
+/// indices into the id tables of the file the code was read from and are
+/// resolved on demand by the dxc_compact_* accessors.  Instructions are
+/// addressed by their code unit offset, the same addresses branch targets
+/// and try blocks use.
+typedef struct {
+  /// The number of registers used by this code.
+  dx_ushort registers_size;
+
+  /// The number of words of incoming arguments to this method.
+  dx_ushort ins_size;
+
+  /// The number of words of outgoing argument space for this method.
+  dx_ushort outs_size;
+
+  /// Pointer to the debug information for this method or NULL if there is no
+  /// information available.
+  DexDebugInfo* debug_information;
+
+  /// A sentinel terminated list of try bytecode ranges and the catch handlers
+  /// that contain them.
+  DexTryBlock* tries;
+
+  /// The number of instructions, counting each payload as one instruction as
+  /// ::DexCode does.
+  dx_uint insns_count;
+
+  /// The number of code units in insns.
+  dx_uint insns_size;
+
+  /// The code units of the instructions.
+  const dx_ushort* insns;
+
+  /// The number of payloads in insns.
+  dx_uint payloads_size;
+
+  /// The payloads in insns in ascending address order.
+  DexPayloadRange* payloads;
+
+  /// The reader state the operand indices refer to.
+  struct read_context_t* source;
+
+  /// Nonzero if insns points into memory owned by source.
+  int insns_borrowed;
+} DexCompactCode;
+
+/** \fn void dxc_free_compact_code(DexCompactCode* code)
+ * \brief Frees all data allocated for this compact code structure. Does not
+ * attempt to free the passed pointer.
+ */
+extern
+void dxc_free_compact_code(DexCompactCode* code);
+
+/** \fn dx_uint dxc_compact_next(const DexCompactCode* code, dx_uint addr)
+ * \brief Returns the address of the instruction following the one at addr,
+ * stepping over payloads as a whole.  Returns insns_size after the last
+ * instruction.
+ */
+extern
+dx_uint dxc_compact_next(const DexCompactCode* code, dx_uint addr);
+
+/** \fn int dxc_compact_is_payload(const DexCompactCode* code, dx_uint addr)
+ * \brief Returns true if a switch or fill-array-data payload starts at addr.
+ */
+extern
+int dxc_compact_is_payload(const DexCompactCode* code, dx_uint addr);
+
+/** \fn int dxc_compact_decode(const DexCompactCode* code, dx_uint addr,
+ *                             DexInstruction* insn)
+ * \brief Decodes the instruction or payload at addr into insn, which must be
+ * released with dxc_free_instruction().  Returns 0 on failure.
+ */
+extern
+int dxc_compact_decode(const DexCompactCode* code, dx_uint addr,
+                       DexInstruction* insn);
+
+/** \fn ref_str* dxc_compact_string(const DexCompactCode* code, dx_uint addr)
+ * \brief Returns the string operand of the instruction at addr or NULL if it
+ * has none.  The string belongs to the file; use dxc_copy_str() to keep it.
+ */
+extern
+ref_str* dxc_compact_string(const DexCompactCode* code, dx_uint addr);
+
+/** \fn ref_str* dxc_compact_type(const DexCompactCode* code, dx_uint addr)
+ * \brief Same as dxc_compact_string() for type operands.
+ */
+extern
+ref_str* dxc_compact_type(const DexCompactCode* code, dx_uint addr);
+
+/** \fn int dxc_compact_field(const DexCompactCode* code, dx_uint addr,
+ *                            ref_field* field)
+ * \brief Fills in field with the field operand of the instruction at addr.
+ * The strings belong to the file.  Returns 0 if there is no field operand.
+ */
+extern
+int dxc_compact_field(const DexCompactCode* code, dx_uint addr,
+                      ref_field* field);
+
+/** \fn int dxc_compact_method(const DexCompactCode* code, dx_uint addr,
+ *                             ref_method* method)
+ * \brief Same as dxc_compact_field() for method operands.
+ */
+extern
+int dxc_compact_method(const DexCompactCode* code, dx_uint addr,
+                       ref_method* method);
+
 #ifdef __cplusplus
 }
 #endif
@@ -67,7 +67,7 @@ typedef struct {
 
   /// NULL terminated list of strings giving the names of the parameters for
   /// this function.  If the ith parameter name is not available the string will
-  /// be empty.
+  /// be empty.  The list is empty when read with DXC_READ_NO_PARAMETER_NAMES.
   ref_strstr* parameter_names;
 
   /// The actual byte code of the state machine.  This array is ended the
@@ -48,11 +48,40 @@ typedef unsigned char dx_ubyte;
 /// of an existing char* or use dxc_copy_str to increment the refrence count and
 /// use dxc_free_str to decrement the reference count and possibly free the
 /// pointer.
+///
+/// Strings read from a file that keeps its input alive are borrowed: their
+/// characters point into the input buffer and they are owned by the DexFile
+/// rather than by their reference count.  They remain valid until the file is
+/// freed; use dxc_induct_str on s to keep a string beyond that.
+///
+/// The hash and lengths are filled in the first time they are needed, or
+/// before the string becomes immortal; use dxc_str_hash, dxc_str_len and
+/// dxc_str_utf16_len rather than reading them.  A zero hash means they have
+/// not been computed yet.
 typedef struct {
   dx_uint cnt;
-  char s[1];
+  char* s;
+  dx_uint hash;
+  dx_uint len;
+  dx_uint utf16_len;
 } ref_str;
 
+/// Flag in the reference count of an immortal ref_str or ref_strstr.  Such
+/// objects are owned by something else, such as a read-only file or an intern
+/// table, and copying or freeing them leaves them untouched.
+#define DXC_REF_IMMORTAL 0x80000000U
+
+/*! \fn void dxc_set_atomic_refcounts(int enable)
+ *  \brief Selects whether reference counts are updated with atomic operations
+ *  so that structures can be shared between threads.
+ *
+ *  This is off by default unless the library was configured with
+ *  --enable-atomic-refcount, in which case updates are always atomic.  Change
+ *  it before other threads start using the library.
+ */
+extern
+void dxc_set_atomic_refcounts(int enable);
+
 /*! \fn ref_str* dxc_induct_str(const char* s)
  *  \brief Copies the string pointed to s and creates a ref_str with the
  *  reference count set to 1.
@@ -63,8 +92,10 @@ ref_str* dxc_induct_str(const char* s);
 /*! \fn ref_str* dxc_copy_str(ref_str* s)
  *  \brief Returns a copy of the ref_str s.
  *
- *  What this really does is simply increment the reference count on s and
- *  returns s.
+ *  This increments the reference count on s and returns s.  Copying an
+ *  immortal (borrowed or interned) string returns the same pointer without
+ *  keeping it alive; a borrowed string is still only valid until its DexFile
+ *  is freed.  Use dxc_induct_str on s->s to keep such a string beyond that.
  */
 extern
 ref_str* dxc_copy_str(ref_str* s);
@@ -76,6 +107,45 @@ ref_str* dxc_copy_str(ref_str* s);
 extern
 void dxc_free_str(ref_str* s);
 
+/*! \fn dx_uint dxc_str_hash(ref_str* s)
+ *  \brief Returns the FNV-1a hash of the characters of s, computing and
+ *  caching it along with the lengths of s on first use.  A hash of 0 is
+ *  returned as 1.
+ */
+extern
+dx_uint dxc_str_hash(ref_str* s);
+
+/*! \fn dx_uint dxc_str_len(ref_str* s)
+ *  \brief Returns the length of s in bytes, not counting the terminator.
+ */
+extern
+dx_uint dxc_str_len(ref_str* s);
+
+/*! \fn dx_uint dxc_str_utf16_len(ref_str* s)
+ *  \brief Returns the number of UTF-16 code units s decodes to, or
+ *  (dx_uint)-1 if s is not valid MUTF-8.
+ */
+extern
+dx_uint dxc_str_utf16_len(ref_str* s);
+
+/*! \fn int dxc_str_equal(ref_str* a, ref_str* b)
+ *  \brief Returns nonzero if a and b hold the same characters.  Shared and
+ *  interned strings compare by pointer; otherwise the cached hashes and
+ *  lengths reject most unequal pairs without touching the characters.
+ */
+extern
+int dxc_str_equal(ref_str* a, ref_str* b);
+
+/*! \fn void dxc_make_immortal_str(ref_str* s)
+ *  \brief Marks s as immortal so that copies and frees no longer touch it.
+ *  The cached hash and lengths of s are computed first.
+ *
+ *  The caller becomes responsible for the lifetime of s.  Immortal strings are
+ *  never written to again, which keeps pages shared after fork().
+ */
+extern
+void dxc_make_immortal_str(ref_str* s);
+
 /// Represents a reference counted list of strings used throughout the api.
 /// This list is NULL terminated.  Use dxc_create_strstr and dxc_copy_strstr as
 /// you would with ref_str.
@@ -107,6 +177,13 @@ ref_strstr* dxc_copy_strstr(ref_strstr* s);
 extern
 void dxc_free_strstr(ref_strstr* s);
 
+/*! \fn void dxc_make_immortal_strstr(ref_strstr* s)
+ *  \brief Marks s as immortal like dxc_make_immortal_str().  The strings in
+ *  the list are not affected.
+ */
+extern
+void dxc_make_immortal_strstr(ref_strstr* s);
+
 typedef struct ref_field {
   ref_str* defining_class;
   ref_str* name;
@@ -30,9 +30,12 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <dxcut/field.h>
 #include <dxcut/file.h>
 #include <dxcut/handler.h>
+#include <dxcut/intern.h>
 #include <dxcut/method.h>
+#include <dxcut/scan.h>
 #include <dxcut/try_block.h>
 #include <dxcut/value.h>
+#include <dxcut/visit.h>
 #include <dxcut/util.h>
 
 #endif // __DXCUT_DXCUT_H
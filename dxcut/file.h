@@ -20,6 +20,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #define __DXCUT_FILE_H
 #include <stdio.h>
 #include <dxcut/class.h>
+#include <dxcut/intern.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -37,6 +38,55 @@ typedef enum {
   DEX_FLAG_INVOCATIONS = 8,
 } OdexFlags;
 
+/// \enum DexReadFlags
+/// \brief Flags controlling how a dex file is read.
+typedef enum {
+  /// Only parse the id tables when the file is opened.  Each class starts out
+  /// with just its name filled in and is decoded the first time it is looked
+  /// up with dxc_get_class() or when dxc_load_all_classes() is called.
+  DXC_READ_LAZY_CLASSES = 1,
+  /// Leave the code items of methods undecoded until they are accessed with
+  /// dxc_method_code().
+  DXC_READ_LAZY_CODE = 2,
+  /// Do not verify the Adler-32 checksums of the dex file and odex sections.
+  DXC_READ_SKIP_CHECKSUM = 4,
+  /// Do not verify the SHA-1 signature of the dex file.
+  DXC_READ_SKIP_SIGNATURE = 8,
+  /// Leave debug_information NULL on every code item.
+  DXC_READ_NO_DEBUG_INFO = 16,
+  /// Give classes, fields, methods and parameters empty annotation lists.
+  DXC_READ_NO_ANNOTATIONS = 32,
+  /// Leave the debug info parameter name lists empty.
+  DXC_READ_NO_PARAMETER_NAMES = 64,
+  /// Give every class an empty static value list.
+  DXC_READ_NO_STATIC_VALUES = 128,
+  /// Keep the code of each method as a ::DexCompactCode in compact_code
+  /// rather than decoding it into code_body.  Combined with
+  /// DXC_READ_LAZY_CODE the compact form is only built by
+  /// dxc_method_compact_code().
+  DXC_READ_COMPACT_CODE = 256,
+  /// Allocate every node of the file, including lazily decoded classes and
+  /// code, from one arena owned by the file.  dxc_free_file() then releases
+  /// the whole file at once instead of walking it.  Nodes of such a file must
+  /// not be freed individually; anything attached to it after reading is not
+  /// freed by dxc_free_file() and stays the caller's to release.
+  DXC_READ_ARENA = 512,
+} DexReadFlags;
+
+/// \brief Options for dxc_read_buffer_ex().  A zeroed structure gives the
+/// same behavior as dxc_read_buffer().
+typedef struct {
+  /// The sum of some of the DexReadFlags.
+  dx_uint flags;
+  /// The number of threads to decode the class section and compute the
+  /// checksum with.  0 and 1 both read on the calling thread.
+  dx_uint nthreads;
+  /// When not NULL every string and prototype of the id tables is replaced
+  /// by its canonical copy in this pool, so that files read with the same
+  /// pool share them.  The pool must outlive the file.
+  DexInternPool* intern_pool;
+} DexReadOptions;
+
 typedef struct {
   /// Dex identifier used for identification perposes.  This is a sha1 hash of
   /// the original dex file prior to optimizations.
@@ -105,14 +155,40 @@ typedef struct {
   /// by dxc_file_write().
   dx_uint type_table_size;
   ref_str** type_table;
+
+  /// Reader state that keeps the input of this file alive, such as the mapping
+  /// created by dxc_open_mmap().  Managed by the library and released by
+  /// dxc_free_file(); NULL for files that do not reference their input.
+  struct read_context_t* context;
 } DexFile;
 
 /** \fn DexFile* dxc_read_file(FILE* fin)
  *  \brief Read in the dex file given by the input stream.
+ *
+ *  The stream is read from its current position to its end and need not be
+ *  seekable, so pipes work.  The contents of the stream are kept with the
+ *  returned file and the strings of the file borrow from them.  See
+ *  ::ref_str.
  */
 extern
 DexFile* dxc_read_file(FILE* fin);
 
+/** \fn DexFile* dxc_read_fd(int fd)
+ *  \brief Same as dxc_read_file() for a file descriptor such as a pipe or a
+ *  socket.  The buffer is sized from the file size in the header once the
+ *  header has arrived and grown if more data follows.  The descriptor is
+ *  left open.
+ */
+extern
+DexFile* dxc_read_fd(int fd);
+
+/** \fn DexFile* dxc_read_fd_ex(int fd, const DexReadOptions* opts)
+ *  \brief Same as dxc_read_fd() but reads the file according to opts.  A
+ *  NULL opts behaves like a zeroed structure.
+ */
+extern
+DexFile* dxc_read_fd_ex(int fd, const DexReadOptions* opts);
+
 /** \fn DexFile* dxc_read_buffer(void* buf, dx_uint size)
  *  \brief Read in the dex file residing in memory at the address given by buf
  *  with length size.
@@ -120,14 +196,159 @@ DexFile* dxc_read_file(FILE* fin);
 extern
 DexFile* dxc_read_buffer(void* buf, dx_uint size);
 
+/** \fn DexFile* dxc_read_buffer_parallel(void* buf, dx_uint size,
+ *                                         dx_uint nthreads)
+ *  \brief Same as dxc_read_buffer() but decodes the classes using up to
+ *  nthreads threads.  The result is identical to that of dxc_read_buffer().
+ */
+extern
+DexFile* dxc_read_buffer_parallel(void* buf, dx_uint size, dx_uint nthreads);
+
+/** \fn DexFile* dxc_read_buffer_ex(void* buf, dx_uint size,
+ *                                   const DexReadOptions* opts)
+ *  \brief Same as dxc_read_buffer() but reads according to opts, which may be
+ *  NULL for the defaults.
+ *
+ *  Content dropped through the DXC_READ_NO_* flags is never decoded or
+ *  allocated.  With either of the lazy flags the buffer must stay valid until
+ *  the file is freed.
+ */
+extern
+DexFile* dxc_read_buffer_ex(void* buf, dx_uint size,
+                            const DexReadOptions* opts);
+
+/** \fn DexFile* dxc_open_mmap(const char* path)
+ *  \brief Read in the dex file at path by mapping it read-only into memory.
+ *
+ *  The mapping is kept alive until the file is released with dxc_close() so
+ *  that the parsed structures can refer to the file contents in place rather
+ *  than copying them; in particular the strings of the file are borrowed from
+ *  the mapping.  Returns NULL on failure.
+ */
+extern
+DexFile* dxc_open_mmap(const char* path);
+
+/** \fn DexFile* dxc_open_mmap_flags(const char* path, dx_uint flags)
+ *  \brief Same as dxc_open_mmap() but reads the file according to flags, the
+ *  sum of some of the DexReadFlags.
+ */
+extern
+DexFile* dxc_open_mmap_flags(const char* path, dx_uint flags);
+
+/** \fn DexFile* dxc_open_mmap_ex(const char* path,
+ *                                const DexReadOptions* opts)
+ *  \brief Same as dxc_open_mmap() but reads the file according to opts.  A
+ *  NULL opts behaves like a zeroed structure.
+ */
+extern
+DexFile* dxc_open_mmap_ex(const char* path, const DexReadOptions* opts);
+
+/** \fn void dxc_close(DexFile* dex)
+ *  \brief Free a DexFile opened with dxc_open_mmap() and unmap its backing
+ *  file.  Equivalent to dxc_free_file().
+ */
+extern
+void dxc_close(DexFile* dex);
+
+/// \brief A batch of files read together by dxc_read_files().
+typedef struct {
+  /// The number of paths that were read.
+  dx_uint count;
+  /// files[i] is the file read from the i-th path, or NULL if that path could
+  /// not be read.
+  DexFile** files;
+  /// The number of NULL entries in files.
+  dx_uint failed;
+  /// The pool every file in the set was interned with.
+  DexInternPool* intern_pool;
+  /// Nonzero if intern_pool was created for the set and is freed with it.
+  int owns_intern_pool;
+} DexFileSet;
+
+/** \fn DexFileSet* dxc_read_files(const char* const* paths, dx_uint n,
+ *          const DexReadOptions* opts, dx_uint nthreads)
+ *  \brief Maps and reads the n files in paths as dxc_open_mmap_ex() would,
+ *  using up to nthreads threads across the files.
+ *
+ *  Threads take the next unread file whenever they finish one, largest files
+ *  first.  Every file is read with the intern pool of opts, or with a pool
+ *  created for the set if opts has none, so that the files share their
+ *  strings and prototypes.  opts->nthreads still applies within each file.
+ *  A file that fails to read leaves a NULL entry and does not stop the
+ *  others.  Returns NULL only if the set itself cannot be allocated.
+ */
+extern
+DexFileSet* dxc_read_files(const char* const* paths, dx_uint n,
+                           const DexReadOptions* opts, dx_uint nthreads);
+
+/** \fn void dxc_free_file_set(DexFileSet* set)
+ *  \brief Frees every file of the set, then its intern pool if the set owns
+ *  it, then the set itself.
+ */
+extern
+void dxc_free_file_set(DexFileSet* set);
+
+/** \fn DexClass* dxc_get_class(DexFile* dex, const char* descriptor)
+ *  \brief Returns the class with the given type descriptor (such as
+ *  "Ljava/lang/Object;") or NULL if there is no such class.
+ *
+ *  For files read with DXC_READ_LAZY_CLASSES the lookup goes through a hash
+ *  index over the class defs, built from the names the classes had when the
+ *  file was read, and decodes the class if it has not been decoded yet.
+ */
+extern
+DexClass* dxc_get_class(DexFile* dex, const char* descriptor);
+
+/** \fn int dxc_load_all_classes(DexFile* dex)
+ *  \brief Decodes every class of a file read with DXC_READ_LAZY_CLASSES that
+ *  has not been decoded yet.  Returns 0 on failure.  Does nothing for files
+ *  that were read eagerly.
+ */
+extern
+int dxc_load_all_classes(DexFile* dex);
+
 /** \fn void dxc_write_file(DexFile* dex, FILE* fout)
  *  \brief Write out the DexFile structure to a file.
+ *
+ *  Code that was read with DXC_READ_LAZY_CODE or DXC_READ_COMPACT_CODE and
+ *  never expanded with dxc_method_code() cannot have changed; it is copied
+ *  from the input with only its pool indices rewritten instead of being
+ *  decoded and encoded again.
  */
 extern
 void dxc_write_file(DexFile* dex, FILE* fout);
 
+typedef enum {
+  /// Let methods whose code items encode to identical bytes share one code
+  /// item.  The format permits this and it saves the space of trivial bodies
+  /// such as getters and constructors repeated across classes.
+  DXC_WRITE_SHARE_CODE_ITEMS = 1,
+} DexWriteFlags;
+
+/// \brief Options for dxc_write_file_ex().  A zeroed structure gives the
+/// same behavior as dxc_write_file().
+typedef struct {
+  /// The sum of some of the DexWriteFlags.
+  dx_uint flags;
+  /// The number of threads to collect the constant pool and encode the
+  /// classes with.  0 and 1 both write on the calling thread.  The output
+  /// does not depend on it.
+  dx_uint nthreads;
+} DexWriteOptions;
+
+/** \fn void dxc_write_file_ex(DexFile* dex, FILE* fout,
+ *                             const DexWriteOptions* opts)
+ *  \brief Same as dxc_write_file() but writes the file according to opts.  A
+ *  NULL opts behaves like a zeroed structure.
+ */
+extern
+void dxc_write_file_ex(DexFile* dex, FILE* fout, const DexWriteOptions* opts);
+
 /** \fn void dxc_free_file(DexFile* dex)
  *  \brief Free the entire DexFile structure including the given pointer itself.
+ *
+ *  Files read with DXC_READ_ARENA are released block by block without walking
+ *  their nodes.
  */
 extern
 void dxc_free_file(DexFile* dex);
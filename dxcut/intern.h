@@ -0,0 +1,67 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+/*! \file intern.h
+ *  \brief Canonical strings and prototypes shared between dex files.
+ *
+ * An intern pool maps every distinct MUTF-8 string and every distinct
+ * prototype to one immortal object owned by the pool.  Files read with the
+ * same pool through DexReadOptions share these objects, so a string used by
+ * many files is stored once and two interned strings or prototypes are equal
+ * exactly when they are the same pointer.
+ */
+#ifndef __DXCUT_INTERN_H
+#define __DXCUT_INTERN_H
+#include <dxcut/dex.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dex_intern_pool_t DexInternPool;
+
+/** \fn DexInternPool* dxc_create_intern_pool(void)
+ *  \brief Creates an empty intern pool.  Returns NULL if out of memory.
+ */
+extern
+DexInternPool* dxc_create_intern_pool(void);
+
+/** \fn void dxc_free_intern_pool(DexInternPool* pool)
+ *  \brief Frees the pool and every object in it.  Every file read with the
+ *  pool must be freed first.
+ */
+extern
+void dxc_free_intern_pool(DexInternPool* pool);
+
+/** \fn ref_str* dxc_intern_str(DexInternPool* pool, const char* s)
+ *  \brief Returns the pool's canonical copy of s, adding it if it is not
+ *  there yet.  The result is immortal and valid until the pool is freed.
+ *  Safe to call from several threads at once.  Returns NULL if out of memory.
+ */
+extern
+ref_str* dxc_intern_str(DexInternPool* pool, const char* s);
+
+/** \fn ref_strstr* dxc_intern_strstr(DexInternPool* pool,
+ *                                   ref_str* const* s)
+ *  \brief Same as dxc_intern_str() for the NULL terminated string list s,
+ *  such as a prototype.  The strings of the result are themselves interned.
+ */
+extern
+ref_strstr* dxc_intern_strstr(DexInternPool* pool, ref_str* const* s);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // __DXCUT_INTERN_H
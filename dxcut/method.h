@@ -37,7 +37,9 @@ typedef struct {
   ref_strstr* prototype;
   
   /// A pointer to the code body for this method or NULL if this method is
-  /// either abstract or native.
+  /// either abstract or native.  For files read with DXC_READ_LAZY_CODE or
+  /// DXC_READ_COMPACT_CODE this is NULL until the code is decoded; use
+  /// dxc_method_code() to access it.
   DexCode* code_body;
   
   /// A sentinel terminated list of Annotations that are applied directly to
@@ -48,6 +50,17 @@ typedef struct {
   /// to each of the parameters of this method.  The length of this list
   /// should be the same as the number of parameters in the prototype.
   DexAnnotation** parameter_annotations;
+
+  /// The offset of the code item that has not been decoded into code_body yet
+  /// or 0.  Clear this when assigning code_body on such a method.
+  dx_uint code_off;
+
+  /// The reader state code_off refers to.
+  struct read_context_t* code_source;
+
+  /// The code of a method read with DXC_READ_COMPACT_CODE while code_body is
+  /// still NULL.  dxc_method_code() expands it into code_body and frees it.
+  DexCompactCode* compact_code;
 } DexMethod;
 
 /** \fn void dxc_free_method(DexMethod* method)
@@ -57,6 +70,24 @@ typedef struct {
 extern
 void dxc_free_method(DexMethod* method);
 
+/** \fn DexCode* dxc_method_code(DexMethod* method)
+ *  \brief Returns the code body of this method, decoding it first if the
+ *  method came from a file read with DXC_READ_LAZY_CODE or
+ *  DXC_READ_COMPACT_CODE.  Returns NULL if the method has no code or the code
+ *  could not be decoded.
+ */
+extern
+DexCode* dxc_method_code(DexMethod* method);
+
+/** \fn DexCompactCode* dxc_method_compact_code(DexMethod* method)
+ *  \brief Returns the compact form of the code of this method, reading it
+ *  first if the method came from a file read with DXC_READ_LAZY_CODE.
+ *  Returns NULL if the method has no code, its code was already expanded into
+ *  code_body or the code could not be read.
+ */
+extern
+DexCompactCode* dxc_method_compact_code(DexMethod* method);
+
 /** \fn int dxc_is_sentinel_method(DexMethod* method)
  *  \brief Returns true if this method marks the end of a method list.
  */
@@ -0,0 +1,101 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+/*! \file scan.h
+ *  \brief Symbol lookups over the id tables of a dex file.
+ *
+ * dxc_scan_ids() only looks at the header and the string, type, proto, field
+ * and method id tables of a dex file; class definitions, code and annotations
+ * are never touched.  The lookups binary search the id tables using the sort
+ * order the dex format requires of them, so answering whether a file
+ * references a given symbol costs a handful of string comparisons.
+ */
+#ifndef __DXCUT_SCAN_H
+#define __DXCUT_SCAN_H
+#include <dxcut/dex.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dex_id_scan_t DexIdScan;
+
+/** \fn DexIdScan* dxc_scan_ids(const void* buf, dx_uint size)
+ *  \brief Locates the id tables of the dex file, or of the dex file embedded
+ *  in the odex file, in buf.  The buffer must stay valid until the scan is
+ *  freed.  Returns NULL if the file is malformed or big-endian.
+ */
+extern
+DexIdScan* dxc_scan_ids(const void* buf, dx_uint size);
+
+/** \fn void dxc_free_scan(DexIdScan* scan)
+ *  \brief Frees a scan returned by dxc_scan_ids().
+ */
+extern
+void dxc_free_scan(DexIdScan* scan);
+
+/** \fn const char* dxc_scan_string(const DexIdScan* scan, dx_uint idx)
+ *  \brief Returns string idx of the file as NUL terminated MUTF-8 pointing
+ *  into the buffer, or NULL if idx is out of range or the string is
+ *  malformed.
+ */
+extern
+const char* dxc_scan_string(const DexIdScan* scan, dx_uint idx);
+
+/** \fn const char* dxc_scan_type(const DexIdScan* scan, dx_uint idx)
+ *  \brief Same as dxc_scan_string() for the descriptor of type idx.
+ */
+extern
+const char* dxc_scan_type(const DexIdScan* scan, dx_uint idx);
+
+/** \fn dx_int dxc_scan_find_string(const DexIdScan* scan, const char* s)
+ *  \brief Returns the index of the string s or -1 if the file does not
+ *  contain it.
+ */
+extern
+dx_int dxc_scan_find_string(const DexIdScan* scan, const char* s);
+
+/** \fn dx_int dxc_scan_find_type(const DexIdScan* scan,
+ *                               const char* descriptor)
+ *  \brief Returns the index of the type with the given descriptor or -1.
+ */
+extern
+dx_int dxc_scan_find_type(const DexIdScan* scan, const char* descriptor);
+
+/** \fn dx_int dxc_scan_find_field(const DexIdScan* scan,
+ *          const char* defining_class, const char* name, const char* type)
+ *  \brief Returns the index of the field id matching all three parts or -1.
+ */
+extern
+dx_int dxc_scan_find_field(const DexIdScan* scan, const char* defining_class,
+                           const char* name, const char* type);
+
+/** \fn dx_int dxc_scan_find_method(const DexIdScan* scan,
+ *          const char* defining_class, const char* name,
+ *          const char* const* prototype)
+ *  \brief Returns the index of the method id matching all parts or -1.
+ *
+ *  prototype is a NULL terminated list holding the return type followed by
+ *  the parameter types, laid out like the strings of a ::ref_strstr
+ *  prototype.
+ */
+extern
+dx_int dxc_scan_find_method(const DexIdScan* scan, const char* defining_class,
+                            const char* name, const char* const* prototype);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // __DXCUT_SCAN_H
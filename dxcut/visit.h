@@ -0,0 +1,202 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+/*! \file visit.h
+ *  \brief Streaming, callback based traversal of a dex file.
+ *
+ * dxc_visit_buffer() walks the classes of a dex file held in memory and
+ * reports what it finds through the callbacks of a DexVisitor without building
+ * a DexFile.  Nothing is allocated per item; the views passed to the callbacks
+ * live on the stack and their strings point straight into the buffer as NUL
+ * terminated MUTF-8.  Views and their strings are only valid during the
+ * callback, though the strings themselves stay valid as long as the buffer.
+ */
+#ifndef __DXCUT_VISIT_H
+#define __DXCUT_VISIT_H
+#include <dxcut/annotation.h>
+#include <dxcut/dalvik.h>
+#include <dxcut/dex.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// \enum DexVisitResult
+/// \brief Returned by the visitor callbacks to steer the traversal.
+typedef enum {
+  /// Keep going, including into the children of the current item.
+  DXC_VISIT_CONTINUE = 0,
+  /// Skip the children of the current item: the members and annotations of a
+  /// class, the code of a method or the instructions of a code item.
+  DXC_VISIT_SKIP = 1,
+  /// Stop the traversal altogether.
+  DXC_VISIT_STOP = 2,
+} DexVisitResult;
+
+/// \enum DexAnnotationTarget
+/// \brief What a visited annotation is attached to.
+typedef enum {
+  DXC_ANNOTATION_CLASS = 0,
+  DXC_ANNOTATION_FIELD = 1,
+  DXC_ANNOTATION_METHOD = 2,
+  DXC_ANNOTATION_PARAMETER = 3,
+} DexAnnotationTarget;
+
+struct dex_visit_context_t;
+
+typedef struct {
+  const char* defining_class;
+  const char* name;
+  const char* type;
+} DexFieldView;
+
+typedef struct {
+  const char* defining_class;
+  const char* name;
+  const char* return_type;
+  /// The number of parameters, see dxc_visit_parameter().
+  dx_uint parameters_size;
+
+  /// Internal, used by dxc_visit_parameter().
+  const struct dex_visit_context_t* ctx;
+  dx_uint parameters_off;
+} DexMethodView;
+
+typedef struct {
+  const char* name;
+  dx_uint access_flags;
+  /// NULL if the class has no super class.
+  const char* super_class;
+  /// NULL if the source file is unknown.
+  const char* source_file;
+  /// The number of implemented interfaces, see dxc_visit_interface().
+  dx_uint interfaces_size;
+
+  /// Internal, used by dxc_visit_interface().
+  const struct dex_visit_context_t* ctx;
+  dx_uint interfaces_off;
+} DexClassView;
+
+typedef struct {
+  dx_ushort registers_size;
+  dx_ushort ins_size;
+  dx_ushort outs_size;
+  dx_ushort tries_size;
+  /// The raw code units of the method.
+  const dx_ushort* insns;
+  dx_uint insns_size;
+} DexCodeView;
+
+typedef struct {
+  /// Offset of the instruction in code units from the start of the method.
+  dx_uint address;
+  /// The raw code units of the instruction, including the whole table for
+  /// switch and array data payloads.
+  const dx_ushort* units;
+  dx_uint size;
+  /// Same meaning as in ::DexInstruction.
+  dx_ubyte opcode;
+  dx_ubyte hi_byte;
+  dx_ushort param[2];
+  /// The type of special information decoded into special; SPECIAL_NONE for
+  /// payload pseudo instructions.
+  DexOpSpecialType special_type;
+  union {
+    dx_long constant;
+    dx_int target;
+    const char* str;
+    const char* type;
+    DexFieldView field;
+    DexMethodView method;
+    /// The inline, object offset or vtable index for optimized instructions.
+    dx_uint index;
+  } special;
+} DexInstructionView;
+
+typedef struct {
+  DexAnnotationTarget target;
+  /// The annotated field for DXC_ANNOTATION_FIELD, otherwise NULL.
+  const DexFieldView* field;
+  /// The annotated method for DXC_ANNOTATION_METHOD and
+  /// DXC_ANNOTATION_PARAMETER, otherwise NULL.
+  const DexMethodView* method;
+  /// The parameter index for DXC_ANNOTATION_PARAMETER.
+  dx_uint parameter;
+  DexAnnotationVisibility visibility;
+  const char* type;
+  /// The number of name value pairs and their encoded form, exactly as they
+  /// appear in an encoded_annotation after the size.
+  dx_uint elements_size;
+  const dx_ubyte* elements;
+} DexAnnotationView;
+
+/// \brief Callbacks for dxc_visit_buffer().  Any callback may be NULL.  Each
+/// receives the user pointer of the visitor first.
+typedef struct {
+  void* user;
+
+  DexVisitResult (*visit_class)(void* user, const DexClassView* cl);
+  DexVisitResult (*end_class)(void* user, const DexClassView* cl);
+  DexVisitResult (*visit_field)(void* user, const DexClassView* cl,
+                                const DexFieldView* field,
+                                dx_uint access_flags, int is_static);
+  DexVisitResult (*visit_method)(void* user, const DexClassView* cl,
+                                 const DexMethodView* method,
+                                 dx_uint access_flags, int is_direct);
+  DexVisitResult (*visit_code)(void* user, const DexMethodView* method,
+                               const DexCodeView* code);
+  DexVisitResult (*visit_instruction)(void* user, const DexMethodView* method,
+                                      const DexInstructionView* insn);
+  DexVisitResult (*visit_annotation)(void* user, const DexClassView* cl,
+                                     const DexAnnotationView* annotation);
+} DexVisitor;
+
+/** \fn int dxc_visit_buffer(const void* buf, dx_uint size,
+ *                          const DexVisitor* visitor)
+ *  \brief Walk the dex file in buf, reporting each class followed by its
+ *  annotations, fields and methods, each method followed by its code and
+ *  instructions.
+ *
+ *  Checksums are not verified.  The dex file embedded in an odex file is
+ *  walked the same way; big-endian images are not accepted.  Returns 1 if the
+ *  traversal finished or was stopped by a callback and 0 if the file is
+ *  malformed.
+ */
+extern
+int dxc_visit_buffer(const void* buf, dx_uint size, const DexVisitor* visitor);
+
+/** \fn const char* dxc_visit_parameter(const DexMethodView* method, dx_uint i)
+ *  \brief Returns the type of parameter i of method or NULL if out of range.
+ */
+extern
+const char* dxc_visit_parameter(const DexMethodView* method, dx_uint i);
+
+/** \fn const char* dxc_visit_interface(const DexClassView* cl, dx_uint i)
+ *  \brief Returns interface i of cl or NULL if out of range.
+ */
+extern
+const char* dxc_visit_interface(const DexClassView* cl, dx_uint i);
+
+/** \fn dx_int dxc_visit_register(const DexInstructionView* insn,
+ *                               dx_uint index)
+ *  \brief Same as dxc_get_register() for a visited instruction.
+ */
+extern
+dx_int dxc_visit_register(const DexInstructionView* insn, dx_uint index);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // __DXCUT_VISIT_H
@@ -15,6 +15,7 @@ this program; if not, write to the Free Software Foundation, Inc., 59 Temple
 Place, Suite 330, Boston, MA 02111-1307 USA
 */
 #include "annotations.h"
+#include "read.h"
 #include "values.h"
 
 #include <stdlib.h>
@@ -30,13 +31,13 @@ int dxc_read_encoded_annotation(read_context* ctx, DexAnnotation* annotation,
   }
   if(has_visibility) {
     annotation->visibility = (DexAnnotationVisibility)
-        ctx->read_ubyte(ctx, off);
+        dxc_read_ubyte(ctx, off);
   } else {
     annotation->visibility = VISIBILITY_NONE;
   }
 
-  dx_uint type_idx = ctx->read_uleb(ctx, off);
-  dx_uint size = ctx->read_uleb(ctx, off);
+  dx_uint type_idx = dxc_read_uleb(ctx, off);
+  dx_uint size = dxc_read_uleb(ctx, off);
   if(!dxc_in_data(ctx, *off)) {
     DXC_ERROR("encoded annotation not within data section");
     return 0;
@@ -46,8 +47,8 @@ int dxc_read_encoded_annotation(read_context* ctx, DexAnnotation* annotation,
     return 0;
   }
   annotation->type = dxc_copy_str(ctx->types[type_idx]);
-  annotation->parameters = (DexNameValuePair*)calloc(size + 1,
-                                                     sizeof(DexNameValuePair));
+  annotation->parameters = (DexNameValuePair*)dxc_ctx_calloc(ctx, size + 1,
+      sizeof(DexNameValuePair));
   if(!annotation->parameters) {
     DXC_ERROR("annotation parameter alloc failed");
     return 0;
@@ -55,7 +56,7 @@ int dxc_read_encoded_annotation(read_context* ctx, DexAnnotation* annotation,
   dxc_make_sentinel_parameter(annotation->parameters + size);
   dx_uint i;
   for(i = 0; i < size; i++) {
-    dx_uint name_idx = ctx->read_uleb(ctx, off);
+    dx_uint name_idx = dxc_read_uleb(ctx, off);
     if(!dxc_in_data(ctx, *off)) {
       DXC_ERROR("encoded annotation not within data section");
       return 0;
@@ -78,13 +79,14 @@ int dxc_read_annotation_list(read_context* ctx, DexAnnotation** anlist,
     DXC_ERROR("annotation list item not within data section");
     return 0;
   }
-  dx_uint size = ctx->read_uint(ctx, &off);
+  dx_uint size = dxc_read_uint(ctx, &off);
   if(!dxc_read_ok(ctx, off, size * 4)) {
     DXC_ERROR("annotation list item not within data section");
     return 0;
   }
   DexAnnotation* res;
-  *anlist = res = (DexAnnotation*)calloc(size + 1, sizeof(DexAnnotation));
+  *anlist = res = (DexAnnotation*)dxc_ctx_calloc(ctx, size + 1,
+                                                 sizeof(DexAnnotation));
   if(!res) {
     DXC_ERROR("annotation list alloc failed");
     return 0;
@@ -92,7 +94,7 @@ int dxc_read_annotation_list(read_context* ctx, DexAnnotation** anlist,
   dxc_make_sentinel_annotation(res + size);
   dx_uint i;
   for(i = 0; i < size; i++) {
-    dx_uint annon_off = ctx->read_uint(ctx, &off);
+    dx_uint annon_off = dxc_read_uint(ctx, &off);
     if(!dxc_read_encoded_annotation(ctx, res + i, &annon_off, 0, 1)) {
       return 0;
     }
@@ -106,16 +108,17 @@ int dxc_read_annotation_directory(read_context* ctx, DexClass* cl,
     DXC_ERROR("annotation directory not within data section");
     return 0;
   }
-  dx_uint class_annotation_off = ctx->read_uint(ctx, &off);
-  dx_uint fsz = ctx->read_uint(ctx, &off);
-  dx_uint msz = ctx->read_uint(ctx, &off);
-  dx_uint psz = ctx->read_uint(ctx, &off);
+  dx_uint class_annotation_off = dxc_read_uint(ctx, &off);
+  dx_uint fsz = dxc_read_uint(ctx, &off);
+  dx_uint msz = dxc_read_uint(ctx, &off);
+  dx_uint psz = dxc_read_uint(ctx, &off);
   if(!dxc_read_ok(ctx, off, (fsz + msz + psz) * 8)) {
     DXC_ERROR("annotation directory not within data section");
     return 0;
   }
   if(class_annotation_off == 0) {
-    if(!(cl->annotations = (DexAnnotation*)calloc(1, sizeof(DexAnnotation)))) {
+    if(!(cl->annotations =
+         (DexAnnotation*)dxc_ctx_calloc(ctx, 1, sizeof(DexAnnotation)))) {
       DXC_ERROR("annotation directory alloc failed");
       return 0;
     }
@@ -127,56 +130,69 @@ int dxc_read_annotation_directory(read_context* ctx, DexClass* cl,
   }
   dx_uint i;
   for(i = 0; i < fsz; i++) {
-    dx_uint field_idx = ctx->read_uint(ctx, &off);
-    dx_uint annotation_off = ctx->read_uint(ctx, &off);
+    dx_uint field_idx = dxc_read_uint(ctx, &off);
+    dx_uint annotation_off = dxc_read_uint(ctx, &off);
     if(field_idx >= ctx->fields_sz) {
       DXC_ERROR("annotation field index too large");
       return 0;
     }
+    if(!dxc_str_equal(ctx->fields[field_idx].defining_class, cl->name)) {
+      DXC_ERROR("annotated field not defined by annotated class");
+      return 0;
+    }
     if(!dxc_read_annotation_list(ctx, &ctx->fields[field_idx].annotations,
                                  annotation_off)) {
       return 0;
     }
   }
   for(i = 0; i < msz; i++) {
-    dx_uint method_idx = ctx->read_uint(ctx, &off);
-    dx_uint annotation_off = ctx->read_uint(ctx, &off);
+    dx_uint method_idx = dxc_read_uint(ctx, &off);
+    dx_uint annotation_off = dxc_read_uint(ctx, &off);
     if(method_idx >= ctx->methods_sz) {
       DXC_ERROR("annotation method index too large");
       return 0;
     }
+    if(!dxc_str_equal(ctx->methods[method_idx].defining_class, cl->name)) {
+      DXC_ERROR("annotated method not defined by annotated class");
+      return 0;
+    }
     if(!dxc_read_annotation_list(ctx, &ctx->methods[method_idx].annotations,
                                  annotation_off)) {
       return 0;
     }
   }
   for(i = 0; i < psz; i++) {
-    dx_uint method_idx = ctx->read_uint(ctx, &off);
-    dx_uint annotation_off = ctx->read_uint(ctx, &off);
+    dx_uint method_idx = dxc_read_uint(ctx, &off);
+    dx_uint annotation_off = dxc_read_uint(ctx, &off);
     if(method_idx >= ctx->methods_sz) {
       DXC_ERROR("annotation method index too large");
       return 0;
     }
+    if(!dxc_str_equal(ctx->methods[method_idx].defining_class, cl->name)) {
+      DXC_ERROR("annotated method not defined by annotated class");
+      return 0;
+    }
     if(!dxc_read_ok(ctx, annotation_off, 4)) {
       DXC_ERROR("annotation set ref list not within data section");
       return 0;
     }
-    dx_uint params = ctx->read_uint(ctx, &annotation_off);
+    dx_uint params = dxc_read_uint(ctx, &annotation_off);
     if(!dxc_read_ok(ctx, annotation_off, 4 * params)) {
       DXC_ERROR("annotation set ref list not within data section");
       return 0;
     }
     if(!(ctx->methods[method_idx].parameter_annotations =
-        (DexAnnotation**)calloc(params + 1, sizeof(DexAnnotation*)))) {
+        (DexAnnotation**)dxc_ctx_calloc(ctx, params + 1,
+                                        sizeof(DexAnnotation*)))) {
       DXC_ERROR("annotation set ref list alloc failed");
       return 0;
     }
     dx_uint j;
     for(j = 0; j < params; j++) {
-      dx_uint annon_off = ctx->read_uint(ctx, &annotation_off);
+      dx_uint annon_off = dxc_read_uint(ctx, &annotation_off);
       if(annon_off == 0) {
         if(!(ctx->methods[method_idx].parameter_annotations[j] =
-            (DexAnnotation*)calloc(1, sizeof(DexAnnotation)))) {
+            (DexAnnotation*)dxc_ctx_calloc(ctx, 1, sizeof(DexAnnotation)))) {
           DXC_ERROR("annotation set ref list alloc failed");
           return 0;
         }
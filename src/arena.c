@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "arena.h"
+
+#include <stdlib.h>
+
+/* Size of a regular block.  Requests above a quarter of this get a block of
+ * their own so that they do not strand the tail of the current one. */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct arena_block_t {
+  struct arena_block_t* next;
+  size_t size;
+  size_t used;
+} arena_block;
+
+/* Header size rounded up so the data that follows is aligned. */
+#define BLOCK_HEADER \
+  ((sizeof(arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct dxc_arena_t {
+  /* The block allocations are bumped out of. */
+  arena_block* current;
+  /* Every other block, full or dedicated to one large request. */
+  arena_block* retired;
+};
+
+static
+arena_block* new_block(size_t size) {
+  arena_block* block = (arena_block*)calloc(1, BLOCK_HEADER + size);
+  if(block) block->size = size;
+  return block;
+}
+
+static
+void push_retired(dxc_arena* arena, arena_block* block) {
+  arena_block* head = __atomic_load_n(&arena->retired, __ATOMIC_RELAXED);
+  do {
+    block->next = head;
+  } while(!__atomic_compare_exchange_n(&arena->retired, &head, block, 1,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+dxc_arena* dxc_arena_create(void) {
+  return (dxc_arena*)calloc(1, sizeof(dxc_arena));
+}
+
+void* dxc_arena_alloc(dxc_arena* arena, size_t size) {
+  size = size ? (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1) :
+                ARENA_ALIGN;
+  if(size > ARENA_BLOCK_SIZE / 4) {
+    arena_block* block = new_block(size);
+    if(!block) return NULL;
+    block->used = size;
+    push_retired(arena, block);
+    return (char*)block + BLOCK_HEADER;
+  }
+
+  arena_block* block = __atomic_load_n(&arena->current, __ATOMIC_ACQUIRE);
+  for(;;) {
+    if(block) {
+      size_t off = __atomic_fetch_add(&block->used, size, __ATOMIC_RELAXED);
+      if(off + size <= block->size) {
+        return (char*)block + BLOCK_HEADER + off;
+      }
+    }
+
+    /* The block is full.  Whoever swaps in a replacement first wins; the
+     * losers drop theirs and retry against the winner's. */
+    arena_block* fresh = new_block(ARENA_BLOCK_SIZE);
+    if(!fresh) return NULL;
+    if(__atomic_compare_exchange_n(&arena->current, &block, fresh, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      if(block) push_retired(arena, block);
+      block = fresh;
+    } else {
+      free(fresh);
+    }
+  }
+}
+
+void dxc_arena_destroy(dxc_arena* arena) {
+  if(!arena) return;
+  arena_block* block = arena->retired;
+  while(block) {
+    arena_block* next = block->next;
+    free(block);
+    block = next;
+  }
+  free(arena->current);
+  free(arena);
+}
@@ -0,0 +1,39 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef DEX_ARENA_H
+#define DEX_ARENA_H
+
+#include <stddef.h>
+
+/* A bump allocator for the nodes of a file read with DXC_READ_ARENA.  Memory
+ * is handed out from large zeroed blocks and is only ever released all at
+ * once by dxc_arena_destroy().  Allocation is lock free so the threads of a
+ * parallel read can share one arena. */
+typedef struct dxc_arena_t dxc_arena;
+
+extern
+dxc_arena* dxc_arena_create(void);
+
+/* Returns size zeroed bytes aligned for any node type, or NULL if out of
+ * memory. */
+extern
+void* dxc_arena_alloc(dxc_arena* arena, size_t size);
+
+extern
+void dxc_arena_destroy(dxc_arena* arena);
+
+#endif // DEX_ARENA_H
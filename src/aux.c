@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "read.h"
+
 #define AUX_TYPE_OLD 0
 #define AUX_TYPE_NEW 1
 
@@ -19,10 +21,10 @@ int dxc_read_deps_table(read_context* ctx, OdexData* metadata,
     DXC_ERROR("deps section too small");
     return 0;
   }
-  metadata->dex_mod_time = ctx->read_uint(ctx, &deps_off);
-  metadata->dex_crc = ctx->read_uint(ctx, &deps_off);
-  metadata->vm_version = ctx->read_uint(ctx, &deps_off);
-  dx_uint sz = ctx->read_uint(ctx, &deps_off);
+  metadata->dex_mod_time = dxc_read_uint(ctx, &deps_off);
+  metadata->dex_crc = dxc_read_uint(ctx, &deps_off);
+  metadata->vm_version = dxc_read_uint(ctx, &deps_off);
+  dx_uint sz = dxc_read_uint(ctx, &deps_off);
   
   dx_uint i;
   if(!(metadata->deps = dxc_create_strstr(sz)) ||
@@ -35,7 +37,7 @@ int dxc_read_deps_table(read_context* ctx, OdexData* metadata,
       DXC_ERROR("deps leaves deps section");
       return 0;
     }
-    dx_uint ln = ctx->read_uint(ctx, &deps_off);
+    dx_uint ln = dxc_read_uint(ctx, &deps_off);
     if(deps_off + ln + 20 > deps_end) {
       DXC_ERROR("deps leaves deps section");
       return 0;
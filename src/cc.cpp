@@ -380,9 +380,10 @@ void fill_method(ccDexMethod& ccmethod, const DexMethod* method) {
   ccmethod.access_flags = method->access_flags;
   ccmethod.name = method->name->s;
   fill_str_array(ccmethod.prototype, method->prototype->s);
-  if(method->code_body) {
+  const DexCode* code = dxc_method_code(const_cast<DexMethod*>(method));
+  if(code) {
     ccmethod.code_body = new ccDexCode;
-    fill_code_body(*ccmethod.code_body, method->code_body);
+    fill_code_body(*ccmethod.code_body, code);
   } else {
     ccmethod.code_body = NULL;
   }
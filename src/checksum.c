@@ -0,0 +1,228 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "file.h"
+
+#include <stdlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "threads.h"
+
+static
+const dx_uint ADLER_CHECKSUM_MODULUS = 65521;
+
+/* Largest n such that 255 * n * (n + 1) / 2 + (n + 1) * (BASE - 1) fits in 32
+ * bits; the sums are only reduced once per this many bytes. */
+#define ADLER_BLOCK 5552
+
+/* Buffers at least this large get split up between threads. */
+#define ADLER_PARALLEL_MIN (4 << 20)
+#define ADLER_CHUNK (1 << 20)
+
+static
+dx_uint adler_scalar(dx_uint adler, const dx_ubyte* buf, dx_uint size) {
+  dx_uint A = adler & 0xFFFF;
+  dx_uint B = adler >> 16;
+  while(size) {
+    dx_uint n = size < ADLER_BLOCK ? size : ADLER_BLOCK;
+    size -= n;
+    for(; n >= 4; n -= 4, buf += 4) {
+      A += buf[0]; B += A;
+      A += buf[1]; B += A;
+      A += buf[2]; B += A;
+      A += buf[3]; B += A;
+    }
+    for(; n; n--) {
+      A += *buf++;
+      B += A;
+    }
+    A %= ADLER_CHECKSUM_MODULUS;
+    B %= ADLER_CHECKSUM_MODULUS;
+  }
+  return B << 16 | A;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Both vector kernels consume whole chunks of W bytes from a block of N bytes
+ * and use that for the block
+ *   A' = A + sum(b[i])
+ *   B' = B + N * A + sum((N - i) * b[i])
+ * where N - i splits into W * (chunks after the byte's chunk) + (W - i % W).
+ * The first term is accumulated by adding the running byte sum into a prefix
+ * sum before each chunk, the second with a weighted multiply-add. */
+
+__attribute__((target("sse2")))
+static
+dx_uint adler_sse2(dx_uint adler, const dx_ubyte* buf, dx_uint size) {
+  dx_uint A = adler & 0xFFFF;
+  dx_uint B = adler >> 16;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i w_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+  const __m128i w_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+  while(size >= 16) {
+    dx_uint n = size < ADLER_BLOCK ? size & ~15U : ADLER_BLOCK & ~15U;
+    size -= n;
+    B += n * A;
+    __m128i v_sum = zero;
+    __m128i v_prefix = zero;
+    __m128i v_weighted = zero;
+    for(; n; n -= 16, buf += 16) {
+      __m128i b = _mm_loadu_si128((const __m128i*)buf);
+      v_prefix = _mm_add_epi32(v_prefix, v_sum);
+      v_sum = _mm_add_epi32(v_sum, _mm_sad_epu8(b, zero));
+      v_weighted = _mm_add_epi32(v_weighted,
+          _mm_madd_epi16(_mm_unpacklo_epi8(b, zero), w_lo));
+      v_weighted = _mm_add_epi32(v_weighted,
+          _mm_madd_epi16(_mm_unpackhi_epi8(b, zero), w_hi));
+    }
+    dx_uint lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, v_sum);
+    A += lanes[0] + lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, v_prefix);
+    dx_ulong prefix = (dx_ulong)lanes[0] + lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, v_weighted);
+    dx_ulong weighted = (dx_ulong)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    B = (B + 16 * prefix + weighted) % ADLER_CHECKSUM_MODULUS;
+    A %= ADLER_CHECKSUM_MODULUS;
+  }
+  return adler_scalar(B << 16 | A, buf, size);
+}
+
+__attribute__((target("avx2")))
+static
+dx_uint adler_avx2(dx_uint adler, const dx_ubyte* buf, dx_uint size) {
+  dx_uint A = adler & 0xFFFF;
+  dx_uint B = adler >> 16;
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i w_lo = _mm256_setr_epi16(32, 31, 30, 29, 28, 27, 26, 25,
+                                         24, 23, 22, 21, 20, 19, 18, 17);
+  const __m256i w_hi = _mm256_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9,
+                                         8, 7, 6, 5, 4, 3, 2, 1);
+  while(size >= 32) {
+    dx_uint n = size < ADLER_BLOCK ? size & ~31U : ADLER_BLOCK & ~31U;
+    size -= n;
+    B += n * A;
+    __m256i v_sum = zero;
+    __m256i v_prefix = zero;
+    __m256i v_weighted = zero;
+    for(; n; n -= 32, buf += 32) {
+      __m256i b = _mm256_loadu_si256((const __m256i*)buf);
+      v_prefix = _mm256_add_epi32(v_prefix, v_sum);
+      v_sum = _mm256_add_epi32(v_sum, _mm256_sad_epu8(b, zero));
+      v_weighted = _mm256_add_epi32(v_weighted, _mm256_madd_epi16(
+          _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)buf)), w_lo));
+      v_weighted = _mm256_add_epi32(v_weighted, _mm256_madd_epi16(
+          _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(buf + 16))),
+          w_hi));
+    }
+    dx_uint lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, v_sum);
+    A += lanes[0] + lanes[2] + lanes[4] + lanes[6];
+    _mm256_storeu_si256((__m256i*)lanes, v_prefix);
+    dx_ulong prefix = (dx_ulong)lanes[0] + lanes[2] + lanes[4] + lanes[6];
+    _mm256_storeu_si256((__m256i*)lanes, v_weighted);
+    dx_ulong weighted = 0;
+    int i;
+    for(i = 0; i < 8; i++) weighted += lanes[i];
+    B = (B + 32 * prefix + weighted) % ADLER_CHECKSUM_MODULUS;
+    A %= ADLER_CHECKSUM_MODULUS;
+  }
+  return adler_sse2(B << 16 | A, buf, size);
+}
+
+#endif
+
+typedef dx_uint (*adler_func)(dx_uint adler, const dx_ubyte* buf,
+                              dx_uint size);
+
+static
+adler_func select_adler(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) return adler_avx2;
+  if(__builtin_cpu_supports("sse2")) return adler_sse2;
+#endif
+  return adler_scalar;
+}
+
+dx_uint dxc_checksum_update(dx_uint adler, const void* buf, dx_uint size) {
+  static adler_func func = NULL;
+  adler_func f = __atomic_load_n(&func, __ATOMIC_RELAXED);
+  if(!f) {
+    f = select_adler();
+    __atomic_store_n(&func, f, __ATOMIC_RELAXED);
+  }
+  return f(adler, (const dx_ubyte*)buf, size);
+}
+
+dx_uint dxc_checksum(const void* buf, int size) {
+  return dxc_checksum_update(1, buf, size);
+}
+
+dx_uint dxc_checksum_combine(dx_uint adler1, dx_uint adler2, dx_uint len2) {
+  /* Every byte of the second buffer saw A offset by A1 - 1 and so B by
+   * len2 * (A1 - 1). */
+  dx_ulong A1 = adler1 & 0xFFFF;
+  dx_ulong A = A1 + (adler2 & 0xFFFF) + ADLER_CHECKSUM_MODULUS - 1;
+  dx_ulong B = (adler1 >> 16) + (adler2 >> 16) +
+      (dx_ulong)(len2 % ADLER_CHECKSUM_MODULUS) *
+      (A1 + ADLER_CHECKSUM_MODULUS - 1);
+  A %= ADLER_CHECKSUM_MODULUS;
+  B %= ADLER_CHECKSUM_MODULUS;
+  return (dx_uint)(B << 16 | A);
+}
+
+typedef struct {
+  const dx_ubyte* buf;
+  dx_uint size;
+  dx_uint* sums;
+} chunk_task;
+
+static
+int checksum_chunk(void* vtask, dx_uint i) {
+  chunk_task* task = (chunk_task*)vtask;
+  dx_uint off = i * ADLER_CHUNK;
+  dx_uint n = task->size - off < ADLER_CHUNK ? task->size - off : ADLER_CHUNK;
+  task->sums[i] = dxc_checksum_update(1, task->buf + off, n);
+  return 1;
+}
+
+dx_uint dxc_checksum_parallel(const void* buf, dx_uint size,
+                              dx_uint nthreads) {
+  if(nthreads <= 1 || size < ADLER_PARALLEL_MIN) {
+    return dxc_checksum_update(1, buf, size);
+  }
+  chunk_task task;
+  dx_uint chunks = (size + ADLER_CHUNK - 1) / ADLER_CHUNK;
+  task.buf = (const dx_ubyte*)buf;
+  task.size = size;
+  if(!(task.sums = (dx_uint*)malloc(sizeof(dx_uint) * chunks))) {
+    return dxc_checksum_update(1, buf, size);
+  }
+  dxc_run_tasks(nthreads, chunks, checksum_chunk, &task);
+
+  dx_uint i;
+  dx_uint res = task.sums[0];
+  for(i = 1; i < chunks; i++) {
+    dx_uint n = i + 1 < chunks ? ADLER_CHUNK : size - i * ADLER_CHUNK;
+    res = dxc_checksum_combine(res, task.sums[i], n);
+  }
+  free(task.sums);
+  return res;
+}
@@ -20,201 +20,309 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdio.h>
 #include <string.h>
 
+#include <dxcut/file.h>
+
 #include "annotations.h"
 #include "fields.h"
 #include "methods.h"
+#include "read.h"
+#include "threads.h"
 #include "values.h"
 
 static const dx_uint NO_INDEX = 0xFFFFFFFFU;
 
-int dxc_read_class_section(read_context* ctx, dx_uint off, dx_uint size) {
-  if(!(ctx->classes = (DexClass*)calloc(size + 1, sizeof(DexClass)))) {
-    DXC_ERROR("class def alloc failed");
+static
+int read_class_def(read_context* ctx, DexClass* cl, dx_uint off) {
+  dx_uint class_idx = dxc_read_uint(ctx, &off);
+  dx_uint access_flags = dxc_read_uint(ctx, &off);
+  dx_uint superclass_idx = dxc_read_uint(ctx, &off);
+  dx_uint interfaces_off = dxc_read_uint(ctx, &off);
+  dx_uint source_file_idx = dxc_read_uint(ctx, &off);
+  dx_uint annotations_off = dxc_read_uint(ctx, &off);
+  dx_uint class_data_off = dxc_read_uint(ctx, &off);
+  dx_uint static_values_off = dxc_read_uint(ctx, &off);
+
+  if(class_idx >= ctx->types_sz) {
+    DXC_ERROR("class name type index too large");
+    return 0;
+  }
+  if(superclass_idx != NO_INDEX && superclass_idx >= ctx->types_sz) {
+    DXC_ERROR("class superclass type index too large");
+    return 0;
+  }
+  if(source_file_idx != NO_INDEX && source_file_idx >= ctx->strs_sz)  {
+    DXC_ERROR("class source file string index too large");
     return 0;
   }
-  ctx->classes_sz = size;
-  dxc_make_sentinel_class(ctx->classes + size);
-  dx_uint i;
-  for(i = 0; i < size; i++) {
-    DexClass* cl = ctx->classes + i;
-    dx_uint class_idx = ctx->read_uint(ctx, &off);
-    dx_uint access_flags = ctx->read_uint(ctx, &off);
-    dx_uint superclass_idx = ctx->read_uint(ctx, &off);
-    dx_uint interfaces_off = ctx->read_uint(ctx, &off);
-    dx_uint source_file_idx = ctx->read_uint(ctx, &off);
-    dx_uint annotations_off = ctx->read_uint(ctx, &off);
-    dx_uint class_data_off = ctx->read_uint(ctx, &off);
-    dx_uint static_values_off = ctx->read_uint(ctx, &off);
 
-    if(class_idx >= ctx->types_sz) {
-      DXC_ERROR("class name type index too large");
+  cl->name = dxc_copy_str(ctx->types[class_idx]);
+  cl->access_flags = (DexAccessFlags)access_flags;
+  cl->super_class = superclass_idx == NO_INDEX ? NULL :
+                    dxc_copy_str(ctx->types[superclass_idx]);
+  cl->source_file = source_file_idx == NO_INDEX ? NULL :
+                    dxc_copy_str(ctx->strs[source_file_idx]);
+
+  /* Load the annotations for this class. */
+  if(annotations_off && !(ctx->flags & DXC_READ_NO_ANNOTATIONS)) {
+    if(!dxc_read_annotation_directory(ctx, cl, annotations_off)) {
       return 0;
     }
-    if(superclass_idx != NO_INDEX && superclass_idx >= ctx->types_sz) {
-      DXC_ERROR("class superclass type index too large");
+  } else {
+    dxc_make_sentinel_annotation(cl->annotations =
+        (DexAnnotation*)dxc_ctx_calloc(ctx, 1, sizeof(DexAnnotation)));
+  }
+
+  /* Load the interfaces for this class. */
+  dx_uint interfaces_size = 0;
+  dx_uint interfaces_pos = interfaces_off;
+  if(interfaces_off != 0 && !dxc_read_ok(ctx, interfaces_off, 4)) {
+    DXC_ERROR("class interface list not in data section");
+    return 0;
+  } else if(interfaces_off != 0) {
+    interfaces_size = dxc_read_uint(ctx, &interfaces_pos);
+  } else {
+    interfaces_size = 0;
+  }
+  
+  if(!(cl->interfaces = dxc_ctx_create_strstr(ctx, interfaces_size))) {
+    DXC_ERROR("class interface alloc failed");
+    return 0;
+  }
+  dx_uint j;
+  for(j = 0; j < interfaces_size; j++) {
+    if(!dxc_read_ok(ctx, interfaces_pos, 2)) {
+      DXC_ERROR("class interface list not in data section");
       return 0;
     }
-    if(source_file_idx != NO_INDEX && source_file_idx >= ctx->strs_sz)  {
-      DXC_ERROR("class source file string index too large");
+    dx_ushort interface_idx = dxc_read_ushort(ctx, &interfaces_pos);
+    if(interface_idx >= ctx->types_sz) {
+      DXC_ERROR("interface type index too large");
       return 0;
     }
+    cl->interfaces->s[j] = dxc_copy_str(ctx->types[interface_idx]);
+  }
 
-    cl->name = dxc_copy_str(ctx->types[class_idx]);
-    cl->access_flags = (DexAccessFlags)access_flags;
-    cl->super_class = superclass_idx == NO_INDEX ? NULL :
-                      dxc_copy_str(ctx->types[superclass_idx]);
-    cl->source_file = source_file_idx == NO_INDEX ? NULL :
-                      dxc_copy_str(ctx->strs[source_file_idx]);
-
-    /* Load the annotations for this class. */
-    if(annotations_off) {
-      if(!dxc_read_annotation_directory(ctx, cl, annotations_off)) {
-        return 0;
-      }
-    } else {
-      dxc_make_sentinel_annotation(cl->annotations =
-          (DexAnnotation*)calloc(1, sizeof(DexAnnotation)));
-    }
-
-    /* Load the interfaces for this class. */
-    dx_uint interfaces_size = 0;
-    dx_uint interfaces_pos = interfaces_off;
-    if(interfaces_off != 0 && !dxc_read_ok(ctx, interfaces_off, 4)) {
-      DXC_ERROR("class interface list not in data section");
+  if(class_data_off != 0) {
+    if(!dxc_read_ok(ctx, class_data_off, 4)) {
+      DXC_ERROR("class data outside of data section");
       return 0;
-    } else if(interfaces_off != 0) {
-      interfaces_size = ctx->read_uint(ctx, &interfaces_pos);
-    } else {
-      interfaces_size = 0;
     }
+    dx_uint static_fields_sz = dxc_read_uleb(ctx, &class_data_off);
+    dx_uint instance_fields_sz = dxc_read_uleb(ctx, &class_data_off);
+    dx_uint direct_methods_sz = dxc_read_uleb(ctx, &class_data_off);
+    dx_uint virtual_methods_sz = dxc_read_uleb(ctx, &class_data_off);
     
-    if(!(cl->interfaces = dxc_create_strstr(interfaces_size))) {
-      DXC_ERROR("class interface alloc failed");
+    // Read static fields.
+    dx_uint idx = 0;
+    if(!(cl->static_fields = (DexField*)dxc_ctx_calloc(ctx,
+                                   static_fields_sz + 1, sizeof(DexField)))) {
+      DXC_ERROR("class static field alloc failed");
       return 0;
     }
-    dx_uint j;
-    for(j = 0; j < interfaces_size; j++) {
-      if(!dxc_read_ok(ctx, interfaces_pos, 2)) {
-        DXC_ERROR("class interface list not in data section");
-        return 0;
-      }
-      dx_ushort interface_idx = ctx->read_ushort(ctx, &interfaces_pos);
-      if(interface_idx >= ctx->types_sz) {
-        DXC_ERROR("interface type index too large");
+    dxc_make_sentinel_field(cl->static_fields + static_fields_sz);
+    for(j = 0; j < static_fields_sz; j++) {
+      if(!dxc_read_encoded_field(ctx, cl->static_fields + j, cl->name, &idx,
+                                 &class_data_off)) {
         return 0;
       }
-      cl->interfaces->s[j] = dxc_copy_str(ctx->types[interface_idx]);
     }
 
-    if(class_data_off != 0) {
-      if(!dxc_read_ok(ctx, class_data_off, 4)) {
-        DXC_ERROR("class data outside of data section");
-        return 0;
-      }
-      dx_uint static_fields_sz = ctx->read_uleb(ctx, &class_data_off);
-      dx_uint instance_fields_sz = ctx->read_uleb(ctx, &class_data_off);
-      dx_uint direct_methods_sz = ctx->read_uleb(ctx, &class_data_off);
-      dx_uint virtual_methods_sz = ctx->read_uleb(ctx, &class_data_off);
-      
-      // Read static fields.
-      dx_uint idx = 0;
-      if(!(cl->static_fields = (DexField*)calloc(static_fields_sz + 1,
-                                                 sizeof(DexField)))) {
-        DXC_ERROR("class static field alloc failed");
+    // Read instance fields.
+    idx = 0;
+    if(!(cl->instance_fields = (DexField*)dxc_ctx_calloc(ctx,
+                                 instance_fields_sz + 1, sizeof(DexField)))) {
+      DXC_ERROR("class instance field alloc failed");
+      return 0;
+    }
+    dxc_make_sentinel_field(cl->instance_fields + instance_fields_sz);
+    for(j = 0; j < instance_fields_sz; j++) {
+      if(!dxc_read_encoded_field(ctx, cl->instance_fields + j, cl->name, &idx,
+                                 &class_data_off)) {
         return 0;
       }
-      dxc_make_sentinel_field(cl->static_fields + static_fields_sz);
-      for(j = 0; j < static_fields_sz; j++) {
-        if(!dxc_read_encoded_field(ctx, cl->static_fields + j, cl->name, &idx,
-                                   &class_data_off)) {
-          return 0;
-        }
-      }
+    }
 
-      // Read instance fields.
-      idx = 0;
-      if(!(cl->instance_fields = (DexField*)calloc(instance_fields_sz + 1,
-                                                   sizeof(DexField)))) {
-        DXC_ERROR("class instance field alloc failed");
+    idx = 0;
+    if(!(cl->direct_methods = (DexMethod*)dxc_ctx_calloc(ctx,
+                                 direct_methods_sz + 1, sizeof(DexMethod)))) {
+      DXC_ERROR("class direct method alloc failed");
+      return 0;
+    }
+    dxc_make_sentinel_method(cl->direct_methods + direct_methods_sz);
+    for(j = 0; j < direct_methods_sz; j++) {
+      if(!dxc_read_encoded_method(ctx, cl->direct_methods + j, cl->name,
+                                  &idx, &class_data_off)) {
         return 0;
       }
-      dxc_make_sentinel_field(cl->instance_fields + instance_fields_sz);
-      for(j = 0; j < instance_fields_sz; j++) {
-        if(!dxc_read_encoded_field(ctx, cl->instance_fields + j, cl->name, &idx,
-                                   &class_data_off)) {
-          return 0;
-        }
-      }
+    }
 
-      idx = 0;
-      if(!(cl->direct_methods = (DexMethod*)calloc(direct_methods_sz + 1,
-                                                   sizeof(DexMethod)))) {
-        DXC_ERROR("class direct method alloc failed");
+    idx = 0;
+    if(!(cl->virtual_methods = (DexMethod*)dxc_ctx_calloc(ctx,
+                                 virtual_methods_sz + 1, sizeof(DexMethod)))) {
+      DXC_ERROR("class virtual method alloc failed");
+      return 0;
+    }
+    dxc_make_sentinel_method(cl->virtual_methods + virtual_methods_sz);
+    for(j = 0; j < virtual_methods_sz; j++) {
+      if(!dxc_read_encoded_method(ctx, cl->virtual_methods + j, cl->name,
+                                  &idx, &class_data_off)) {
         return 0;
       }
-      dxc_make_sentinel_method(cl->direct_methods + direct_methods_sz);
-      for(j = 0; j < direct_methods_sz; j++) {
-        if(!dxc_read_encoded_method(ctx, cl->direct_methods + j, cl->name,
-                                    &idx, &class_data_off)) {
-          return 0;
-        }
-      }
+    }
+  } else {
+    if(!(cl->static_fields =
+                        (DexField*)dxc_ctx_calloc(ctx, 1, sizeof(DexField)))) {
+      DXC_ERROR("class empty array alloc failed");
+      return 0;
+    }
+    dxc_make_sentinel_field(cl->static_fields);
+    if(!(cl->instance_fields =
+                        (DexField*)dxc_ctx_calloc(ctx, 1, sizeof(DexField)))) {
+      DXC_ERROR("class empty array alloc failed");
+      return 0;
+    }
+    dxc_make_sentinel_field(cl->instance_fields);
+    if(!(cl->direct_methods =
+                       (DexMethod*)dxc_ctx_calloc(ctx, 1, sizeof(DexMethod)))) {
+      DXC_ERROR("class empty array alloc failed");
+      return 0;
+    }
+    dxc_make_sentinel_method(cl->direct_methods);
+    if(!(cl->virtual_methods =
+                       (DexMethod*)dxc_ctx_calloc(ctx, 1, sizeof(DexMethod)))) {
+      DXC_ERROR("class empty array alloc failed");
+      return 0;
+    }
+    dxc_make_sentinel_method(cl->virtual_methods);
+  }
 
-      idx = 0;
-      if(!(cl->virtual_methods = (DexMethod*)calloc(virtual_methods_sz + 1,
-                                                    sizeof(DexMethod)))) {
-        DXC_ERROR("class virtual method alloc failed");
-        return 0;
-      }
-      dxc_make_sentinel_method(cl->virtual_methods + virtual_methods_sz);
-      for(j = 0; j < virtual_methods_sz; j++) {
-        if(!dxc_read_encoded_method(ctx, cl->virtual_methods + j, cl->name,
-                                    &idx, &class_data_off)) {
-          return 0;
-        }
-      }
-    } else {
-      if(!(cl->static_fields = (DexField*)calloc(1, sizeof(DexField)))) {
-        DXC_ERROR("class empty array alloc failed");
-        return 0;
-      }
-      dxc_make_sentinel_field(cl->static_fields);
-      if(!(cl->instance_fields =
-                          (DexField*)calloc(1, sizeof(DexField)))) {
-        DXC_ERROR("class empty array alloc failed");
-        return 0;
-      }
-      dxc_make_sentinel_field(cl->instance_fields);
-      if(!(cl->direct_methods =
-                          (DexMethod*)calloc(1, sizeof(DexMethod)))) {
-        DXC_ERROR("class empty array alloc failed");
-        return 0;
-      }
-      dxc_make_sentinel_method(cl->direct_methods);
-      if(!(cl->virtual_methods =
-                          (DexMethod*)calloc(1, sizeof(DexMethod)))) {
-        DXC_ERROR("class empty array alloc failed");
-        return 0;
-      }
-      dxc_make_sentinel_method(cl->virtual_methods);
+  if(static_values_off != 0 && !(ctx->flags & DXC_READ_NO_STATIC_VALUES)) {
+    if(!dxc_read_value_array(ctx, &cl->static_values,
+                             &static_values_off, 0)) {
+      return 0;
+    }
+  } else {
+    if(!(cl->static_values =
+                        (DexValue*)dxc_ctx_calloc(ctx, 1, sizeof(DexField)))) {
+      DXC_ERROR("class static value alloc failed");
+      return 0;
     }
+    dxc_make_sentinel_value(cl->static_values);
+  }
+  return 1;
+}
 
-    if(static_values_off != 0) {
-      if(!dxc_read_value_array(ctx, &cl->static_values,
-                               &static_values_off, 0)) {
-        return 0;
-      }
-    } else {
-      if(!(cl->static_values = (DexValue*)calloc(1, sizeof(DexField)))) {
-        DXC_ERROR("class static value alloc failed");
-        return 0;
-      }
-      dxc_make_sentinel_value(cl->static_values);
+typedef struct {
+  read_context* ctx;
+  dx_uint off;
+} class_task;
+
+static
+int read_class_task(void* vtask, dx_uint i) {
+  class_task* task = (class_task*)vtask;
+  return read_class_def(task->ctx, task->ctx->classes + i,
+                        task->off + i * CLASS_DEF_ELEMENT_SIZE);
+}
+
+int dxc_read_class_section(read_context* ctx, dx_uint off, dx_uint size) {
+  if(!(ctx->classes =
+       (DexClass*)dxc_ctx_calloc(ctx, size + 1, sizeof(DexClass)))) {
+    DXC_ERROR("class def alloc failed");
+    return 0;
+  }
+  ctx->classes_sz = size;
+  dxc_make_sentinel_class(ctx->classes + size);
+  if(ctx->nthreads > 1) {
+    /* Each class def only writes to its own slot and to the annotations of
+     * its own fields and methods in the raw tables. */
+    class_task task;
+    task.ctx = ctx;
+    task.off = off;
+    dxc_share_refs_begin();
+    int res = dxc_run_tasks(ctx->nthreads, size, read_class_task, &task);
+    dxc_share_refs_end();
+    return res;
+  }
+  dx_uint i;
+  for(i = 0; i < size; i++) {
+    if(!read_class_def(ctx, ctx->classes + i,
+                       off + i * CLASS_DEF_ELEMENT_SIZE)) {
+      return 0;
     }
   }
   return 1;
 }
 
+int dxc_index_class_section(read_context* ctx, dx_uint off, dx_uint size) {
+  if(!(ctx->classes =
+       (DexClass*)dxc_ctx_calloc(ctx, size + 1, sizeof(DexClass))) ||
+     !(ctx->class_loaded = (dx_ubyte*)calloc(size + 1, 1))) {
+    DXC_ERROR("class def alloc failed");
+    return 0;
+  }
+  ctx->classes_sz = size;
+  ctx->class_defs_off = off;
+  dxc_make_sentinel_class(ctx->classes + size);
+
+  /* Open addressing table of class def index + 1 keyed by descriptor; kept at
+   * most half full. */
+  ctx->class_index_mask = 1;
+  while(ctx->class_index_mask < 2 * size) ctx->class_index_mask <<= 1;
+  if(!(ctx->class_index = (dx_uint*)calloc(ctx->class_index_mask,
+                                           sizeof(dx_uint)))) {
+    DXC_ERROR("class index alloc failed");
+    return 0;
+  }
+  ctx->class_index_mask--;
+
+  dx_uint i;
+  for(i = 0; i < size; i++) {
+    dx_uint pos = off + i * CLASS_DEF_ELEMENT_SIZE;
+    dx_uint class_idx = dxc_read_uint(ctx, &pos);
+    if(class_idx >= ctx->types_sz) {
+      DXC_ERROR("class name type index too large");
+      return 0;
+    }
+    ctx->classes[i].name = dxc_copy_str(ctx->types[class_idx]);
+
+    dx_uint h = dxc_str_hash(ctx->classes[i].name);
+    for(; ctx->class_index[h & ctx->class_index_mask]; h++) {
+      dx_uint j = ctx->class_index[h & ctx->class_index_mask] - 1;
+      if(dxc_str_equal(ctx->classes[j].name, ctx->classes[i].name)) break;
+    }
+    if(!ctx->class_index[h & ctx->class_index_mask]) {
+      ctx->class_index[h & ctx->class_index_mask] = i + 1;
+    }
+  }
+  return 1;
+}
+
+dx_int dxc_find_class_def(read_context* ctx, DexClass* classes,
+                          const char* descriptor) {
+  dx_uint h = dxc_hash_str(descriptor);
+  for(; ctx->class_index[h & ctx->class_index_mask]; h++) {
+    dx_uint i = ctx->class_index[h & ctx->class_index_mask] - 1;
+    if(!strcmp(classes[i].name->s, descriptor)) return i;
+  }
+  return -1;
+}
+
+int dxc_load_class_def(read_context* ctx, DexClass* cl, dx_uint i) {
+  if(ctx->class_loaded[i]) return 1;
+
+  DexClass tmp;
+  memset(&tmp, 0, sizeof(tmp));
+  if(!read_class_def(ctx, &tmp, ctx->class_defs_off +
+                                i * CLASS_DEF_ELEMENT_SIZE)) {
+    if(!ctx->arena) dxc_free_class(&tmp);
+    return 0;
+  }
+  if(!ctx->arena) dxc_free_class(cl);
+  *cl = tmp;
+  ctx->class_loaded[i] = 1;
+  return 1;
+}
+
 void dxc_free_class(DexClass* cl) {
   if(!cl) return;
   if(cl->annotations) {
@@ -27,4 +27,16 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 extern
 int dxc_read_class_section(read_context* ctx, dx_uint off, dx_uint size);
 
+/* Fills ctx->classes with just the class names and indexes them by descriptor
+ * so that classes can be decoded on demand with dxc_load_class_def. */
+extern
+int dxc_index_class_section(read_context* ctx, dx_uint off, dx_uint size);
+
+extern
+dx_int dxc_find_class_def(read_context* ctx, DexClass* classes,
+                          const char* descriptor);
+
+extern
+int dxc_load_class_def(read_context* ctx, DexClass* cl, dx_uint i);
+
 #endif // DEX_CLASSES_H
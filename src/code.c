@@ -20,23 +20,30 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdio.h>
 #include <string.h>
 
+#include <dxcut/file.h>
+
 #include "dalvik.h"
 #include "debug.h"
+#include "read.h"
 
-int dxc_read_code(read_context* ctx, DexCode* code, dx_uint off) {
+/* Reads everything of the code item at off except for the instructions, whose
+ * location is returned through insns_off and insns_size. */
+static
+int read_code_item(read_context* ctx, DexCode* code, dx_uint off,
+                   dx_uint* insns_off, dx_uint* insns_size) {
   if(!dxc_read_ok(ctx, off, 16)) {
     DXC_ERROR("code item not within data section");
     return 0;
   }
-  code->registers_size = ctx->read_ushort(ctx, &off);
-  code->ins_size = ctx->read_ushort(ctx, &off);
-  code->outs_size = ctx->read_ushort(ctx, &off);
-  dx_ushort tries_size = ctx->read_ushort(ctx, &off);
+  code->registers_size = dxc_read_ushort(ctx, &off);
+  code->ins_size = dxc_read_ushort(ctx, &off);
+  code->outs_size = dxc_read_ushort(ctx, &off);
+  dx_ushort tries_size = dxc_read_ushort(ctx, &off);
   
-  dx_uint debug_info_off = ctx->read_uint(ctx, &off);
-  if(debug_info_off) {
+  dx_uint debug_info_off = dxc_read_uint(ctx, &off);
+  if(debug_info_off && !(ctx->flags & DXC_READ_NO_DEBUG_INFO)) {
     if(!(code->debug_information =
-        (DexDebugInfo*)calloc(1, sizeof(DexDebugInfo)))) {
+        (DexDebugInfo*)dxc_ctx_calloc(ctx, 1, sizeof(DexDebugInfo)))) {
       DXC_ERROR("code debug alloc failed");
       return 0;
     }
@@ -45,32 +52,32 @@ int dxc_read_code(read_context* ctx, DexCode* code, dx_uint off) {
     }
   }
 
-  dx_uint insns_size = ctx->read_uint(ctx, &off);
-  if(!dxc_read_ok(ctx, off, insns_size * 2)) {
+  *insns_size = dxc_read_uint(ctx, &off);
+  if(*insns_size > ctx->data_sz / 2 ||
+     !dxc_read_ok(ctx, off, *insns_size * 2)) {
     DXC_ERROR("code item not within data section");
     return 0;
   }
-  
-  if(!dxc_read_dalvik(ctx, insns_size, off, &code->insns, &code->insns_count)) {
-    return 0;
-  }
-  off += sizeof(dx_ushort) * insns_size;
+  *insns_off = off;
+  off += sizeof(dx_ushort) * *insns_size;
   
   if(tries_size == 0) {
-    if(!(code->tries = (DexTryBlock*)calloc(1, sizeof(DexTryBlock)))) {
+    if(!(code->tries =
+         (DexTryBlock*)dxc_ctx_calloc(ctx, 1, sizeof(DexTryBlock)))) {
       DXC_ERROR("code try block alloc failed");
       return 0;
     }
     dxc_make_sentinel_try_block(code->tries);
   } else {
-    if(insns_size & 1) {
+    if(*insns_size & 1) {
       /* Need to burn a short to make things 4-byte aligned. */
       off += sizeof(dx_ushort);
     }
     dx_uint handler_off = off + tries_size * 8;
     
     if(!(code->tries =
-       (DexTryBlock*)calloc(tries_size + 1, sizeof(DexTryBlock)))) {
+       (DexTryBlock*)dxc_ctx_calloc(ctx, tries_size + 1,
+                                    sizeof(DexTryBlock)))) {
       DXC_ERROR("code try block alloc failed");
       return 0;
     }
@@ -78,11 +85,11 @@ int dxc_read_code(read_context* ctx, DexCode* code, dx_uint off) {
     int i;
     for(i = 0; i < tries_size; i++) {
       DexTryBlock* t = code->tries + i;
-      t->start_addr = ctx->read_uint(ctx, &off);
-      t->insn_count = ctx->read_ushort(ctx, &off);
-      dx_uint hoff = handler_off + ctx->read_ushort(ctx, &off);
+      t->start_addr = dxc_read_uint(ctx, &off);
+      t->insn_count = dxc_read_ushort(ctx, &off);
+      dx_uint hoff = handler_off + dxc_read_ushort(ctx, &off);
       
-      dx_int hsz = ctx->read_sleb(ctx, &hoff);
+      dx_int hsz = dxc_read_sleb(ctx, &hoff);
       if(!dxc_in_data(ctx, hoff)) {
         DXC_ERROR("encoded handler not within data section");
         return 0;
@@ -91,15 +98,16 @@ int dxc_read_code(read_context* ctx, DexCode* code, dx_uint off) {
       int has_catch_all = hsz <= 0;
       if(has_catch_all) hsz = -hsz;
 
-      if(!(t->handlers = (DexHandler*)calloc(hsz + 1, sizeof(DexHandler)))) {
+      if(!(t->handlers =
+           (DexHandler*)dxc_ctx_calloc(ctx, hsz + 1, sizeof(DexHandler)))) {
         DXC_ERROR("code handler alloc failed");
         return 0;
       }
       dxc_make_sentinel_handler(t->handlers + hsz);
       int j;
       for(j = 0; j < hsz; j++) {
-        dx_uint type_idx = ctx->read_uleb(ctx, &hoff);
-        dx_uint addr = ctx->read_uleb(ctx, &hoff);
+        dx_uint type_idx = dxc_read_uleb(ctx, &hoff);
+        dx_uint addr = dxc_read_uleb(ctx, &hoff);
         if(!dxc_in_data(ctx, hoff)) {
           DXC_ERROR("encoded handler not within data section");
           return 0;
@@ -114,11 +122,11 @@ int dxc_read_code(read_context* ctx, DexCode* code, dx_uint off) {
 
       if(has_catch_all) {
         if(!(t->catch_all_handler =
-            (DexHandler*)calloc(1, sizeof(DexHandler)))) {
+            (DexHandler*)dxc_ctx_calloc(ctx, 1, sizeof(DexHandler)))) {
           DXC_ERROR("code catch all handler alloc failed");
           return 0;
         }
-        t->catch_all_handler->addr = ctx->read_uleb(ctx, &hoff);
+        t->catch_all_handler->addr = dxc_read_uleb(ctx, &hoff);
         if(!dxc_in_data(ctx, hoff)) {
           DXC_ERROR("encoded handler not within data section");
           return 0;
@@ -129,6 +137,197 @@ int dxc_read_code(read_context* ctx, DexCode* code, dx_uint off) {
   return 1;
 }
 
+int dxc_read_code(read_context* ctx, DexCode* code, dx_uint off) {
+  dx_uint insns_off;
+  dx_uint insns_size;
+  return read_code_item(ctx, code, off, &insns_off, &insns_size) &&
+         dxc_read_dalvik(ctx, insns_size, insns_off,
+                         &code->insns, &code->insns_count);
+}
+
+int dxc_read_compact_code(read_context* ctx, DexCompactCode* code,
+                          dx_uint off) {
+  DexCode parts;
+  memset(&parts, 0, sizeof(parts));
+  dx_uint insns_off;
+  dx_uint insns_size;
+  int ok = read_code_item(ctx, &parts, off, &insns_off, &insns_size);
+  code->registers_size = parts.registers_size;
+  code->ins_size = parts.ins_size;
+  code->outs_size = parts.outs_size;
+  code->debug_information = parts.debug_information;
+  code->tries = parts.tries;
+  code->source = ctx;
+  if(!ok) return 0;
+
+  /* Check every instruction up front so that the accessors can trust the
+   * widths and operand indices. */
+  const dx_ushort* buf = (const dx_ushort*)(ctx->buf + insns_off);
+  dx_uint i;
+  dx_uint width;
+  for(i = 0; i < insns_size; i += width) {
+    if(!(width = dxc_dalvik_width(buf, i, insns_size))) return 0;
+    code->insns_count++;
+    if((buf[i] & 0x00FF) == OP_PSUEDO && (buf[i] >> 8) != PSUEDO_OP_NOP) {
+      code->payloads_size++;
+      continue;
+    }
+    const DexOpFormat* fmt = &dex_opcode_formats[buf[i] & 0x00FF];
+    dx_ulong v;
+    dx_ulong limit;
+    switch(fmt->specialType) {
+      case SPECIAL_STRING: limit = ctx->strs_sz; break;
+      case SPECIAL_TYPE: limit = ctx->types_sz; break;
+      case SPECIAL_FIELD: limit = ctx->fields_sz; break;
+      case SPECIAL_METHOD: limit = ctx->methods_sz; break;
+      default: continue;
+    }
+    if(!dxc_decode_special(fmt, buf + i, &v)) return 0;
+    if(v >= limit) {
+      DXC_ERROR("invalid pool index in bytecode");
+      return 0;
+    }
+  }
+
+  if(code->payloads_size) {
+    if(!(code->payloads = (DexPayloadRange*)dxc_ctx_calloc(ctx,
+             code->payloads_size, sizeof(DexPayloadRange)))) {
+      DXC_ERROR("payload table alloc failed");
+      return 0;
+    }
+    DexPayloadRange* payload = code->payloads;
+    for(i = 0; i < insns_size; i += width) {
+      width = dxc_dalvik_width(buf, i, insns_size);
+      if((buf[i] & 0x00FF) == OP_PSUEDO && (buf[i] >> 8) != PSUEDO_OP_NOP) {
+        payload->addr = i;
+        payload->size = width;
+        payload++;
+      }
+    }
+  }
+
+  /* Point straight into the input when the context keeps it alive. */
+  code->insns_size = insns_size;
+  if(ctx->map_base || ctx->swap_buf) {
+    code->insns = buf;
+    code->insns_borrowed = 1;
+  } else if(insns_size) {
+    dx_ushort* copy =
+        (dx_ushort*)dxc_ctx_calloc(ctx, insns_size, sizeof(dx_ushort));
+    if(!copy) {
+      DXC_ERROR("compact code alloc failed");
+      return 0;
+    }
+    memcpy(copy, buf, insns_size * sizeof(dx_ushort));
+    code->insns = copy;
+  }
+  return 1;
+}
+
+int dxc_expand_compact_code(const DexCompactCode* compact, DexCode* code) {
+  code->registers_size = compact->registers_size;
+  code->ins_size = compact->ins_size;
+  code->outs_size = compact->outs_size;
+  return dxc_decode_dalvik(compact->source, compact->insns,
+                           compact->insns_size, &code->insns,
+                           &code->insns_count);
+}
+
+void dxc_free_compact_code(DexCompactCode* code) {
+  if(!code) return;
+  if(code->debug_information) {
+    dxc_free_debug_info(code->debug_information);
+  }
+  if(code->tries) {
+    DexTryBlock* ptr;
+    for(ptr = code->tries;
+        !dxc_is_sentinel_try_block(ptr); ptr++) dxc_free_try_block(ptr);
+  }
+  free(code->debug_information);
+  free(code->tries);
+  free(code->payloads);
+  if(!code->insns_borrowed) free((dx_ushort*)code->insns);
+}
+
+dx_uint dxc_compact_next(const DexCompactCode* code, dx_uint addr) {
+  if(addr >= code->insns_size) return code->insns_size;
+  dx_uint width = dxc_dalvik_width(code->insns, addr, code->insns_size);
+  return width ? addr + width : code->insns_size;
+}
+
+int dxc_compact_is_payload(const DexCompactCode* code, dx_uint addr) {
+  dx_uint lo = 0;
+  dx_uint hi = code->payloads_size;
+  while(lo < hi) {
+    dx_uint mid = lo + (hi - lo) / 2;
+    if(code->payloads[mid].addr == addr) return 1;
+    if(addr < code->payloads[mid].addr) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return 0;
+}
+
+int dxc_compact_decode(const DexCompactCode* code, dx_uint addr,
+                       DexInstruction* insn) {
+  memset(insn, 0, sizeof(DexInstruction));
+  if(addr >= code->insns_size) {
+    DXC_ERROR("instruction address out of range");
+    return 0;
+  }
+  return dxc_decode_insn(code->source, code->insns, addr, code->insns_size,
+                         NULL, insn) != 0;
+}
+
+/* Returns the pool index operand of the instruction at addr if it is of the
+ * given type.  Indices were range checked when the code was read. */
+static
+int compact_operand(const DexCompactCode* code, dx_uint addr,
+                    DexOpSpecialType type, dx_ulong* idx) {
+  if(addr >= code->insns_size) return 0;
+  dx_ushort unit = code->insns[addr];
+  if((unit & 0x00FF) == OP_PSUEDO && (unit >> 8) != PSUEDO_OP_NOP) return 0;
+  const DexOpFormat* fmt = &dex_opcode_formats[unit & 0x00FF];
+  if(fmt->specialType != type || addr + fmt->size > code->insns_size) return 0;
+  return dxc_decode_special(fmt, code->insns + addr, idx);
+}
+
+ref_str* dxc_compact_string(const DexCompactCode* code, dx_uint addr) {
+  dx_ulong idx;
+  if(!compact_operand(code, addr, SPECIAL_STRING, &idx)) return NULL;
+  return code->source->strs[idx];
+}
+
+ref_str* dxc_compact_type(const DexCompactCode* code, dx_uint addr) {
+  dx_ulong idx;
+  if(!compact_operand(code, addr, SPECIAL_TYPE, &idx)) return NULL;
+  return code->source->types[idx];
+}
+
+int dxc_compact_field(const DexCompactCode* code, dx_uint addr,
+                      ref_field* field) {
+  dx_ulong idx;
+  if(!compact_operand(code, addr, SPECIAL_FIELD, &idx)) return 0;
+  raw_field* rf = code->source->fields + idx;
+  field->defining_class = rf->defining_class;
+  field->name = rf->name;
+  field->type = rf->type;
+  return 1;
+}
+
+int dxc_compact_method(const DexCompactCode* code, dx_uint addr,
+                       ref_method* method) {
+  dx_ulong idx;
+  if(!compact_operand(code, addr, SPECIAL_METHOD, &idx)) return 0;
+  raw_method* rm = code->source->methods + idx;
+  method->defining_class = rm->defining_class;
+  method->name = rm->name;
+  method->prototype = rm->prototype;
+  return 1;
+}
+
 void dxc_free_code(DexCode* code) {
   if(!code) return;
   if(code->debug_information) {
@@ -24,4 +24,13 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 extern
 int dxc_read_code(read_context* ctx, DexCode* code, dx_uint off);
 
+extern
+int dxc_read_compact_code(read_context* ctx, DexCompactCode* code,
+                          dx_uint off);
+
+/* Decodes the instructions of compact into code, which takes over nothing
+ * else; the caller moves the debug information and try blocks. */
+extern
+int dxc_expand_compact_code(const DexCompactCode* compact, DexCode* code);
+
 #endif
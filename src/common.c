@@ -20,7 +20,107 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "common.h"
 
-ref_str dxc_empty_str = {1, {0}};
+#include "arena.h"
+#include "mutf8.h"
+
+/* Immortal strings carry their cached hash and lengths from the start; this
+ * is the FNV-1a hash of "". */
+ref_str dxc_empty_str = {DXC_REF_IMMORTAL, (char*)"", 2166136261U, 0, 0};
+
+/* Nonzero while reference counts may be updated from several threads.  Holds
+ * one reference for dxc_set_atomic_refcounts and one per shared read. */
+static
+int atomic_refs = 0;
+
+static
+int atomic_refs_enabled = 0;
+
+#ifdef DXC_ATOMIC_REFCOUNT
+#define REFS_ATOMIC() 1
+#else
+#define REFS_ATOMIC() __atomic_load_n(&atomic_refs, __ATOMIC_RELAXED)
+#endif
+
+static
+int ref_immortal(dx_uint* cnt) {
+  /* The flag never changes but the count next to it may be updated
+   * concurrently. */
+  return (__atomic_load_n(cnt, __ATOMIC_RELAXED) & DXC_REF_IMMORTAL) != 0;
+}
+
+static
+void ref_acquire(dx_uint* cnt) {
+  if(REFS_ATOMIC()) {
+    __atomic_fetch_add(cnt, 1, __ATOMIC_RELAXED);
+  } else {
+    ++*cnt;
+  }
+}
+
+static
+dx_uint ref_release(dx_uint* cnt) {
+  if(REFS_ATOMIC()) {
+    return __atomic_sub_fetch(cnt, 1, __ATOMIC_ACQ_REL);
+  }
+  return --*cnt;
+}
+
+void dxc_set_atomic_refcounts(int enable) {
+  if(!enable == !atomic_refs_enabled) return;
+  atomic_refs_enabled = enable;
+  __atomic_fetch_add(&atomic_refs, enable ? 1 : -1, __ATOMIC_SEQ_CST);
+}
+
+void dxc_share_refs_begin(void) {
+  __atomic_fetch_add(&atomic_refs, 1, __ATOMIC_SEQ_CST);
+}
+
+void dxc_share_refs_end(void) {
+  __atomic_fetch_sub(&atomic_refs, 1, __ATOMIC_SEQ_CST);
+}
+
+void* dxc_ctx_calloc(read_context* ctx, size_t n, size_t size) {
+  if(!ctx->arena) return calloc(n, size);
+  if(size && n > (size_t)-1 / size) return NULL;
+  return dxc_arena_alloc(ctx->arena, n * size);
+}
+
+void* dxc_ctx_realloc(read_context* ctx, void* ptr, size_t old_size,
+                      size_t size) {
+  if(!ctx->arena) return realloc(ptr, size);
+  if(size <= old_size) return ptr;
+  void* ret = dxc_arena_alloc(ctx->arena, size);
+  if(ret && old_size) memcpy(ret, ptr, old_size);
+  return ret;
+}
+
+void dxc_ctx_free(read_context* ctx, void* ptr) {
+  if(!ctx->arena) free(ptr);
+}
+
+ref_strstr* dxc_ctx_create_strstr(read_context* ctx, dx_uint sz) {
+  if(!ctx->arena) return dxc_create_strstr(sz);
+  ref_strstr* ret = (ref_strstr*)dxc_arena_alloc(ctx->arena,
+      offsetof(ref_strstr, s) + (sz + 1) * sizeof(ref_str*));
+  if(ret) ret->cnt = DXC_REF_IMMORTAL;
+  return ret;
+}
+
+ref_str* dxc_ctx_induct_str(read_context* ctx, const char* s) {
+  if(!ctx->arena) return dxc_induct_str(s);
+  dx_uint sz = strlen(s);
+  ref_str* ret = (ref_str*)dxc_arena_alloc(ctx->arena,
+                                           sizeof(ref_str) + sz + 1);
+  if(!ret) {
+    DXC_ERROR("induct str alloc failed");
+    return NULL;
+  }
+  ret->s = (char*)(ret + 1);
+  memcpy(ret->s, s, sz + 1);
+  dxc_fill_str_info(ret);
+  ret->cnt = DXC_REF_IMMORTAL;
+  return ret;
+}
 
 int dxc_in_data(read_context* ctx, dx_uint off) {
   return ctx->data_off <= off && off <= ctx->data_off + ctx->data_sz;
@@ -31,28 +131,97 @@ int dxc_read_ok(read_context* ctx, dx_uint off, dx_uint width) {
          off <= off + width;
 }
 
-ref_str* dxc_induct_str(const char* s) {
-  dx_uint sz = strlen(s);
-  ref_str* ret = (ref_str*)malloc(5 + sz);
+ref_str* dxc_alloc_str(dx_uint len) {
+  ref_str* ret = (ref_str*)malloc(sizeof(ref_str) + len + 1);
   if(!ret) {
     DXC_ERROR("induct str alloc failed");
     return NULL;
   }
   ret->cnt = 1;
-  strcpy(ret->s, s);
+  ret->s = (char*)(ret + 1);
+  ret->hash = ret->len = ret->utf16_len = 0;
+  return ret;
+}
+
+dx_uint dxc_hash_str(const char* s) {
+  /* FNV-1a, with 0 moved to 1 since a zero hash marks one not computed. */
+  dx_uint h = 2166136261U;
+  for(; *s; s++) {
+    h = (h ^ (dx_ubyte)*s) * 16777619U;
+  }
+  return h ? h : 1;
+}
+
+/* Computes the cached hash and lengths of s.  Threads sharing s may race to
+ * fill them in; they all store the same values and publish the hash last. */
+static
+dx_uint str_info(ref_str* s) {
+  dx_uint h = __atomic_load_n(&s->hash, __ATOMIC_ACQUIRE);
+  if(h) return h;
+  h = 2166136261U;
+  const dx_ubyte* p;
+  for(p = (const dx_ubyte*)s->s; *p; p++) {
+    h = (h ^ *p) * 16777619U;
+  }
+  if(!h) h = 1;
+  __atomic_store_n(&s->len, (dx_uint)(p - (const dx_ubyte*)s->s),
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&s->utf16_len, mutf8_code_points(s->s), __ATOMIC_RELAXED);
+  __atomic_store_n(&s->hash, h, __ATOMIC_RELEASE);
+  return h;
+}
+
+void dxc_fill_str_info(ref_str* s) {
+  str_info(s);
+}
+
+dx_uint dxc_str_hash(ref_str* s) {
+  return str_info(s);
+}
+
+dx_uint dxc_str_len(ref_str* s) {
+  str_info(s);
+  return __atomic_load_n(&s->len, __ATOMIC_RELAXED);
+}
+
+dx_uint dxc_str_utf16_len(ref_str* s) {
+  str_info(s);
+  return __atomic_load_n(&s->utf16_len, __ATOMIC_RELAXED);
+}
+
+int dxc_str_equal(ref_str* a, ref_str* b) {
+  if(a == b) return 1;
+  if(str_info(a) != str_info(b)) return 0;
+  dx_uint len = dxc_str_len(a);
+  return len == dxc_str_len(b) && !memcmp(a->s, b->s, len);
+}
+
+ref_str* dxc_induct_str(const char* s) {
+  dx_uint sz = strlen(s);
+  ref_str* ret = dxc_alloc_str(sz);
+  if(ret) memcpy(ret->s, s, sz + 1);
   return ret;
 }
 
 ref_str* dxc_copy_str(ref_str* s) {
-  s->cnt++;
+  if(!ref_immortal(&s->cnt)) ref_acquire(&s->cnt);
   return s;
 }
 
+void dxc_make_immortal_str(ref_str* s) {
+  str_info(s);
+  s->cnt |= DXC_REF_IMMORTAL;
+}
+
 ref_strstr* dxc_copy_strstr(ref_strstr* s) {
-  s->cnt++;
+  if(!ref_immortal(&s->cnt)) ref_acquire(&s->cnt);
   return s;
 }
 
+void dxc_make_immortal_strstr(ref_strstr* s) {
+  s->cnt |= DXC_REF_IMMORTAL;
+}
+
 ref_strstr* dxc_create_strstr(dx_uint sz) {
   ref_strstr* ret = (ref_strstr*)calloc(offsetof(ref_strstr, s) +
                                         (sz + 1) * sizeof(ref_str*), 1);
@@ -79,15 +248,15 @@ raw_method dxc_copy_raw_method(raw_method mtd) {
 }
 
 void dxc_free_str(ref_str* s) {
-  if(!s) return;
-  if(!--(s->cnt)) {
+  if(!s || ref_immortal(&s->cnt)) return;
+  if(!ref_release(&s->cnt)) {
     free(s);
   }
 }
 
 void dxc_free_strstr(ref_strstr* s) {
-  if(!s) return;
-  if(!--(s->cnt)) {
+  if(!s || ref_immortal(&s->cnt)) return;
+  if(!ref_release(&s->cnt)) {
     ref_str** ptr;
     for(ptr = s->s; *ptr; ptr++) dxc_free_str(*ptr);
     free(s);
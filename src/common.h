@@ -20,6 +20,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdio.h>
 
 #include <dxcut/annotation.h>
@@ -48,6 +49,45 @@ typedef struct read_context_t {
   char* buf;
   char* odex_buf;
 
+  /* The input as it was given, in step with buf.  Differs from buf only for
+   * big-endian images, which are read from a little-endian copy in swap_buf
+   * while checksums are verified against the original bytes. */
+  const char* raw_buf;
+  char* swap_buf;
+
+  /* The mapping (or owned copy) of the input when the file keeps its input
+   * alive, otherwise NULL.  Released along with the DexFile. */
+  void* map_base;
+  dx_uint map_size;
+  int map_malloced;
+
+  /* When set the string table borrows its characters from buf rather than
+   * copying them, and the string and proto tables are immortal and owned by
+   * the context.  Requires the context to stay alive as long as the DexFile.
+   */
+  int immortal_ids;
+  ref_str* str_block;
+
+  /* Where the nodes of a file read with DXC_READ_ARENA are allocated from,
+   * otherwise NULL.  See dxc_ctx_calloc(). */
+  struct dxc_arena_t* arena;
+
+  /* Pool the string and proto tables are taken from, or NULL.  Interned
+   * entries are immortal and owned by the pool. */
+  struct dex_intern_pool_t* intern;
+
+  /* The DexReadFlags the file was read with. */
+  dx_uint flags;
+
+  /* Number of threads to decode the class section with. */
+  dx_uint nthreads;
+
+  /* Index over the class defs for lazily decoded files. */
+  dx_uint class_defs_off;
+  dx_ubyte* class_loaded;
+  dx_uint* class_index;
+  dx_uint class_index_mask;
+
   dx_uint dex_version;
   dx_uint odex_version;
 
@@ -63,25 +103,61 @@ typedef struct read_context_t {
   dx_uint methods_sz;
   dx_uint data_off;
   dx_uint data_sz;
+  /* data_off + data_sz, the bound for leb128 reads. */
+  dx_uint data_end;
   DexClass* classes;
   dx_uint classes_sz;
-
-  dx_uint   (*read_uleb)  (struct read_context_t* ctx, dx_uint* pos);
-  dx_uint   (*read_ulebp1)(struct read_context_t* ctx, dx_uint* pos);
-  dx_int    (*read_sleb)  (struct read_context_t* ctx, dx_uint* pos);
-  dx_ulong  (*read_ulong) (struct read_context_t* ctx, dx_uint* pos);
-  dx_long   (*read_long)  (struct read_context_t* ctx, dx_uint* pos);
-  dx_uint   (*read_uint)  (struct read_context_t* ctx, dx_uint* pos);
-  dx_int    (*read_int)   (struct read_context_t* ctx, dx_uint* pos);
-  dx_ushort (*read_ushort)(struct read_context_t* ctx, dx_uint* pos);
-  dx_short  (*read_short) (struct read_context_t* ctx, dx_uint* pos);
-  dx_ubyte  (*read_ubyte) (struct read_context_t* ctx, dx_uint* pos);
-  dx_byte   (*read_byte)  (struct read_context_t* ctx, dx_uint* pos);
 } read_context;
 
 extern
 ref_str dxc_empty_str;
 
+extern
+ref_str* dxc_alloc_str(dx_uint len);
+
+extern
+dx_uint dxc_hash_str(const char* s);
+
+/* Computes the cached hash and lengths of s now rather than on first use.
+ * Strings that are about to become immortal must have them filled in, as
+ * immortal strings are never written to. */
+extern
+void dxc_fill_str_info(ref_str* s);
+
+/* Makes reference count updates atomic until the matching end call, for while
+ * the id tables of a read are shared between threads.  Calls may nest and
+ * combine with dxc_set_atomic_refcounts. */
+extern
+void dxc_share_refs_begin(void);
+
+extern
+void dxc_share_refs_end(void);
+
+/* calloc() for the nodes of the file being read.  Allocates from the
+ * context's arena if it has one and from the heap otherwise.  Everything the
+ * reader builds goes through these so that an arena read never touches the
+ * heap for individual nodes. */
+extern
+void* dxc_ctx_calloc(read_context* ctx, size_t n, size_t size);
+
+/* Grows a block from dxc_ctx_calloc() holding old_size bytes to size bytes.
+ * Does not zero the new tail.  On failure the old block is left alone. */
+extern
+void* dxc_ctx_realloc(read_context* ctx, void* ptr, size_t old_size,
+                      size_t size);
+
+/* Releases a block from dxc_ctx_calloc().  Does nothing for arena contexts. */
+extern
+void dxc_ctx_free(read_context* ctx, void* ptr);
+
+/* Arena aware versions of dxc_create_strstr and dxc_induct_str.  Arena
+ * allocated strings are immortal as they cannot be freed individually. */
+extern
+ref_strstr* dxc_ctx_create_strstr(read_context* ctx, dx_uint sz);
+
+extern
+ref_str* dxc_ctx_induct_str(read_context* ctx, const char* s);
+
 extern
 int dxc_in_data(read_context* ctx, dx_uint off);
 
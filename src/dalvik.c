@@ -20,224 +20,275 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
+
 static
-dx_int get_int(dx_ushort* buf, int ind) {
+dx_int get_int(const dx_ushort* buf, int ind) {
   dx_uint res = buf[ind + 1];
   res = res << 16;
   res |= buf[ind];
   return (dx_int)res;
 }
 
-int dxc_read_dalvik(read_context* ctx, dx_uint size, dx_uint off,
-                    DexInstruction** insns, dx_uint* count) {
-  DexInstruction* res;
-  if(!(res = *insns = (DexInstruction*)calloc(size, sizeof(DexInstruction)))) {
-    DXC_ERROR("dalvik alloc failed");
-    return 0;
-  }
-  *count = 0;
-
-  dx_ushort* buf = (dx_ushort*)(ctx->buf + off);
-
-  dx_uint i;
-  for(i = 0; i < size; res++) {
-    (*count)++;
-    res->opcode = (DexOpCode)(buf[i] & 0x00FF);
-    res->hi_byte = (DexPsuedoOpCode)(buf[i] >> 8);
-    if(res->opcode == OP_PSUEDO &&
-       res->hi_byte != PSUEDO_OP_NOP) {
-      /* Handle the special psuedo opcode tables. */
-      if(i + 2 > size) {
-        DXC_ERROR("instruction table leaves code boundaries");
-        return 0;
-      }
-      dx_ushort sz = buf[i + 1];
-      switch(res->hi_byte) {
-        case PSUEDO_OP_PACKED_SWITCH: {
-          if(i + sz * 2 + 4 > size) {
-            DXC_ERROR("instruction table leaves code boundaries");
-            return 0;
-          }
-          res->special.packed_switch.size = sz;
-          res->special.packed_switch.first_key = get_int(buf, i + 2);
-          res->special.packed_switch.targets =
-              (dx_int*)malloc(sizeof(dx_int) * sz);
-          int j;
-          for(j = 0; j < sz; j++) {
-            res->special.packed_switch.targets[j] = get_int(buf, i + 2 * j + 4);
-          }
-          i += sz * 2 + 4;
+int dxc_decode_special(const DexOpFormat* fmt, const dx_ushort* buf,
+                       dx_ulong* res) {
+  int pos = fmt->specialPos;
+  int size = fmt->specialSize;
+  dx_ulong v = 0;
+  switch(pos) {
+    case 0:
+      switch(size) {
+        case 1:
+          v = buf[0] >> 12UL;
           break;
-        } case PSUEDO_OP_SPARSE_SWITCH: {
-          if(i + sz * 4 + 2 > size) {
-            DXC_ERROR("instruction table leaves code boundaries");
-            return 0;
-          }
-          res->special.sparse_switch.size = sz;
-          res->special.sparse_switch.keys =
-              (dx_int*)malloc(sizeof(dx_int) * sz);
-          res->special.sparse_switch.targets =
-              (dx_int*)malloc(sizeof(dx_int) * sz);
-          int j;
-          for(j = 0; j < sz; j++) {
-            res->special.sparse_switch.keys[j] = get_int(buf, i + 2 * j + 2);
-          }
-          for(j = 0; j < sz; j++) {
-            res->special.sparse_switch.targets[j] = get_int(buf,
-                                                      i + 2 * (sz + j) + 2);
-          }
-          i += sz * 4 + 2;
-          break;
-        } case PSUEDO_OP_FILL_DATA_ARRAY:
-          if(i + 4 > size) {
-            DXC_ERROR("instruction table leaves code boundaries");
-            return 0;
-          }
-          res->special.fill_data_array.element_width = sz;
-          res->special.fill_data_array.size = get_int(buf, i + 2);
-          if(i + (sz * res->special.fill_data_array.size + 1) / 2 + 4 > size) {
-            DXC_ERROR("instruction table leaves code boundaries");
-            return 0;
-          }
-          res->special.fill_data_array.data =
-              (dx_ubyte*)malloc(sz * res->special.fill_data_array.size);
-          memcpy(res->special.fill_data_array.data, buf + i + 4,
-                 sz * res->special.fill_data_array.size);
-          i += (sz * res->special.fill_data_array.size + 1) / 2 + 4;
+        case 2:
+          v = buf[0] >> 8UL;
           break;
         default:
-          DXC_ERROR("unrecognized psuedo opcode");
+          DXC_ERROR("unhandled special alignment");
           return 0;
       }
-    } else {
-      /* Handle the normal opcodes. */
-      const DexOpFormat* fmt = &dex_opcode_formats[res->opcode];
-      if(fmt->name == NULL) {
-        DXC_ERROR("unrecognized opcode");
-        return 0;
+      break;
+    case 4:
+      switch(size) {
+        case 16:
+          v |= ((dx_ulong)buf[4]) << 48UL;
+          v |= ((dx_ulong)buf[3]) << 32UL;
+        case 8:
+          v |= ((dx_ulong)buf[2]) << 16UL;
+        case 4:
+          v |= buf[1];
+          break;
+        case 2:
+          v = buf[1] >> 8UL;
+          break;
+        default:
+          DXC_ERROR("unhandled special alignment");
+          return 0;
       }
-      if(i + fmt->size > size) {
-        DXC_ERROR("instruction leaves code boundaries");
+      break;
+    default:
+      DXC_ERROR("unhandled special alignment");
+      return 0;
+  }
+  if((fmt->specialType == SPECIAL_CONSTANT ||
+      fmt->specialType == SPECIAL_TARGET) && size < 16) {
+    // These two types both need to be sign extended.
+    if(v & (1ULL << (size * 4 - 1))) {
+      v |= ~((1ULL << size * 4) - 1);
+    }
+  }
+  *res = v;
+  return 1;
+}
+
+dx_uint dxc_dalvik_width(const dx_ushort* buf, dx_uint i, dx_uint size) {
+  dx_ubyte opcode = buf[i] & 0x00FF;
+  dx_ubyte hi_byte = buf[i] >> 8;
+  dx_ulong width;
+  if(opcode == OP_PSUEDO && hi_byte != PSUEDO_OP_NOP) {
+    if(i + 2 > size) {
+      DXC_ERROR("instruction table leaves code boundaries");
+      return 0;
+    }
+    dx_ushort sz = buf[i + 1];
+    switch(hi_byte) {
+      case PSUEDO_OP_PACKED_SWITCH:
+        width = sz * 2 + 4;
+        break;
+      case PSUEDO_OP_SPARSE_SWITCH:
+        width = sz * 4 + 2;
+        break;
+      case PSUEDO_OP_FILL_DATA_ARRAY:
+        if(i + 4 > size) {
+          DXC_ERROR("instruction table leaves code boundaries");
+          return 0;
+        }
+        width = ((dx_ulong)sz * (dx_uint)get_int(buf, i + 2) + 1) / 2 + 4;
+        break;
+      default:
+        DXC_ERROR("unrecognized psuedo opcode");
         return 0;
-      }
-      res->param[0] = buf[i + 1];
-      res->param[1] = buf[i + 2];
-      if(fmt->specialType != SPECIAL_NONE) {
-        int pos = fmt->specialPos;
-        int size = fmt->specialSize;
-        dx_ulong v = 0;
-        switch(pos) {
-          case 0:
-            switch(size) {
-              case 1:
-                v = buf[i] >> 12UL;
-                break;
-              case 2:
-                v = buf[i] >> 8UL;
-                break;
-              default:
-                DXC_ERROR("unhandled special alignment");
-                return 0;
-            }
-            break;
-          case 4:
-            switch(size) {
-              case 16:
-                v |= ((dx_ulong)buf[i + 4]) << 48UL;
-                v |= ((dx_ulong)buf[i + 3]) << 32UL;
-              case 8:
-                v |= ((dx_ulong)buf[i + 2]) << 16UL;
-              case 4:
-                v |= buf[i + 1];
-                break;
-              case 2:
-                v = buf[i + 1] >> 8UL;
-                break;
-              default:
-                DXC_ERROR("unhandled special alignment");
-                return 0;
-            }
-            break;
-          default:
-            DXC_ERROR("unhandled special alignment");
-            return 0;
+    }
+    if(width > size - i) {
+      DXC_ERROR("instruction table leaves code boundaries");
+      return 0;
+    }
+  } else {
+    const DexOpFormat* fmt = &dex_opcode_formats[opcode];
+    if(fmt->name == NULL) {
+      DXC_ERROR("unrecognized opcode");
+      return 0;
+    }
+    width = fmt->size;
+    if(width > size - i) {
+      DXC_ERROR("instruction leaves code boundaries");
+      return 0;
+    }
+  }
+  return (dx_uint)width;
+}
+
+static
+void* payload_alloc(dxc_arena* arena, size_t size) {
+  return arena ? dxc_arena_alloc(arena, size) : malloc(size);
+}
+
+dx_uint dxc_decode_insn(read_context* ctx, const dx_ushort* buf, dx_uint i,
+                        dx_uint size, dxc_arena* arena, DexInstruction* res) {
+  dx_uint width = dxc_dalvik_width(buf, i, size);
+  if(!width) return 0;
+
+  res->opcode = (DexOpCode)(buf[i] & 0x00FF);
+  res->hi_byte = (DexPsuedoOpCode)(buf[i] >> 8);
+  if(res->opcode == OP_PSUEDO &&
+     res->hi_byte != PSUEDO_OP_NOP) {
+    /* Handle the special psuedo opcode tables. */
+    dx_ushort sz = buf[i + 1];
+    int j;
+    switch(res->hi_byte) {
+      case PSUEDO_OP_PACKED_SWITCH:
+        res->special.packed_switch.size = sz;
+        res->special.packed_switch.first_key = get_int(buf, i + 2);
+        res->special.packed_switch.targets =
+            (dx_int*)payload_alloc(arena, sizeof(dx_int) * sz);
+        for(j = 0; j < sz; j++) {
+          res->special.packed_switch.targets[j] = get_int(buf, i + 2 * j + 4);
         }
-        if((fmt->specialType == SPECIAL_CONSTANT ||
-            fmt->specialType == SPECIAL_TARGET) && size < 16) {
-          // These two types both need to be sign extended.
-          if(v & (1ULL << (size * 4 - 1))) {
-            v |= ~((1ULL << size * 4) - 1);
-          }
+        break;
+      case PSUEDO_OP_SPARSE_SWITCH:
+        res->special.sparse_switch.size = sz;
+        res->special.sparse_switch.keys =
+            (dx_int*)payload_alloc(arena, sizeof(dx_int) * sz);
+        res->special.sparse_switch.targets =
+            (dx_int*)payload_alloc(arena, sizeof(dx_int) * sz);
+        for(j = 0; j < sz; j++) {
+          res->special.sparse_switch.keys[j] = get_int(buf, i + 2 * j + 2);
         }
-        switch(fmt->specialType) {
-          case SPECIAL_CONSTANT:
-            res->special.constant = v;
-            break;
-          case SPECIAL_TARGET:
-            res->special.target = v;
-            break;
-          case SPECIAL_STRING:
-            if(v >= ctx->strs_sz) {
-              DXC_ERROR("invalid string index in bytecode");
-              return 0;
-            }
-            res->special.str = dxc_copy_str(ctx->strs[v]);
-            break;
-          case SPECIAL_TYPE:
-            if(v >= ctx->types_sz) {
-              DXC_ERROR("invalid type index in bytecode");
-              return 0;
-            }
-            res->special.type = dxc_copy_str(ctx->types[v]);
-            break;
-          case SPECIAL_FIELD:
-            if(v >= ctx->fields_sz) {
-              DXC_ERROR("invalid field index in bytecode");
-              return 0;
-            }
-            res->special.field.defining_class =
-                dxc_copy_str(ctx->fields[v].defining_class);
-            res->special.field.name =
-                dxc_copy_str(ctx->fields[v].name);
-            res->special.field.type =
-                dxc_copy_str(ctx->fields[v].type);
-            break;
-          case SPECIAL_METHOD:
-            if(v >= ctx->methods_sz) {
-              DXC_ERROR("invalid method index in bytecode");
-              return 0;
-            }
-            res->special.method.defining_class =
-                dxc_copy_str(ctx->methods[v].defining_class);
-            res->special.method.name =
-                dxc_copy_str(ctx->methods[v].name);
-            res->special.method.prototype =
-                dxc_copy_strstr(ctx->methods[v].prototype);
-            break;
-          case SPECIAL_INLINE:
-            res->special.inline_ind = v;
-            break;
-          case SPECIAL_OBJECT:
-            res->special.object_off = v;
-            break;
-          case SPECIAL_VTABLE:
-            res->special.vtable_ind = v;
-            break;
-          case SPECIAL_NONE:
-            break;
+        for(j = 0; j < sz; j++) {
+          res->special.sparse_switch.targets[j] =
+              get_int(buf, i + 2 * (sz + j) + 2);
         }
+        break;
+      case PSUEDO_OP_FILL_DATA_ARRAY:
+        res->special.fill_data_array.element_width = sz;
+        res->special.fill_data_array.size = get_int(buf, i + 2);
+        res->special.fill_data_array.data =
+            (dx_ubyte*)payload_alloc(arena,
+                                     sz * res->special.fill_data_array.size);
+        memcpy(res->special.fill_data_array.data, buf + i + 4,
+               sz * res->special.fill_data_array.size);
+        break;
+    }
+    return width;
+  }
+
+  /* Handle the normal opcodes. */
+  const DexOpFormat* fmt = &dex_opcode_formats[res->opcode];
+  res->param[0] = width > 1 ? buf[i + 1] : 0;
+  res->param[1] = width > 2 ? buf[i + 2] : 0;
+  if(fmt->specialType == SPECIAL_NONE) {
+    return width;
+  }
+  dx_ulong v;
+  if(!dxc_decode_special(fmt, buf + i, &v)) {
+    return 0;
+  }
+  switch(fmt->specialType) {
+    case SPECIAL_CONSTANT:
+      res->special.constant = v;
+      break;
+    case SPECIAL_TARGET:
+      res->special.target = v;
+      break;
+    case SPECIAL_STRING:
+      if(v >= ctx->strs_sz) {
+        DXC_ERROR("invalid string index in bytecode");
+        return 0;
+      }
+      res->special.str = dxc_copy_str(ctx->strs[v]);
+      break;
+    case SPECIAL_TYPE:
+      if(v >= ctx->types_sz) {
+        DXC_ERROR("invalid type index in bytecode");
+        return 0;
       }
-      i += fmt->size;
+      res->special.type = dxc_copy_str(ctx->types[v]);
+      break;
+    case SPECIAL_FIELD:
+      if(v >= ctx->fields_sz) {
+        DXC_ERROR("invalid field index in bytecode");
+        return 0;
+      }
+      res->special.field.defining_class =
+          dxc_copy_str(ctx->fields[v].defining_class);
+      res->special.field.name =
+          dxc_copy_str(ctx->fields[v].name);
+      res->special.field.type =
+          dxc_copy_str(ctx->fields[v].type);
+      break;
+    case SPECIAL_METHOD:
+      if(v >= ctx->methods_sz) {
+        DXC_ERROR("invalid method index in bytecode");
+        return 0;
+      }
+      res->special.method.defining_class =
+          dxc_copy_str(ctx->methods[v].defining_class);
+      res->special.method.name =
+          dxc_copy_str(ctx->methods[v].name);
+      res->special.method.prototype =
+          dxc_copy_strstr(ctx->methods[v].prototype);
+      break;
+    case SPECIAL_INLINE:
+      res->special.inline_ind = v;
+      break;
+    case SPECIAL_OBJECT:
+      res->special.object_off = v;
+      break;
+    case SPECIAL_VTABLE:
+      res->special.vtable_ind = v;
+      break;
+    case SPECIAL_NONE:
+      break;
+  }
+  return width;
+}
+
+int dxc_decode_dalvik(read_context* ctx, const dx_ushort* buf, dx_uint size,
+                      DexInstruction** insns, dx_uint* count) {
+  /* Size the array exactly with a first pass over the widths rather than
+   * allocating a slot per code unit. */
+  dx_uint i;
+  dx_uint width;
+  *count = 0;
+  for(i = 0; i < size; i += width) {
+    if(!(width = dxc_dalvik_width(buf, i, size))) {
+      *insns = NULL;
+      return 0;
     }
+    (*count)++;
+  }
+
+  DexInstruction* res;
+  if(!(res = *insns = (DexInstruction*)dxc_ctx_calloc(ctx,
+          *count ? *count : 1, sizeof(DexInstruction)))) {
+    DXC_ERROR("dalvik alloc failed");
+    return 0;
   }
-  if((res = (DexInstruction*)malloc((*count) * sizeof(DexInstruction)))) {
-    memcpy(res, *insns, (*count) * sizeof(DexInstruction));
-    free(*insns);
-    *insns = res;
+  for(i = 0; i < size; i += width, res++) {
+    if(!(width = dxc_decode_insn(ctx, buf, i, size, ctx->arena, res))) {
+      return 0;
+    }
   }
   return 1;
 }
 
+int dxc_read_dalvik(read_context* ctx, dx_uint size, dx_uint off,
+                    DexInstruction** insns, dx_uint* count) {
+  return dxc_decode_dalvik(ctx, (dx_ushort*)(ctx->buf + off), size,
+                           insns, count);
+}
+
 void dxc_free_instruction(DexInstruction* insn) {
   if(!insn) return;
   if(insn->opcode == OP_PSUEDO &&
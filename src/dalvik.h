@@ -22,6 +22,31 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "common.h"
 
+/* Extracts the special value of a normal instruction starting at buf into res,
+ * sign extended for constants and targets.  Returns 0 for formats it cannot
+ * handle. */
+extern
+int dxc_decode_special(const DexOpFormat* fmt, const dx_ushort* buf,
+                       dx_ulong* res);
+
+/* Returns the width in code units of the instruction or payload at buf[i]
+ * after checking that it is a known opcode that fits in the size code units
+ * of buf, or 0 if it does not. */
+extern
+dx_uint dxc_dalvik_width(const dx_ushort* buf, dx_uint i, dx_uint size);
+
+/* Decodes the instruction at buf[i] into res resolving pool indices against
+ * ctx.  Payload tables are allocated from arena, or from the heap when arena
+ * is NULL.  Returns its width or 0 on error. */
+extern
+dx_uint dxc_decode_insn(read_context* ctx, const dx_ushort* buf, dx_uint i,
+                        dx_uint size, struct dxc_arena_t* arena,
+                        DexInstruction* res);
+
+extern
+int dxc_decode_dalvik(read_context* ctx, const dx_ushort* buf, dx_uint size,
+                      DexInstruction** insns, dx_uint* count);
+
 extern
 int dxc_read_dalvik(read_context* ctx, dx_uint size, dx_uint off,
                     DexInstruction** insns, dx_uint* count);
@@ -20,28 +20,37 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdio.h>
 #include <string.h>
 
+#include <dxcut/file.h>
+
+#include "read.h"
+
 static dx_uint NO_INDEX = 0xFFFFFFFFU;
 
 int dxc_read_debug_section(read_context* ctx, DexDebugInfo* debug_info,
                            dx_uint off) {
-  debug_info->line_start = ctx->read_uleb(ctx, &off);
-  dx_uint parameters = ctx->read_uleb(ctx, &off);
+  debug_info->line_start = dxc_read_uleb(ctx, &off);
+  dx_uint parameters = dxc_read_uleb(ctx, &off);
   if(!dxc_in_data(ctx, off)) {
     DXC_ERROR("debug item outside of data section");
     return 0;
   }
 
-  if(!(debug_info->parameter_names = dxc_create_strstr(parameters))) {
+  /* Dropped parameter names are still skipped over but leave an empty list
+   * without touching the string table. */
+  int keep_names = !(ctx->flags & DXC_READ_NO_PARAMETER_NAMES);
+  if(!(debug_info->parameter_names =
+       dxc_ctx_create_strstr(ctx, keep_names ? parameters : 0))) {
     DXC_ERROR("debug parameter alloc failed");
     return 0;
   }
   dx_uint i;
   for(i = 0; i < parameters; i++) {
-    dx_uint str_idx = ctx->read_ulebp1(ctx, &off);
+    dx_uint str_idx = dxc_read_ulebp1(ctx, &off);
     if(!dxc_in_data(ctx, off)) {
       DXC_ERROR("debug item outside of data section");
       return 0;
     }
+    if(!keep_names) continue;
     if(str_idx == NO_INDEX) {
       debug_info->parameter_names->s[i] = dxc_copy_str(&dxc_empty_str);
     } else if(str_idx >= ctx->strs_sz) {
@@ -54,7 +63,7 @@ int dxc_read_debug_section(read_context* ctx, DexDebugInfo* debug_info,
 
   dx_uint sz = 10;
   if(!(debug_info->insns = (DexDebugInstruction*)
-                            calloc(sz, sizeof(DexDebugInstruction)))) {
+                     dxc_ctx_calloc(ctx, sz, sizeof(DexDebugInstruction)))) {
     DXC_ERROR("debug instruction alloc failed");
     return 0;
   }
@@ -65,7 +74,9 @@ int dxc_read_debug_section(read_context* ctx, DexDebugInfo* debug_info,
     }
     if(i == sz) {
       if(!(debug_info->insns = (DexDebugInstruction*)
-           realloc(debug_info->insns, 2 * sz * sizeof(DexDebugInstruction)))) {
+           dxc_ctx_realloc(ctx, debug_info->insns,
+                           sz * sizeof(DexDebugInstruction),
+                           2 * sz * sizeof(DexDebugInstruction)))) {
         DXC_ERROR("debug instruction alloc failed");
         return 0;
       }
@@ -73,24 +84,24 @@ int dxc_read_debug_section(read_context* ctx, DexDebugInfo* debug_info,
       sz *= 2;
     }
     DexDebugInstruction* insn = debug_info->insns + i;
-    insn->opcode = (DexDebugOpCode)ctx->read_ubyte(ctx, &off);
+    insn->opcode = (DexDebugOpCode)dxc_read_ubyte(ctx, &off);
     if(insn->opcode == DBG_END_SEQUENCE) {
       break;
     }
     switch(insn->opcode) {
       case DBG_ADVANCE_PC:
-        insn->p.addr_diff = ctx->read_uleb(ctx, &off);
+        insn->p.addr_diff = dxc_read_uleb(ctx, &off);
         break;
       case DBG_ADVANCE_LINE:
-        insn->p.addr_diff = ctx->read_sleb(ctx, &off);
+        insn->p.addr_diff = dxc_read_sleb(ctx, &off);
         break;
       case DBG_START_LOCAL:
       case DBG_START_LOCAL_EXTENDED: {
-        dx_uint reg_num = ctx->read_uleb(ctx, &off);
-        dx_uint name_idx = ctx->read_ulebp1(ctx, &off);
-        dx_uint type_idx = ctx->read_ulebp1(ctx, &off);
+        dx_uint reg_num = dxc_read_uleb(ctx, &off);
+        dx_uint name_idx = dxc_read_ulebp1(ctx, &off);
+        dx_uint type_idx = dxc_read_ulebp1(ctx, &off);
         dx_uint sig_idx = insn->opcode == DBG_START_LOCAL_EXTENDED ?
-                          ctx->read_ulebp1(ctx, &off) : NO_INDEX;
+                          dxc_read_ulebp1(ctx, &off) : NO_INDEX;
         if((name_idx != NO_INDEX && name_idx >= ctx->strs_sz) ||
            (type_idx != NO_INDEX && type_idx >= ctx->types_sz) ||
            (sig_idx != NO_INDEX && sig_idx >= ctx->strs_sz)) {
@@ -98,7 +109,8 @@ int dxc_read_debug_section(read_context* ctx, DexDebugInfo* debug_info,
           return 0;
         }
         insn->p.start_local =
-            (typeof(insn->p.start_local))malloc(sizeof(*insn->p.start_local));
+            (typeof(insn->p.start_local))dxc_ctx_calloc(ctx, 1,
+                sizeof(*insn->p.start_local));
         insn->p.start_local->register_num = reg_num;
         insn->p.start_local->name = insn->p.start_local->type =
             insn->p.start_local->sig = NULL;
@@ -111,10 +123,10 @@ int dxc_read_debug_section(read_context* ctx, DexDebugInfo* debug_info,
         break;
       } case DBG_END_LOCAL:
       case DBG_RESTART_LOCAL:
-        insn->p.register_num = ctx->read_uleb(ctx, &off);
+        insn->p.register_num = dxc_read_uleb(ctx, &off);
         break;
       case DBG_SET_FILE: {
-        dx_uint name_idx = ctx->read_ulebp1(ctx, &off);
+        dx_uint name_idx = dxc_read_ulebp1(ctx, &off);
         if(name_idx != NO_INDEX && name_idx >= ctx->strs_sz) {
           DXC_ERROR("set file parameters invalid");
           return 0;
@@ -129,8 +141,10 @@ int dxc_read_debug_section(read_context* ctx, DexDebugInfo* debug_info,
       return 0;
     }
   }
+  /* Trim the growth slack.  Not worth it in an arena where the old block
+   * cannot be given back. */
   DexDebugInstruction* reloc;
-  if((reloc = (DexDebugInstruction*)
+  if(!ctx->arena && (reloc = (DexDebugInstruction*)
       malloc((i + 1) * sizeof(DexDebugInstruction)))) {
     memcpy(reloc, debug_info->insns, (i + 1) * sizeof(DexDebugInstruction));
     free(debug_info->insns);
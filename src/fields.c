@@ -23,14 +23,16 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <dxcut/field.h>
 #include <dxcut/annotation.h>
 
+#include "read.h"
+
 int dxc_read_field_section(read_context* ctx, dx_uint off, dx_uint size) {
-  ctx->fields = (raw_field*)calloc(size, sizeof(raw_field));
+  ctx->fields = (raw_field*)dxc_ctx_calloc(ctx, size, sizeof(raw_field));
   ctx->fields_sz = size;
   dx_uint i;
   for(i = 0; i < size; i++) {
-    dx_ushort class_idx = ctx->read_ushort(ctx, &off);
-    dx_ushort type_idx = ctx->read_ushort(ctx, &off);
-    dx_uint name_idx = ctx->read_uint(ctx, &off);
+    dx_ushort class_idx = dxc_read_ushort(ctx, &off);
+    dx_ushort type_idx = dxc_read_ushort(ctx, &off);
+    dx_uint name_idx = dxc_read_uint(ctx, &off);
 
     if(class_idx >= ctx->types_sz) {
       DXC_ERROR("field class index too large");
@@ -55,14 +57,14 @@ int dxc_read_field_section(read_context* ctx, dx_uint off, dx_uint size) {
 
 int dxc_read_encoded_field(read_context* ctx, DexField* fld, ref_str* parent,
                            dx_uint* idx, dx_uint* off) {
-  *idx += ctx->read_uleb(ctx, off);
-  fld->access_flags = (DexAccessFlags)ctx->read_uleb(ctx, off);
+  *idx += dxc_read_uleb(ctx, off);
+  fld->access_flags = (DexAccessFlags)dxc_read_uleb(ctx, off);
   if(*idx >= ctx->fields_sz) {
     DXC_ERROR("encoded field index too large");
     return 0;
   }
   raw_field* rf = ctx->fields + *idx;
-  if(strcmp(rf->defining_class->s, parent->s)) {
+  if(!dxc_str_equal(rf->defining_class, parent)) {
     DXC_ERROR("encoded field appears with undexped defining class");
     return 0;
   }
@@ -73,7 +75,7 @@ int dxc_read_encoded_field(read_context* ctx, DexField* fld, ref_str* parent,
     rf->annotations = NULL;
   } else {
     dxc_make_sentinel_annotation(fld->annotations =
-        (DexAnnotation*)calloc(1, sizeof(DexAnnotation)));
+        (DexAnnotation*)dxc_ctx_calloc(ctx, 1, sizeof(DexAnnotation)));
   }
   return 1;
 }
@@ -18,9 +18,19 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <io.h>
+#endif
 #include <dxcut/file.h>
 #include <dxcut/field.h>
 
+#include "arena.h"
 #include "aux.h"
 #include "classes.h"
 #include "fields.h"
@@ -28,6 +38,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "protos.h"
 #include "read.h"
 #include "strings.h"
+#include "swap.h"
 #include "types.h"
 
 static
@@ -36,105 +47,12 @@ const char DEX_MAGIC[8] = {'d', 'e', 'x', '\n'};
 static
 const char ODEX_MAGIC[8] = {'d', 'e', 'y', '\n'};
 
-static
-const dx_uint ADLER_CHECKSUM_MODULUS = 65521;
-
-dx_uint dxc_checksum(const void* vbuf, int size) {
-  dx_ubyte* buf = (dx_ubyte*)vbuf;
-  dx_uint A = 1;
-  dx_uint B = 0;
-  int i;
-  for(i = 0; i < size; i++) {
-    A += buf[i];
-    if(A >= ADLER_CHECKSUM_MODULUS) A -= ADLER_CHECKSUM_MODULUS;
-    B += A;
-    if(B >= ADLER_CHECKSUM_MODULUS) B -= ADLER_CHECKSUM_MODULUS;
-  }
-  return B << 16 | A;
-}
-
-dx_ubyte* dxc_calc_sha1(const void* vbuf, int size) {
-  dx_ubyte* A = (dx_ubyte*)vbuf;
-  dx_uint w[80];
-
-  int size_start = (size + 9) / 64 * 64 + 56;
-  dx_uint h[5] = {
-    0x67452301,
-    0xEFCDAB89,
-    0x98BADCFE,
-    0x10325476,
-    0xC3D2E1F0
-  };
-  dx_ulong llsize = 8LL * size;
-
-  int i;
-  for(i = 0; i < size_start + 8; ) {
-    int j;
-    for(j = 0; j < 16; j++) {
-      int k = 0;
-      for(k = 0; k < 4; k++, i++) {
-        dx_ubyte v;
-        if(i < size) {
-          v = A[i];
-        } else if(i == size) {
-          v = 0x80;
-        } else if(i < size_start) {
-          v = 0;
-        } else {
-          v = llsize >> 8LL * (7LL - i + size_start) & 0xFF;
-        }
-        w[j] = w[j] << 8;
-        w[j] |= v;
-      }
-    }
-    for(j = 16; j < 80; j++) {
-      w[j] = w[j - 3] ^ w[j - 8] ^ w[j - 14] ^ w[j - 16];
-      w[j] = w[j] << 1 | w[j] >> 31;
-    }
-    dx_uint a = h[0];
-    dx_uint b = h[1];
-    dx_uint c = h[2];
-    dx_uint d = h[3];
-    dx_uint e = h[4];
-    for(j = 0; j < 80; j++) {
-      dx_uint f;
-      dx_uint k;
-      if(j < 20) {
-        f = (b & c) | (~b & d);
-        k = 0x5A827999;
-      } else if(j < 40) {
-        f = b ^ c ^ d;
-        k = 0x6ED9EBA1;
-      } else if(j < 60) {
-        f = (b & c) | (b & d) | (c & d);
-        k = 0x8F1BBCDC;
-      } else {
-        f = b ^ c ^ d;
-        k = 0xCA62C1D6;
-      }
-      dx_uint v = (a << 5 | a >> 27) + f + e + k + w[j];
-      e = d;
-      d = c;
-      c = (b << 30 | b >> 2);
-      b = a;
-      a = v;
-    }
-    h[0] += a;
-    h[1] += b;
-    h[2] += c;
-    h[3] += d;
-    h[4] += e;
-  }
-  dx_ubyte* res = (dx_ubyte*)malloc(20);
-  int pos = 0;
-  for(i = 0; i < 5; i++) {
-    int j;
-    for(j = 24; j >= 0; j -= 8) {
-      res[pos++] = h[i] >> j & 0xFF;
-    }
-  }
-  return res;
-}
+/* Reads that go back to the id tables after the file has been returned, or
+ * whose nodes live in the context's arena, and so need the context to live as
+ * long as the file does. */
+#define KEEP_CONTEXT_FLAGS \
+  (DXC_READ_LAZY_CLASSES | DXC_READ_LAZY_CODE | DXC_READ_COMPACT_CODE | \
+   DXC_READ_ARENA)
 
 void dxc_free_odex_data(OdexData* data) {
   if(!data) return;
@@ -151,19 +69,22 @@ void dxc_free_odex_data(OdexData* data) {
 static
 void free_context(read_context* ctx) {
   dx_uint i;
-  if(ctx->strs) {
+  /* Arena tables and everything they point to go with the arena. */
+  if(ctx->strs && !ctx->arena) {
     for(i = 0; i < ctx->strs_sz; i++) dxc_free_str(ctx->strs[i]);
     free(ctx->strs);
   }
-  if(ctx->types) {
+  if(ctx->types && !ctx->arena) {
     for(i = 0; i < ctx->types_sz; i++) dxc_free_str(ctx->types[i]);
     free(ctx->types);
   }
-  if(ctx->protos) {
+  if(ctx->protos && !ctx->immortal_ids) {
     for(i = 0; i < ctx->protos_sz; i++) dxc_free_strstr(ctx->protos[i]);
     free(ctx->protos);
+    ctx->protos = NULL;
+    ctx->protos_sz = 0;
   }
-  if(ctx->fields) {
+  if(ctx->fields && !ctx->arena) {
     for(i = 0; i < ctx->fields_sz; i++) {
       raw_field fld = ctx->fields[i];
       dxc_free_raw_field(fld);
@@ -177,7 +98,7 @@ void free_context(read_context* ctx) {
     }
     free(ctx->fields);
   }
-  if(ctx->methods) {
+  if(ctx->methods && !ctx->arena) {
     for(i = 0; i < ctx->methods_sz; i++) {
       raw_method mtd = ctx->methods[i];
       dxc_free_raw_method(mtd);
@@ -202,27 +123,19 @@ void free_context(read_context* ctx) {
     }
     free(ctx->methods);
   }
-  if(ctx->classes) {
+  if(ctx->classes && !ctx->arena) {
     for(i = 0; i < ctx->classes_sz; i++) {
       dxc_free_class(ctx->classes + i);
     }
     free(ctx->classes);
   }
-}
-
-DexFile* dxc_read_file(FILE* fin) {
-  if(!fin) return NULL;
-  fseek(fin, 0, SEEK_END);
-  size_t size = ftell(fin);
-  fseek(fin, 0, SEEK_SET);
-  void* buf = malloc(size);
-  if(fread(buf, size, 1, fin) != 1) {
-    DXC_ERROR("failed to read file into buffer");
-    return NULL;
-  }
-  DexFile* res = dxc_read_buffer(buf, size);
-  free(buf);
-  return res;
+  ctx->strs = NULL;
+  ctx->types = NULL;
+  ctx->fields = NULL;
+  ctx->methods = NULL;
+  ctx->classes = NULL;
+  ctx->strs_sz = ctx->types_sz = 0;
+  ctx->fields_sz = ctx->methods_sz = ctx->classes_sz = 0;
 }
 
 static
@@ -234,34 +147,54 @@ dx_uint get_version(char* buf) {
   return (buf[0] - '0') * 100 + (buf[1] - '0') * 10 + buf[2] - '0';
 }
 
-DexFile* dxc_read_buffer(void* vbuf, dx_uint size) {
+static
+DexFile* read_buffer(read_context* ctx, dx_uint size) {
   if(size < 0x70) {
     DXC_ERROR("invalid file size");
     return NULL;
   }
 
-  read_context ctx;
-  memset(&ctx, 0, sizeof(ctx));
-  ctx.buf = (char*)vbuf;
-  fill_read_functions(&ctx);
+  if((ctx->flags & DXC_READ_ARENA) && !ctx->arena) {
+    if(!(ctx->arena = dxc_arena_create())) {
+      DXC_ERROR("failed to alloc arena");
+      return NULL;
+    }
+    /* Nodes cannot be freed one at a time so there is nothing to count. */
+    ctx->immortal_ids = 1;
+  }
+
+  ctx->raw_buf = ctx->buf;
+  int big_endian = dxc_is_big_endian_image(ctx->buf, size);
+  if(big_endian) {
+    if(!(ctx->swap_buf = (char*)malloc(size))) {
+      DXC_ERROR("failed to alloc byte swapped copy");
+      return NULL;
+    }
+    memcpy(ctx->swap_buf, ctx->buf, size);
+    if(!dxc_swap_image(ctx->swap_buf, size, 1)) {
+      return NULL;
+    }
+    ctx->buf = ctx->swap_buf;
+  }
+
   dx_uint pos = 0;
 
   /* Check for file magic header. */
   dx_uint i;
   OdexData* metadata = NULL;
-  if(!memcmp(ctx.buf, ODEX_MAGIC, 4)) {
+  if(!memcmp(ctx->buf, ODEX_MAGIC, 4)) {
     if(!(metadata = (OdexData*)calloc(1, sizeof(OdexData)))) {
       DXC_ERROR("failed to alloc odex data");
       return NULL;
     }
-    ctx.odex_version = get_version(ctx.buf + 4);
-    metadata->odex_version = ctx.odex_version;
-    if(ctx.odex_version == (dx_uint)-1) {
+    ctx->odex_version = get_version(ctx->buf + 4);
+    metadata->odex_version = ctx->odex_version;
+    if(ctx->odex_version == (dx_uint)-1) {
       DXC_ERROR("invalid odex version");
       dxc_free_odex_data(metadata);
       return NULL;
     }
-    switch(ctx.odex_version) {
+    switch(ctx->odex_version) {
       case 35: break;
       case 36: break;
       default:
@@ -271,14 +204,17 @@ DexFile* dxc_read_buffer(void* vbuf, dx_uint size) {
     }
     pos += 8;
 
-    dx_uint dex_off = ctx.read_uint(&ctx, &pos);
-    dx_uint dex_len = ctx.read_uint(&ctx, &pos);
-    dx_uint deps_off = ctx.read_uint(&ctx, &pos);
-    dx_uint deps_len = ctx.read_uint(&ctx, &pos);
-    dx_uint aux_off = ctx.read_uint(&ctx, &pos);
-    dx_uint aux_len = ctx.read_uint(&ctx, &pos);
-    metadata->flags = ctx.read_uint(&ctx, &pos);
-    dx_uint crc = ctx.read_uint(&ctx, &pos);
+    dx_uint dex_off = dxc_read_uint(ctx, &pos);
+    dx_uint dex_len = dxc_read_uint(ctx, &pos);
+    dx_uint deps_off = dxc_read_uint(ctx, &pos);
+    dx_uint deps_len = dxc_read_uint(ctx, &pos);
+    dx_uint aux_off = dxc_read_uint(ctx, &pos);
+    dx_uint aux_len = dxc_read_uint(ctx, &pos);
+    /* Record the byte order the image actually had so that writing it back
+     * out preserves it. */
+    metadata->flags = dxc_read_uint(ctx, &pos) & ~DEX_FLAG_BIG;
+    if(big_endian) metadata->flags |= DEX_FLAG_BIG;
+    dx_uint crc = dxc_read_uint(ctx, &pos);
 
     if(dex_off + dex_len > size) {
       DXC_ERROR("dex file leaves file boundary");
@@ -306,11 +242,11 @@ DexFile* dxc_read_buffer(void* vbuf, dx_uint size) {
       return NULL;
     }
 
-    if(crc != 0xFFFFFFFF) {
+    if(crc != 0xFFFFFFFF && !(ctx->flags & DXC_READ_SKIP_CHECKSUM)) {
       dx_uint crc_start = deps_off ? deps_off : aux_off;
       dx_uint crc_end = aux_off ? aux_off + aux_len :
                         (deps_off ? deps_off + deps_len : 0);
-      dx_uint csum_actual = dxc_checksum(ctx.buf + crc_start,
+      dx_uint csum_actual = dxc_checksum(ctx->raw_buf + crc_start,
                                          crc_end - crc_start);
       if(csum_actual != crc) {
         DXC_ERROR("invalid odex checksum");
@@ -319,30 +255,31 @@ DexFile* dxc_read_buffer(void* vbuf, dx_uint size) {
       }
     }
 
-    if(deps_off != 0 && !dxc_read_deps_table(&ctx, metadata,
+    if(deps_off != 0 && !dxc_read_deps_table(ctx, metadata,
                                              deps_off, deps_len)) {
       dxc_free_odex_data(metadata);
       return NULL;
     }
-    if(aux_off != 0 && !dxc_read_aux_table(&ctx, metadata,
+    if(aux_off != 0 && !dxc_read_aux_table(ctx, metadata,
                                            aux_off, aux_len)) {
       dxc_free_odex_data(metadata);
       return NULL;
     }
 
-    ctx.odex_buf = ctx.buf;
-    ctx.buf += dex_off;
+    ctx->odex_buf = ctx->buf;
+    ctx->buf += dex_off;
+    ctx->raw_buf += dex_off;
     size = dex_len;
     pos = 0;
   }
-  if(!memcmp(ctx.buf, DEX_MAGIC, 4)) {
-    ctx.dex_version = get_version(ctx.buf + 4);
-    if(ctx.dex_version == (dx_uint)-1) {
+  if(!memcmp(ctx->buf, DEX_MAGIC, 4)) {
+    ctx->dex_version = get_version(ctx->buf + 4);
+    if(ctx->dex_version == (dx_uint)-1) {
       DXC_ERROR("invalid dex version");
       dxc_free_odex_data(metadata);
       return NULL;
     }
-    switch(ctx.dex_version) {
+    switch(ctx->dex_version) {
       case 35: break;
       default:
         DXC_ERROR("unknown dex version");
@@ -357,9 +294,10 @@ DexFile* dxc_read_buffer(void* vbuf, dx_uint size) {
   }
 
   /* Check if the checksum is correct. */
-  dx_uint csum_expected = ctx.read_uint(&ctx, &pos);
-  dx_uint csum_actual = dxc_checksum(ctx.buf + pos, size - pos);
-  if(csum_expected != csum_actual) {
+  dx_uint csum_expected = dxc_read_uint(ctx, &pos);
+  if(!(ctx->flags & DXC_READ_SKIP_CHECKSUM) &&
+     csum_expected != dxc_checksum_parallel(ctx->raw_buf + pos, size - pos,
+                                            ctx->nthreads)) {
     DXC_ERROR("invalid dex checksum");
     dxc_free_odex_data(metadata);
     return NULL;
@@ -367,17 +305,16 @@ DexFile* dxc_read_buffer(void* vbuf, dx_uint size) {
 
   if(!metadata) {
     /* Check if the sha1 hash is correct. */
-    int is_match = 1;
-    dx_ubyte* sha1_actual = dxc_calc_sha1(ctx.buf + pos + 20, size - pos - 20);
-    for(i = 0; i < 20 && is_match; i++) {
-      is_match = sha1_actual[i] == ctx.read_ubyte(&ctx, &pos);
-    }
-    free(sha1_actual);
-    if(0 && !is_match) {
-      DXC_ERROR("invalid sha1 hash");
-      dxc_free_odex_data(metadata);
-      return NULL;
+    if(!(ctx->flags & DXC_READ_SKIP_SIGNATURE)) {
+      dx_ubyte sha1_actual[20];
+      dxc_sha1(ctx->raw_buf + pos + 20, size - pos - 20, sha1_actual);
+      if(memcmp(sha1_actual, ctx->buf + pos, 20)) {
+        DXC_ERROR("invalid sha1 hash");
+        dxc_free_odex_data(metadata);
+        return NULL;
+      }
     }
+    pos += 20;
   } else {
     /* For odex files this serves more as an identifier and contains the sha
      * of the dex file prior to optimizations.
@@ -387,58 +324,64 @@ DexFile* dxc_read_buffer(void* vbuf, dx_uint size) {
       dxc_free_odex_data(metadata);
       return NULL;
     }
-    memcpy(metadata->id, ctx.buf + pos, 20);
+    memcpy(metadata->id, ctx->buf + pos, 20);
     pos += 20;
   }
 
-  dx_uint file_size = ctx.read_uint(&ctx, &pos);
+  dx_uint file_size = dxc_read_uint(ctx, &pos);
   if(file_size != size) {
     DXC_ERROR("invalid file size");
     dxc_free_odex_data(metadata);
     return NULL;
   }
 
-  dx_uint header_size = ctx.read_uint(&ctx, &pos);
+  dx_uint header_size = dxc_read_uint(ctx, &pos);
   if(header_size != 0x70) {
     DXC_ERROR("invalid header size");
     dxc_free_odex_data(metadata);
     return NULL;
   }
 
-  dx_uint endian_tag = ctx.read_uint(&ctx, &pos);
+  dx_uint endian_tag = dxc_read_uint(ctx, &pos);
   if(endian_tag != 0x12345678) {
     DXC_ERROR("invalid endian tag");
     dxc_free_odex_data(metadata);
     return NULL;
   }
 
-  dx_uint link_size = ctx.read_uint(&ctx, &pos);
-  dx_uint link_off = ctx.read_uint(&ctx, &pos);
+  dx_uint link_size = dxc_read_uint(ctx, &pos);
+  dx_uint link_off = dxc_read_uint(ctx, &pos);
   if(link_size != 0 || link_off != 0) {
     DXC_ERROR("file has link table, exiting");
     dxc_free_odex_data(metadata);
     return NULL;
   }
 
-  dx_uint map_off = ctx.read_uint(&ctx, &pos);
-
-  dx_uint string_ids_size = ctx.read_uint(&ctx, &pos);
-  dx_uint string_ids_off = ctx.read_uint(&ctx, &pos);
-  dx_uint type_ids_size = ctx.read_uint(&ctx, &pos);
-  dx_uint type_ids_off = ctx.read_uint(&ctx, &pos);
-  dx_uint proto_ids_size = ctx.read_uint(&ctx, &pos);
-  dx_uint proto_ids_off = ctx.read_uint(&ctx, &pos);
-  dx_uint field_ids_size = ctx.read_uint(&ctx, &pos);
-  dx_uint field_ids_off = ctx.read_uint(&ctx, &pos);
-  dx_uint method_ids_size = ctx.read_uint(&ctx, &pos);
-  dx_uint method_ids_off = ctx.read_uint(&ctx, &pos);
-  dx_uint class_defs_size = ctx.read_uint(&ctx, &pos);
-  dx_uint class_defs_off = ctx.read_uint(&ctx, &pos);
-  dx_uint data_size = ctx.read_uint(&ctx, &pos);
-  dx_uint data_off = ctx.read_uint(&ctx, &pos);
-
-  ctx.data_off = data_off;
-  ctx.data_sz = data_size;
+  dx_uint map_off = dxc_read_uint(ctx, &pos);
+
+  dx_uint string_ids_size = dxc_read_uint(ctx, &pos);
+  dx_uint string_ids_off = dxc_read_uint(ctx, &pos);
+  dx_uint type_ids_size = dxc_read_uint(ctx, &pos);
+  dx_uint type_ids_off = dxc_read_uint(ctx, &pos);
+  dx_uint proto_ids_size = dxc_read_uint(ctx, &pos);
+  dx_uint proto_ids_off = dxc_read_uint(ctx, &pos);
+  dx_uint field_ids_size = dxc_read_uint(ctx, &pos);
+  dx_uint field_ids_off = dxc_read_uint(ctx, &pos);
+  dx_uint method_ids_size = dxc_read_uint(ctx, &pos);
+  dx_uint method_ids_off = dxc_read_uint(ctx, &pos);
+  dx_uint class_defs_size = dxc_read_uint(ctx, &pos);
+  dx_uint class_defs_off = dxc_read_uint(ctx, &pos);
+  dx_uint data_size = dxc_read_uint(ctx, &pos);
+  dx_uint data_off = dxc_read_uint(ctx, &pos);
+
+  ctx->data_off = data_off;
+  ctx->data_sz = data_size;
+  ctx->data_end = data_off + data_size;
+  if(data_off + data_size > size || data_off + data_size < data_off) {
+    DXC_ERROR("data section not within file bounds");
+    dxc_free_odex_data(metadata);
+    return NULL;
+  }
   if(string_ids_size != 0 &&
      string_ids_off + STRING_ID_ELEMENT_SIZE * string_ids_size > size) {
     DXC_ERROR("string table not within file bounds");
@@ -476,60 +419,415 @@ DexFile* dxc_read_buffer(void* vbuf, dx_uint size) {
     return NULL;
   }
 
-  if(!dxc_read_string_section(&ctx, string_ids_off, string_ids_size) ||
-     !dxc_read_type_section(&ctx, type_ids_off, type_ids_size) ||
-     !dxc_read_proto_section(&ctx, proto_ids_off, proto_ids_size) ||
-     !dxc_read_field_section(&ctx, field_ids_off, field_ids_size) ||
-     !dxc_read_method_section(&ctx, method_ids_off, method_ids_size) ||
-     !dxc_read_class_section(&ctx, class_defs_off, class_defs_size)) {
-    free_context(&ctx);
+  if(!dxc_read_string_section(ctx, string_ids_off, string_ids_size) ||
+     !dxc_read_type_section(ctx, type_ids_off, type_ids_size) ||
+     !dxc_read_proto_section(ctx, proto_ids_off, proto_ids_size) ||
+     !dxc_read_field_section(ctx, field_ids_off, field_ids_size) ||
+     !dxc_read_method_section(ctx, method_ids_off, method_ids_size) ||
+     !((ctx->flags & DXC_READ_LAZY_CLASSES) ?
+       dxc_index_class_section(ctx, class_defs_off, class_defs_size) :
+       dxc_read_class_section(ctx, class_defs_off, class_defs_size))) {
+    free_context(ctx);
     dxc_free_odex_data(metadata);
     return NULL;
   }
   DexFile* ret = (DexFile*)calloc(1, sizeof(DexFile));
   if(!ret) {
     DXC_ERROR("file pointer alloc failed");
-    free_context(&ctx);
+    free_context(ctx);
     dxc_free_odex_data(metadata);
     return NULL;
   }
 
-  ret->classes = ctx.classes;
+  ret->classes = ctx->classes;
   ret->metadata = metadata;
-  ctx.classes = NULL;
-  ctx.classes_sz = 0;
+  ctx->classes = NULL;
+  ctx->classes_sz = 0;
 
   ret->method_table_size = method_ids_size;
   ret->field_table_size = field_ids_size;
   ret->type_table_size = type_ids_size;
-  ret->method_table = (ref_method*)malloc(sizeof(ref_method) *
-                                             ret->method_table_size);
-  ret->field_table = (ref_field*)malloc(sizeof(ref_field) *
-                                           ret->field_table_size);
-  ret->type_table = (ref_str**)malloc(sizeof(ref_str*) *
-                                             ret->type_table_size);
+  ret->method_table = (ref_method*)dxc_ctx_calloc(ctx,
+      ret->method_table_size, sizeof(ref_method));
+  ret->field_table = (ref_field*)dxc_ctx_calloc(ctx,
+      ret->field_table_size, sizeof(ref_field));
+  ret->type_table = (ref_str**)dxc_ctx_calloc(ctx,
+      ret->type_table_size, sizeof(ref_str*));
   for(i = 0; i < ret->method_table_size; ++i) {
     ret->method_table[i].defining_class =
-        dxc_copy_str(ctx.methods[i].defining_class);
-    ret->method_table[i].prototype = dxc_copy_strstr(ctx.methods[i].prototype);
-    ret->method_table[i].name = dxc_copy_str(ctx.methods[i].name);
+        dxc_copy_str(ctx->methods[i].defining_class);
+    ret->method_table[i].prototype = dxc_copy_strstr(ctx->methods[i].prototype);
+    ret->method_table[i].name = dxc_copy_str(ctx->methods[i].name);
   }
   for(i = 0; i < ret->field_table_size; ++i) {
     ret->field_table[i].defining_class =
-        dxc_copy_str(ctx.fields[i].defining_class);
-    ret->field_table[i].type = dxc_copy_str(ctx.fields[i].type);
-    ret->field_table[i].name = dxc_copy_str(ctx.fields[i].name);
+        dxc_copy_str(ctx->fields[i].defining_class);
+    ret->field_table[i].type = dxc_copy_str(ctx->fields[i].type);
+    ret->field_table[i].name = dxc_copy_str(ctx->fields[i].name);
   }
   for(i = 0; i < ret->type_table_size; ++i) {
-    ret->type_table[i] = dxc_copy_str(ctx.types[i]);
+    ret->type_table[i] = dxc_copy_str(ctx->types[i]);
   }
 
-  free_context(&ctx);
+  /* Lazily decoded classes and code and compact code still need the id
+   * tables. */
+  if(!(ctx->flags & KEEP_CONTEXT_FLAGS)) {
+    free_context(ctx);
+  }
+  return ret;
+}
+
+DexFile* dxc_read_buffer(void* vbuf, dx_uint size) {
+  return dxc_read_buffer_ex(vbuf, size, NULL);
+}
+
+DexFile* dxc_read_buffer_parallel(void* vbuf, dx_uint size,
+                                  dx_uint nthreads) {
+  DexReadOptions opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.nthreads = nthreads;
+  return dxc_read_buffer_ex(vbuf, size, &opts);
+}
+
+static
+void release_context(read_context* ctx) {
+  dx_uint i;
+  free_context(ctx);
+  if(ctx->protos && !ctx->arena) {
+    /* Immortal protos are owned by the context unless they were interned. */
+    if(!ctx->intern) {
+      for(i = 0; i < ctx->protos_sz; i++) free(ctx->protos[i]);
+    }
+    free(ctx->protos);
+  }
+  free(ctx->str_block);
+  free(ctx->swap_buf);
+  free(ctx->class_loaded);
+  free(ctx->class_index);
+  dxc_arena_destroy(ctx->arena);
+  if(ctx->map_malloced) {
+    free(ctx->map_base);
+  } else if(ctx->map_base) {
+#ifndef WIN32
+    munmap(ctx->map_base, ctx->map_size);
+#endif
+  }
+  free(ctx);
+}
+
+DexFile* dxc_read_buffer_ex(void* vbuf, dx_uint size,
+                            const DexReadOptions* opts) {
+  read_context ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.buf = (char*)vbuf;
+  if(opts) {
+    ctx.flags = opts->flags;
+    ctx.nthreads = opts->nthreads;
+    ctx.intern = opts->intern_pool;
+  }
+  if(!(ctx.flags & KEEP_CONTEXT_FLAGS)) {
+    DexFile* ret = read_buffer(&ctx, size);
+    free(ctx.swap_buf);
+    return ret;
+  }
+
+  /* Lazy decoding and compact code go back to the id tables later so the
+   * context has to live as long as the file does.  The buffer itself stays
+   * the caller's. */
+  read_context* hctx = (read_context*)malloc(sizeof(read_context));
+  if(!hctx) {
+    DXC_ERROR("failed to alloc read context");
+    return NULL;
+  }
+  *hctx = ctx;
+  DexFile* ret = read_buffer(hctx, size);
+  if(!ret) {
+    release_context(hctx);
+    return NULL;
+  }
+  ret->context = hctx;
+  return ret;
+}
+
+/* Parses the input held by ctx and hands ctx over to the resulting file so
+ * that borrowed strings stay valid for its lifetime. */
+static
+DexFile* read_owned(read_context* ctx) {
+  ctx->buf = (char*)ctx->map_base;
+  ctx->immortal_ids = 1;
+
+  DexFile* ret = read_buffer(ctx, ctx->map_size);
+  if(!ret) {
+    release_context(ctx);
+    return NULL;
+  }
+  ret->context = ctx;
   return ret;
 }
 
+/* Largest buffer allocated up front on the word of a stream's header; bigger
+ * inputs grow the buffer as their data arrives. */
+#define MAX_SIZE_HINT (64U << 20)
+
+/* Where a stream read pulls its bytes from: fin if set, otherwise fd. */
+typedef struct {
+  FILE* fin;
+  int fd;
+} stream_source;
+
+static
+size_t stream_read(stream_source* src, char* buf, size_t n) {
+  if(src->fin) return fread(buf, 1, n, src->fin);
+  size_t got = 0;
+  while(got < n) {
+    ssize_t r = read(src->fd, buf + got, n - got);
+    if(r < 0 && errno == EINTR) continue;
+    if(r <= 0) break;
+    got += r;
+  }
+  return got;
+}
+
+static
+dx_uint header_uint(const dx_ubyte* p, int big) {
+  return big ? (dx_uint)p[0] << 24 | (dx_uint)p[1] << 16 | p[2] << 8 | p[3] :
+               (dx_uint)p[3] << 24 | (dx_uint)p[2] << 16 | p[1] << 8 | p[0];
+}
+
+/* Returns the total input size claimed by the first 0x70 bytes of a dex or
+ * odex file, or 0 if they do not look like one. */
+static
+dx_uint header_size_hint(const dx_ubyte* h) {
+  if(!memcmp(h, ODEX_MAGIC, 4)) {
+    /* The dex file follows the 0x28 byte odex header. */
+    int big = header_uint(h + 8, 0) != 0x28;
+    dx_uint end = 0;
+    dx_uint i;
+    for(i = 8; i < 0x28; i += 8) {
+      dx_uint e = header_uint(h + i, big) + header_uint(h + i + 4, big);
+      if(e > end) end = e;
+    }
+    return end;
+  }
+  if(!memcmp(h, DEX_MAGIC, 4)) {
+    return header_uint(h + 0x20, header_uint(h + 0x28, 0) != 0x12345678);
+  }
+  return 0;
+}
+
+/* Reads all of src into a buffer owned by ctx, sizing it from the header
+ * instead of seeking so that pipes and sockets work. */
+static
+int read_stream(read_context* ctx, stream_source* src) {
+  char header[0x70];
+  size_t size = stream_read(src, header, sizeof(header));
+  if(size < sizeof(header)) {
+    DXC_ERROR("invalid file size");
+    return 0;
+  }
+  size_t cap = header_size_hint((dx_ubyte*)header);
+  if(cap > MAX_SIZE_HINT) cap = MAX_SIZE_HINT;
+  if(cap < 2 * sizeof(header)) cap = 2 * sizeof(header);
+  char* buf = (char*)malloc(cap);
+  if(!buf) {
+    DXC_ERROR("failed to alloc file buffer");
+    return 0;
+  }
+  memcpy(buf, header, size);
+  for(;;) {
+    if(size == cap) {
+      /* A full buffer usually means the header's size was right; only grow
+       * if more data actually follows. */
+      char next;
+      if(!stream_read(src, &next, 1)) break;
+      if(cap > 0xFFFFFFFFU / 2) {
+        DXC_ERROR("invalid file size");
+        free(buf);
+        return 0;
+      }
+      char* grown = (char*)realloc(buf, cap * 2);
+      if(!grown) {
+        DXC_ERROR("failed to alloc file buffer");
+        free(buf);
+        return 0;
+      }
+      buf = grown;
+      cap *= 2;
+      buf[size++] = next;
+    }
+    size_t got = stream_read(src, buf + size, cap - size);
+    size += got;
+    if(size < cap) break;
+  }
+  /* The buffer lives as long as the file, so give back what the hint or the
+   * last doubling overshot. */
+  if(size < cap) {
+    char* shrunk = (char*)realloc(buf, size);
+    if(shrunk) buf = shrunk;
+  }
+  ctx->map_base = buf;
+  ctx->map_size = size;
+  ctx->map_malloced = 1;
+  return 1;
+}
+
+static
+DexFile* read_source(stream_source* src, const DexReadOptions* opts) {
+  read_context* ctx = (read_context*)calloc(1, sizeof(read_context));
+  if(!ctx) {
+    DXC_ERROR("failed to alloc read context");
+    return NULL;
+  }
+  if(opts) {
+    ctx->flags = opts->flags;
+    ctx->nthreads = opts->nthreads;
+    ctx->intern = opts->intern_pool;
+  }
+  if(!read_stream(ctx, src)) {
+    release_context(ctx);
+    return NULL;
+  }
+  return read_owned(ctx);
+}
+
+DexFile* dxc_read_file(FILE* fin) {
+  if(!fin) return NULL;
+  stream_source src;
+  src.fin = fin;
+  src.fd = -1;
+  return read_source(&src, NULL);
+}
+
+DexFile* dxc_read_fd(int fd) {
+  return dxc_read_fd_ex(fd, NULL);
+}
+
+DexFile* dxc_read_fd_ex(int fd, const DexReadOptions* opts) {
+  if(fd < 0) return NULL;
+  stream_source src;
+  src.fin = NULL;
+  src.fd = fd;
+  return read_source(&src, opts);
+}
+
+DexFile* dxc_open_mmap(const char* path) {
+  return dxc_open_mmap_flags(path, 0);
+}
+
+DexFile* dxc_open_mmap_flags(const char* path, dx_uint flags) {
+  DexReadOptions opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.flags = flags;
+  return dxc_open_mmap_ex(path, &opts);
+}
+
+DexFile* dxc_open_mmap_ex(const char* path, const DexReadOptions* opts) {
+  read_context* ctx = (read_context*)calloc(1, sizeof(read_context));
+  if(!ctx) {
+    DXC_ERROR("failed to alloc read context");
+    return NULL;
+  }
+  dx_uint flags = 0;
+  if(opts) {
+    ctx->flags = flags = opts->flags;
+    ctx->nthreads = opts->nthreads;
+    ctx->intern = opts->intern_pool;
+  }
+#ifndef WIN32
+  int fd = open(path, O_RDONLY);
+  if(fd == -1) {
+    DXC_ERROR("failed to open file");
+    free(ctx);
+    return NULL;
+  }
+  struct stat st;
+  if(fstat(fd, &st) == -1 || st.st_size < 0x70 ||
+     (dx_ulong)st.st_size > 0xFFFFFFFFULL) {
+    DXC_ERROR("invalid file size");
+    close(fd);
+    free(ctx);
+    return NULL;
+  }
+  int map_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+  /* Every page gets touched by a full read so fault them in up front. */
+  if(!(flags & DXC_READ_LAZY_CLASSES)) map_flags |= MAP_POPULATE;
+#endif
+  void* map = mmap(NULL, st.st_size, PROT_READ, map_flags, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    DXC_ERROR("failed to map file");
+    free(ctx);
+    return NULL;
+  }
+  ctx->map_base = map;
+  ctx->map_size = st.st_size;
+#else
+  FILE* fin = fopen(path, "rb");
+  if(!fin) {
+    DXC_ERROR("failed to open file");
+    free(ctx);
+    return NULL;
+  }
+  fseek(fin, 0, SEEK_END);
+  ctx->map_size = ftell(fin);
+  fseek(fin, 0, SEEK_SET);
+  ctx->map_base = malloc(ctx->map_size);
+  ctx->map_malloced = 1;
+  if(!ctx->map_base || fread(ctx->map_base, ctx->map_size, 1, fin) != 1) {
+    DXC_ERROR("failed to read file into buffer");
+    fclose(fin);
+    release_context(ctx);
+    return NULL;
+  }
+  fclose(fin);
+#endif
+  return read_owned(ctx);
+}
+
+void dxc_close(DexFile* dex) {
+  dxc_free_file(dex);
+}
+
+DexClass* dxc_get_class(DexFile* dex, const char* descriptor) {
+  read_context* ctx = dex->context;
+  if(ctx && ctx->class_index) {
+    dx_int i = dxc_find_class_def(ctx, dex->classes, descriptor);
+    if(i == -1 || !dxc_load_class_def(ctx, dex->classes + i, i)) {
+      return NULL;
+    }
+    return dex->classes + i;
+  }
+
+  DexClass* cl;
+  for(cl = dex->classes; !dxc_is_sentinel_class(cl); cl++) {
+    if(!strcmp(cl->name->s, descriptor)) return cl;
+  }
+  return NULL;
+}
+
+int dxc_load_all_classes(DexFile* dex) {
+  read_context* ctx = dex->context;
+  if(!ctx || !ctx->class_loaded) return 1;
+
+  dx_uint i;
+  for(i = 0; !dxc_is_sentinel_class(dex->classes + i); i++) {
+    if(!dxc_load_class_def(ctx, dex->classes + i, i)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
 void dxc_free_file(DexFile* dex) {
   DexClass* cl;
+  if(dex->context && dex->context->arena) {
+    /* The classes and all they point to go with the arena. */
+    dxc_free_odex_data(dex->metadata);
+    release_context(dex->context);
+    free(dex);
+    return;
+  }
   if(dex->classes) {
     for(cl = dex->classes; !dxc_is_sentinel_class(cl); cl++) {
       dxc_free_class(cl);
@@ -537,5 +835,8 @@ void dxc_free_file(DexFile* dex) {
   }
   dxc_free_odex_data(dex->metadata);
   free(dex->classes);
+  if(dex->context) {
+    release_context(dex->context);
+  }
   free(dex);
 }
@@ -19,8 +19,33 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <dxcut/dex.h>
 
+#include <stddef.h>
+
 dx_uint dxc_checksum(const void* vbuf, int size);
 
-dx_ubyte* dxc_calc_sha1(const void* vbuf, int size);
+/* Continues an Adler-32 checksum; start from 1 for a fresh checksum. */
+dx_uint dxc_checksum_update(dx_uint adler, const void* buf, dx_uint size);
+
+/* Returns the checksum of the concatenation of two buffers given both of
+ * their checksums and the length of the second. */
+dx_uint dxc_checksum_combine(dx_uint adler1, dx_uint adler2, dx_uint len2);
+
+/* Checksums large buffers in chunks spread across nthreads threads. */
+dx_uint dxc_checksum_parallel(const void* buf, dx_uint size, dx_uint nthreads);
+
+typedef struct {
+  dx_uint h[5];
+  dx_ulong len;
+  dx_ubyte buf[64];
+} dxc_sha1_ctx;
+
+/* Incremental SHA-1; the digest written by dxc_sha1_final is 20 bytes. */
+void dxc_sha1_init(dxc_sha1_ctx* sha);
+
+void dxc_sha1_update(dxc_sha1_ctx* sha, const void* buf, size_t size);
+
+void dxc_sha1_final(dxc_sha1_ctx* sha, dx_ubyte* digest);
+
+void dxc_sha1(const void* buf, size_t size, dx_ubyte* digest);
 
 #endif // DEX_FILE_H
@@ -0,0 +1,119 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
+
+#include <dxcut/file.h>
+
+#include "common.h"
+#include "threads.h"
+
+typedef struct {
+  dx_ulong size;
+  dx_uint index;
+} file_order;
+
+typedef struct {
+  const char* const* paths;
+  DexReadOptions opts;
+  DexFileSet* set;
+  /* The files in the order they are handed out, largest first. */
+  file_order* order;
+} file_set_task;
+
+static
+int read_file_task(void* vtask, dx_uint i) {
+  file_set_task* task = (file_set_task*)vtask;
+  dx_uint idx = task->order[i].index;
+  DexFile* dex = dxc_open_mmap_ex(task->paths[idx], &task->opts);
+  task->set->files[idx] = dex;
+  if(!dex) __atomic_fetch_add(&task->set->failed, 1, __ATOMIC_RELAXED);
+  /* A bad file only fails itself. */
+  return 1;
+}
+
+static
+int compare_size_desc(const void* va, const void* vb) {
+  const file_order* a = (const file_order*)va;
+  const file_order* b = (const file_order*)vb;
+  if(a->size != b->size) return a->size < b->size ? 1 : -1;
+  return a->index < b->index ? -1 : 1;
+}
+
+DexFileSet* dxc_read_files(const char* const* paths, dx_uint n,
+                           const DexReadOptions* opts, dx_uint nthreads) {
+  DexFileSet* set = (DexFileSet*)calloc(1, sizeof(DexFileSet));
+  if(!set) {
+    DXC_ERROR("failed to alloc file set");
+    return NULL;
+  }
+  file_set_task task;
+  memset(&task, 0, sizeof(task));
+  if(opts) task.opts = *opts;
+  task.paths = paths;
+  task.set = set;
+  set->count = n;
+  if(!(set->files = (DexFile**)calloc(n ? n : 1, sizeof(DexFile*))) ||
+     !(task.order = (file_order*)calloc(n ? n : 1, sizeof(file_order)))) {
+    DXC_ERROR("failed to alloc file set");
+    free(task.order);
+    free(set->files);
+    free(set);
+    return NULL;
+  }
+  if(!task.opts.intern_pool) {
+    if(!(task.opts.intern_pool = dxc_create_intern_pool())) {
+      DXC_ERROR("failed to alloc intern pool");
+      free(task.order);
+      free(set->files);
+      free(set);
+      return NULL;
+    }
+    set->owns_intern_pool = 1;
+  }
+  set->intern_pool = task.opts.intern_pool;
+
+  /* Starting on the largest files keeps one big file from being left for the
+   * end when everything else is done. */
+  dx_uint i;
+  for(i = 0; i < n; i++) {
+    task.order[i].index = i;
+#ifndef WIN32
+    struct stat st;
+    if(!stat(paths[i], &st)) task.order[i].size = st.st_size;
+#endif
+  }
+  qsort(task.order, n, sizeof(file_order), compare_size_desc);
+
+  dxc_run_tasks_batched(nthreads, n, 1, read_file_task, &task);
+  free(task.order);
+  return set;
+}
+
+void dxc_free_file_set(DexFileSet* set) {
+  if(!set) return;
+  dx_uint i;
+  for(i = 0; i < set->count; i++) {
+    if(set->files[i]) dxc_free_file(set->files[i]);
+  }
+  if(set->owns_intern_pool) dxc_free_intern_pool(set->intern_pool);
+  free(set->files);
+  free(set);
+}
@@ -0,0 +1,226 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <dxcut/intern.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "common.h"
+
+/* Each table is split into shards with their own lock, picked by the low bits
+ * of the hash, so that parallel reads rarely wait on one another. */
+#define INTERN_SHARD_BITS 6
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+
+typedef struct {
+  dx_uint hash;
+  void* obj;
+} intern_slot;
+
+typedef struct {
+  int lock;
+  dx_uint size;
+  /* Capacity - 1; the capacity is a power of two kept at most half full. */
+  dx_uint mask;
+  intern_slot* slots;
+} intern_shard;
+
+struct dex_intern_pool_t {
+  /* Holds the interned objects themselves. */
+  dxc_arena* arena;
+  intern_shard strs[INTERN_SHARDS];
+  intern_shard lists[INTERN_SHARDS];
+};
+
+static
+void shard_lock(intern_shard* shard) {
+  while(__atomic_exchange_n(&shard->lock, 1, __ATOMIC_ACQUIRE)) {
+    while(__atomic_load_n(&shard->lock, __ATOMIC_RELAXED));
+  }
+}
+
+static
+void shard_unlock(intern_shard* shard) {
+  __atomic_store_n(&shard->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Doubles the shard once it is half full.  Returns 0 if out of memory. */
+static
+int shard_reserve(intern_shard* shard) {
+  if(shard->slots && 2 * (shard->size + 1) <= shard->mask + 1) return 1;
+  dx_uint cap = shard->slots ? 2 * (shard->mask + 1) : 64;
+  intern_slot* slots = (intern_slot*)calloc(cap, sizeof(intern_slot));
+  if(!slots) return 0;
+  dx_uint i;
+  for(i = 0; shard->slots && i <= shard->mask; i++) {
+    intern_slot* slot = shard->slots + i;
+    if(!slot->obj) continue;
+    dx_uint h = slot->hash >> INTERN_SHARD_BITS;
+    while(slots[h & (cap - 1)].obj) h++;
+    slots[h & (cap - 1)] = *slot;
+  }
+  free(shard->slots);
+  shard->slots = slots;
+  shard->mask = cap - 1;
+  return 1;
+}
+
+static
+int str_equal(const void* obj, const void* key) {
+  return !strcmp(((const ref_str*)obj)->s, (const char*)key);
+}
+
+static
+int list_equal(const void* obj, const void* key) {
+  ref_str* const* a = ((const ref_strstr*)obj)->s;
+  ref_str* const* b = (ref_str* const*)key;
+  for(; *a && *a == *b; a++, b++);
+  return *a == *b;
+}
+
+/* Returns the object in the shard equal to key, creating it with make(pool,
+ * key) if there is none. */
+static
+void* shard_intern(DexInternPool* pool, intern_shard* shard, dx_uint hash,
+                   const void* key, int (*equal)(const void*, const void*),
+                   void* (*make)(DexInternPool*, const void*)) {
+  shard_lock(shard);
+  if(!shard_reserve(shard)) {
+    shard_unlock(shard);
+    DXC_ERROR("intern table alloc failed");
+    return NULL;
+  }
+  dx_uint h = hash >> INTERN_SHARD_BITS;
+  intern_slot* slot;
+  for(;; h++) {
+    slot = shard->slots + (h & shard->mask);
+    if(!slot->obj) break;
+    if(slot->hash == hash && equal(slot->obj, key)) {
+      void* ret = slot->obj;
+      shard_unlock(shard);
+      return ret;
+    }
+  }
+  void* ret = make(pool, key);
+  if(ret) {
+    slot->hash = hash;
+    slot->obj = ret;
+    shard->size++;
+  }
+  shard_unlock(shard);
+  return ret;
+}
+
+static
+void* make_str(DexInternPool* pool, const void* key) {
+  dx_uint len = strlen((const char*)key);
+  ref_str* ret = (ref_str*)dxc_arena_alloc(pool->arena,
+                                           sizeof(ref_str) + len + 1);
+  if(!ret) {
+    DXC_ERROR("interned str alloc failed");
+    return NULL;
+  }
+  ret->s = (char*)(ret + 1);
+  memcpy(ret->s, key, len + 1);
+  dxc_fill_str_info(ret);
+  ret->cnt = DXC_REF_IMMORTAL;
+  return ret;
+}
+
+static
+void* make_list(DexInternPool* pool, const void* key) {
+  ref_str* const* s = (ref_str* const*)key;
+  dx_uint sz;
+  for(sz = 0; s[sz]; sz++);
+  ref_strstr* ret = (ref_strstr*)dxc_arena_alloc(pool->arena,
+      offsetof(ref_strstr, s) + (sz + 1) * sizeof(ref_str*));
+  if(!ret) {
+    DXC_ERROR("interned strstr alloc failed");
+    return NULL;
+  }
+  ret->cnt = DXC_REF_IMMORTAL;
+  memcpy(ret->s, s, (sz + 1) * sizeof(ref_str*));
+  return ret;
+}
+
+DexInternPool* dxc_create_intern_pool(void) {
+  DexInternPool* pool = (DexInternPool*)calloc(1, sizeof(DexInternPool));
+  if(!pool) return NULL;
+  if(!(pool->arena = dxc_arena_create())) {
+    free(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+void dxc_free_intern_pool(DexInternPool* pool) {
+  if(!pool) return;
+  dx_uint i;
+  for(i = 0; i < INTERN_SHARDS; i++) {
+    free(pool->strs[i].slots);
+    free(pool->lists[i].slots);
+  }
+  dxc_arena_destroy(pool->arena);
+  free(pool);
+}
+
+static
+ref_str* intern_hashed(DexInternPool* pool, const char* s, dx_uint hash) {
+  return (ref_str*)shard_intern(pool,
+      pool->strs + (hash & (INTERN_SHARDS - 1)), hash, s, str_equal,
+      make_str);
+}
+
+ref_str* dxc_intern_str(DexInternPool* pool, const char* s) {
+  return intern_hashed(pool, s, dxc_hash_str(s));
+}
+
+ref_strstr* dxc_intern_strstr(DexInternPool* pool, ref_str* const* s) {
+  /* Canonicalize the members first so that lists compare by pointer. */
+  ref_str* local[16];
+  ref_str** canon = local;
+  dx_uint sz;
+  for(sz = 0; s[sz]; sz++);
+  if(sz + 1 > sizeof(local) / sizeof(*local) &&
+     !(canon = (ref_str**)malloc((sz + 1) * sizeof(ref_str*)))) {
+    DXC_ERROR("intern strstr alloc failed");
+    return NULL;
+  }
+
+  /* FNV-1a over the canonical pointers. */
+  dx_uint hash = 2166136261U;
+  dx_uint i;
+  for(i = 0; i < sz; i++) {
+    if(!(canon[i] = intern_hashed(pool, s[i]->s, dxc_str_hash(s[i])))) {
+      if(canon != local) free(canon);
+      return NULL;
+    }
+    hash = (hash ^ (dx_uint)((size_t)canon[i] >> 4)) * 16777619U;
+  }
+  canon[sz] = NULL;
+  /* Spread the pointer bits into the low bits that pick the shard. */
+  hash ^= hash >> 16;
+  hash *= 0x85EBCA6BU;
+  hash ^= hash >> 13;
+
+  ref_strstr* ret = (ref_strstr*)shard_intern(pool,
+      pool->lists + (hash & (INTERN_SHARDS - 1)), hash, canon, list_equal,
+      make_list);
+  if(canon != local) free(canon);
+  return ret;
+}
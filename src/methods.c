@@ -20,18 +20,20 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdio.h>
 #include <string.h>
 
+#include <dxcut/file.h>
 #include <dxcut/method.h>
 
 #include "code.h"
+#include "read.h"
 
 int dxc_read_method_section(read_context* ctx, dx_uint off, dx_uint size) {
-  ctx->methods = (raw_method*)calloc(size, sizeof(raw_method));
+  ctx->methods = (raw_method*)dxc_ctx_calloc(ctx, size, sizeof(raw_method));
   ctx->methods_sz = size;
   dx_uint i;
   for(i = 0; i < size; i++) {
-    dx_ushort class_idx = ctx->read_ushort(ctx, &off);
-    dx_ushort proto_idx = ctx->read_ushort(ctx, &off);
-    dx_uint name_idx = ctx->read_uint(ctx, &off);
+    dx_ushort class_idx = dxc_read_ushort(ctx, &off);
+    dx_ushort proto_idx = dxc_read_ushort(ctx, &off);
+    dx_uint name_idx = dxc_read_uint(ctx, &off);
 
     if(class_idx >= ctx->types_sz) {
       DXC_ERROR("method class type index too large");
@@ -57,9 +59,9 @@ int dxc_read_method_section(read_context* ctx, dx_uint off, dx_uint size) {
 int dxc_read_encoded_method(read_context* ctx, DexMethod* method,
                             ref_str* parent, dx_uint* method_idx,
                             dx_uint* off) {
-  *method_idx += ctx->read_uleb(ctx, off);
-  dx_uint access_flags = ctx->read_uleb(ctx, off);
-  dx_uint code_off = ctx->read_uleb(ctx, off);
+  *method_idx += dxc_read_uleb(ctx, off);
+  dx_uint access_flags = dxc_read_uleb(ctx, off);
+  dx_uint code_off = dxc_read_uleb(ctx, off);
   if(!dxc_in_data(ctx, *off)) {
     DXC_ERROR("encoded method not in data section");
     return 0;
@@ -69,7 +71,7 @@ int dxc_read_encoded_method(read_context* ctx, DexMethod* method,
     return 0;
   }
   raw_method* rm = ctx->methods + *method_idx;
-  if(strcmp(rm->defining_class->s, parent->s)) {
+  if(!dxc_str_equal(rm->defining_class, parent)) {
     DXC_ERROR("encoded method points to method with wrong parent type");
     return 0;
   }
@@ -80,7 +82,7 @@ int dxc_read_encoded_method(read_context* ctx, DexMethod* method,
     rm->annotations = NULL;
   } else {
     dxc_make_sentinel_annotation(method->annotations =
-        (DexAnnotation*)calloc(1, sizeof(DexAnnotation)));
+        (DexAnnotation*)dxc_ctx_calloc(ctx, 1, sizeof(DexAnnotation)));
   }
 
   // Check for any parameter annotations that were associated with this
@@ -90,7 +92,7 @@ int dxc_read_encoded_method(read_context* ctx, DexMethod* method,
     rm->parameter_annotations = NULL;
   } else {
     method->parameter_annotations =
-        (DexAnnotation**)calloc(1, sizeof(DexAnnotation*));
+        (DexAnnotation**)dxc_ctx_calloc(ctx, 1, sizeof(DexAnnotation*));
   }
 
   method->access_flags = (DexAccessFlags)access_flags;
@@ -99,8 +101,22 @@ int dxc_read_encoded_method(read_context* ctx, DexMethod* method,
   
   if(code_off == 0) {
     method->code_body = NULL;
+  } else if(ctx->flags & DXC_READ_LAZY_CODE) {
+    method->code_body = NULL;
+    method->code_off = code_off;
+    method->code_source = ctx;
+  } else if(ctx->flags & DXC_READ_COMPACT_CODE) {
+    method->code_body = NULL;
+    if(!(method->compact_code =
+         (DexCompactCode*)dxc_ctx_calloc(ctx, 1, sizeof(DexCompactCode)))) {
+      DXC_ERROR("failed to alloc compact code");
+      return 0;
+    }
+    if(!dxc_read_compact_code(ctx, method->compact_code, code_off)) {
+      return 0;
+    }
   } else {
-    method->code_body = (DexCode*)calloc(1, sizeof(DexCode));
+    method->code_body = (DexCode*)dxc_ctx_calloc(ctx, 1, sizeof(DexCode));
     if(!dxc_read_code(ctx, method->code_body, code_off)) {
       return 0;
     }
@@ -109,9 +125,74 @@ int dxc_read_encoded_method(read_context* ctx, DexMethod* method,
   return 1;
 }
 
+DexCode* dxc_method_code(DexMethod* method) {
+  if(method->code_body || (!method->code_off && !method->compact_code)) {
+    return method->code_body;
+  }
+  read_context* ctx = method->compact_code ? method->compact_code->source :
+                                             method->code_source;
+  DexCode* code = (DexCode*)dxc_ctx_calloc(ctx, 1, sizeof(DexCode));
+  if(!code) {
+    DXC_ERROR("failed to alloc code body");
+    return NULL;
+  }
+  if(method->compact_code) {
+    DexCompactCode* compact = method->compact_code;
+    if(!dxc_expand_compact_code(compact, code)) {
+      if(!ctx->arena) dxc_free_code(code);
+      dxc_ctx_free(ctx, code);
+      return NULL;
+    }
+    code->debug_information = compact->debug_information;
+    code->tries = compact->tries;
+    compact->debug_information = NULL;
+    compact->tries = NULL;
+    if(!ctx->arena) dxc_free_compact_code(compact);
+    dxc_ctx_free(ctx, compact);
+    method->compact_code = NULL;
+    method->code_body = code;
+    return code;
+  }
+  if(!dxc_read_code(ctx, code, method->code_off)) {
+    if(!ctx->arena) dxc_free_code(code);
+    dxc_ctx_free(ctx, code);
+    return NULL;
+  }
+  method->code_body = code;
+  method->code_off = 0;
+  method->code_source = NULL;
+  return code;
+}
+
+DexCompactCode* dxc_method_compact_code(DexMethod* method) {
+  if(method->compact_code || method->code_body || !method->code_off) {
+    return method->compact_code;
+  }
+  read_context* ctx = method->code_source;
+  DexCompactCode* code =
+      (DexCompactCode*)dxc_ctx_calloc(ctx, 1, sizeof(DexCompactCode));
+  if(!code) {
+    DXC_ERROR("failed to alloc compact code");
+    return NULL;
+  }
+  if(!dxc_read_compact_code(ctx, code, method->code_off)) {
+    if(!ctx->arena) dxc_free_compact_code(code);
+    dxc_ctx_free(ctx, code);
+    return NULL;
+  }
+  method->compact_code = code;
+  method->code_off = 0;
+  method->code_source = NULL;
+  return code;
+}
+
 void dxc_free_method(DexMethod* method) {
   if(!method) return;
   if(method->code_body) dxc_free_code(method->code_body);
+  if(method->compact_code) {
+    dxc_free_compact_code(method->compact_code);
+    free(method->compact_code);
+  }
   if(method->annotations) {
     DexAnnotation* ptr;
     for(ptr = method->annotations;
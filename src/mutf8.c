@@ -58,5 +58,7 @@ int mutf8_compare(char* aa, char* bb) {
 }
 
 int mutf8_ref_compare(ref_str* a, ref_str* b) {
+  /* Interned and borrowed strings are usually shared outright. */
+  if(a == b) return 0;
   return mutf8_compare(a->s, b->s);
 }
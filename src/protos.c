@@ -20,14 +20,44 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdio.h>
 #include <string.h>
 
+#include <dxcut/intern.h>
+
+#include "read.h"
+
+/* Fills s[0] with the return type and s[1..arguments] with the parameter
+ * types of a proto. */
+static
+int read_proto_types(read_context* ctx, ref_str** s, dx_uint return_type,
+                     dx_uint parameters_off, dx_uint arguments) {
+  s[0] = dxc_copy_str(ctx->types[return_type]);
+
+  dx_uint j;
+  for(j = 1; j <= arguments; j++) {
+    if(!dxc_read_ok(ctx, parameters_off, 2)) {
+      DXC_ERROR("proto references outside data section");
+      return 0;
+    }
+    dx_ushort type_idx = dxc_read_ushort(ctx, &parameters_off);
+    if(type_idx >= ctx->types_sz) {
+      DXC_ERROR("proto type offset too large");
+      continue;
+    }
+    s[j] = dxc_copy_str(ctx->types[type_idx]);
+  }
+  return 1;
+}
+
+/* A method takes at most 255 registers of arguments. */
+#define MAX_PARAMETERS 255
+
 int dxc_read_proto_section(read_context* ctx, dx_uint off, dx_uint size) {
-  ctx->protos = (ref_strstr**)calloc(size, sizeof(ref_strstr*));
+  ctx->protos = (ref_strstr**)dxc_ctx_calloc(ctx, size, sizeof(ref_strstr*));
   ctx->protos_sz = size;
   dx_uint i;
   for(i = 0; i < size; i++) {
-    dx_uint shorty_index = ctx->read_uint(ctx, &off);
-    dx_uint return_type = ctx->read_uint(ctx, &off);
-    dx_uint parameters_off = ctx->read_uint(ctx, &off);
+    dx_uint shorty_index = dxc_read_uint(ctx, &off);
+    dx_uint return_type = dxc_read_uint(ctx, &off);
+    dx_uint parameters_off = dxc_read_uint(ctx, &off);
     if(return_type >= ctx->types_sz)  {
       DXC_ERROR("proto type offset too large");
       return 0;
@@ -37,32 +67,41 @@ int dxc_read_proto_section(read_context* ctx, dx_uint off, dx_uint size) {
       DXC_ERROR("proto type list outside of data section");
       return 0;
     } else if(parameters_off != 0) {
-      arguments = ctx->read_uint(ctx, &parameters_off);
+      arguments = dxc_read_uint(ctx, &parameters_off);
       if(arguments + 1 == 0) {
         DXC_ERROR("prototype has too many arguments");
         return 0;
       }
     }
 
+    if(ctx->intern) {
+      /* Only canonical protos from the pool are ever stored in the table. */
+      ref_str* scratch[MAX_PARAMETERS + 2];
+      if(arguments > MAX_PARAMETERS) {
+        DXC_ERROR("prototype has too many arguments");
+        return 0;
+      }
+      memset(scratch, 0, (arguments + 2) * sizeof(ref_str*));
+      if(!read_proto_types(ctx, scratch, return_type, parameters_off,
+                           arguments) ||
+         !(ctx->protos[i] = dxc_intern_strstr(ctx->intern, scratch))) {
+        return 0;
+      }
+      continue;
+    }
+
     ref_strstr* proto;
-    if(!(ctx->protos[i] = proto = dxc_create_strstr(arguments + 1))) {
+    if(!(ctx->protos[i] = proto =
+         dxc_ctx_create_strstr(ctx, arguments + 1))) {
       DXC_ERROR("proto alloc failed");
       return 0;
     }
-    proto->s[0] = dxc_copy_str(ctx->types[return_type]);
-
-    dx_uint j;
-    for(j = 1; j <= arguments; j++) {
-      if(!dxc_read_ok(ctx, parameters_off, 2)) {
-        DXC_ERROR("proto references outside data section");
-        return 0;
-      }
-      dx_ushort type_idx = ctx->read_ushort(ctx, &parameters_off);
-      if(type_idx >= ctx->types_sz) {
-        DXC_ERROR("proto type offset too large");
-        continue;
-      }
-      proto->s[j] = dxc_copy_str(ctx->types[type_idx]);
+    if(!read_proto_types(ctx, proto->s, return_type, parameters_off,
+                         arguments)) {
+      return 0;
+    }
+    if(ctx->immortal_ids) {
+      dxc_make_immortal_strstr(proto);
     }
   }
   return 1;
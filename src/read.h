@@ -19,12 +19,85 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <dxcut/dex.h>
 
+#include <string.h>
+
 #include "common.h"
 
+/* Primitive decoders for the little-endian dex format.  The fixed width reads
+ * do no bounds checking; callers validate the extent of an item once with
+ * dxc_read_ok() before reading its fields.  The leb128 reads stop at the end
+ * of the data section, leaving *pos past it on a truncated value so that the
+ * next dxc_in_data() check fails. */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define DXC_LE16(x) __builtin_bswap16(x)
+#define DXC_LE32(x) __builtin_bswap32(x)
+#define DXC_LE64(x) __builtin_bswap64(x)
+#else
+#define DXC_LE16(x) (x)
+#define DXC_LE32(x) (x)
+#define DXC_LE64(x) (x)
+#endif
+
+#define DXC_DEFINE_READ(type, swap) \
+  static inline \
+  dx_ ## type dxc_read_ ## type(read_context* ctx, dx_uint* pos) { \
+    dx_ ## type res; \
+    memcpy(&res, ctx->buf + *pos, sizeof(res)); \
+    *pos += sizeof(res); \
+    return (dx_ ## type)swap(res); \
+  }
+
+DXC_DEFINE_READ(ulong, DXC_LE64)
+DXC_DEFINE_READ(long, DXC_LE64)
+DXC_DEFINE_READ(uint, DXC_LE32)
+DXC_DEFINE_READ(int, DXC_LE32)
+DXC_DEFINE_READ(ushort, DXC_LE16)
+DXC_DEFINE_READ(short, DXC_LE16)
+DXC_DEFINE_READ(ubyte, )
+DXC_DEFINE_READ(byte, )
+
+#undef DXC_DEFINE_READ
+
 extern
-void fill_read_functions(read_context* ctx);
+dx_uint dxc_read_uleb_slow(read_context* ctx, dx_uint* pos);
 
 extern
-void fill_inverse_read_functions(read_context* ctx);
+dx_int dxc_read_sleb_slow(read_context* ctx, dx_uint* pos);
+
+/* Nearly all ulebs in practice are one or two bytes; decode those inline when
+ * two bytes are known to be available and leave the rest to the slow path. */
+static inline
+dx_uint dxc_read_uleb(read_context* ctx, dx_uint* pos) {
+  if(ctx->data_end && *pos < ctx->data_end - 1) {
+    const dx_ubyte* p = (const dx_ubyte*)ctx->buf + *pos;
+    if(p[0] < 0x80) {
+      *pos += 1;
+      return p[0];
+    }
+    if(p[1] < 0x80) {
+      *pos += 2;
+      return (p[0] & 0x7F) | (dx_uint)p[1] << 7;
+    }
+  }
+  return dxc_read_uleb_slow(ctx, pos);
+}
+
+static inline
+dx_uint dxc_read_ulebp1(read_context* ctx, dx_uint* pos) {
+  return dxc_read_uleb(ctx, pos) - 1;
+}
+
+static inline
+dx_int dxc_read_sleb(read_context* ctx, dx_uint* pos) {
+  if(*pos < ctx->data_end) {
+    dx_ubyte b = (dx_ubyte)ctx->buf[*pos];
+    if(b < 0x80) {
+      *pos += 1;
+      return (dx_int)(b & 0x40 ? b | ~0x7FU : b);
+    }
+  }
+  return dxc_read_sleb_slow(ctx, pos);
+}
 
 #endif // DEX_READ_H
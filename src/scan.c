@@ -0,0 +1,292 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mutf8.h"
+#include "read.h"
+#include "swap.h"
+
+/* The largest number of parameters a method can take. */
+#define MAX_PARAMETERS 255
+
+static
+int in_file(const DexIdScan* scan, dx_uint off, dx_uint count,
+            dx_uint width) {
+  return count <= scan->size / width && off <= scan->size &&
+         count * width <= scan->size - off;
+}
+
+int dxc_init_id_scan(DexIdScan* scan, const void* buf, dx_uint size) {
+  memset(scan, 0, sizeof(*scan));
+  read_context* rd = &scan->rd;
+  rd->buf = (char*)buf;
+  if(dxc_is_big_endian_image(rd->buf, size)) {
+    DXC_ERROR("big-endian dex files cannot be scanned");
+    return 0;
+  }
+
+  dx_uint pos = 8;
+  if(size >= 0x28 && !memcmp(rd->buf, "dey\n", 4)) {
+    /* Only the embedded dex file matters for an odex file. */
+    dx_uint dex_off = dxc_read_uint(rd, &pos);
+    dx_uint dex_len = dxc_read_uint(rd, &pos);
+    if(dex_off > size || dex_len > size - dex_off) {
+      DXC_ERROR("dex file leaves file boundary");
+      return 0;
+    }
+    rd->buf += dex_off;
+    size = dex_len;
+  }
+  scan->size = size;
+  if(size < 0x70 || memcmp(rd->buf, "dex\n", 4)) {
+    DXC_ERROR("not a dex file");
+    return 0;
+  }
+
+  pos = 0x38;
+  scan->strs_sz = dxc_read_uint(rd, &pos);
+  scan->strs_off = dxc_read_uint(rd, &pos);
+  scan->types_sz = dxc_read_uint(rd, &pos);
+  scan->types_off = dxc_read_uint(rd, &pos);
+  scan->protos_sz = dxc_read_uint(rd, &pos);
+  scan->protos_off = dxc_read_uint(rd, &pos);
+  scan->fields_sz = dxc_read_uint(rd, &pos);
+  scan->fields_off = dxc_read_uint(rd, &pos);
+  scan->methods_sz = dxc_read_uint(rd, &pos);
+  scan->methods_off = dxc_read_uint(rd, &pos);
+  scan->classes_sz = dxc_read_uint(rd, &pos);
+  scan->classes_off = dxc_read_uint(rd, &pos);
+  rd->data_sz = dxc_read_uint(rd, &pos);
+  rd->data_off = dxc_read_uint(rd, &pos);
+  rd->data_end = rd->data_off + rd->data_sz;
+  if(!in_file(scan, rd->data_off, rd->data_sz, 1) ||
+     !in_file(scan, scan->strs_off, scan->strs_sz, 4) ||
+     !in_file(scan, scan->types_off, scan->types_sz, 4) ||
+     !in_file(scan, scan->protos_off, scan->protos_sz, 12) ||
+     !in_file(scan, scan->fields_off, scan->fields_sz, 8) ||
+     !in_file(scan, scan->methods_off, scan->methods_sz, 8) ||
+     !in_file(scan, scan->classes_off, scan->classes_sz, 32)) {
+    DXC_ERROR("id table leaves file boundary");
+    return 0;
+  }
+  return 1;
+}
+
+DexIdScan* dxc_scan_ids(const void* buf, dx_uint size) {
+  DexIdScan* scan = (DexIdScan*)malloc(sizeof(DexIdScan));
+  if(!scan) {
+    DXC_ERROR("failed to alloc id scan");
+    return NULL;
+  }
+  if(!dxc_init_id_scan(scan, buf, size)) {
+    free(scan);
+    return NULL;
+  }
+  return scan;
+}
+
+void dxc_free_scan(DexIdScan* scan) {
+  free(scan);
+}
+
+/* The tables are only ever read through the scan; the casts drop the const
+ * the decoders do not declare. */
+static
+dx_uint table_uint(const DexIdScan* scan, dx_uint off) {
+  return dxc_read_uint((read_context*)&scan->rd, &off);
+}
+
+static
+dx_ushort table_ushort(const DexIdScan* scan, dx_uint off) {
+  return dxc_read_ushort((read_context*)&scan->rd, &off);
+}
+
+const char* dxc_scan_string(const DexIdScan* scan, dx_uint idx) {
+  if(idx >= scan->strs_sz) {
+    DXC_ERROR("string index out of range");
+    return NULL;
+  }
+  read_context* rd = (read_context*)&scan->rd;
+  dx_uint off = table_uint(scan, scan->strs_off + 4 * idx);
+  if(!dxc_in_data(rd, off)) {
+    DXC_ERROR("string data outside of data section");
+    return NULL;
+  }
+  dxc_read_uleb(rd, &off);
+  if(off >= rd->data_end ||
+     !memchr(rd->buf + off, 0, rd->data_end - off)) {
+    DXC_ERROR("unterminated string data");
+    return NULL;
+  }
+  return rd->buf + off;
+}
+
+const char* dxc_scan_type(const DexIdScan* scan, dx_uint idx) {
+  if(idx >= scan->types_sz) {
+    DXC_ERROR("type index out of range");
+    return NULL;
+  }
+  return dxc_scan_string(scan, table_uint(scan, scan->types_off + 4 * idx));
+}
+
+dx_int dxc_scan_find_string(const DexIdScan* scan, const char* s) {
+  dx_uint lo = 0;
+  dx_uint hi = scan->strs_sz;
+  while(lo < hi) {
+    dx_uint mid = lo + (hi - lo) / 2;
+    const char* cand = dxc_scan_string(scan, mid);
+    if(!cand) return -1;
+    int res = mutf8_compare((char*)s, (char*)cand);
+    if(res == 0) return mid;
+    if(res < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return -1;
+}
+
+dx_int dxc_scan_find_type(const DexIdScan* scan, const char* descriptor) {
+  dx_int str = dxc_scan_find_string(scan, descriptor);
+  if(str < 0) return -1;
+  /* type_ids are sorted by string index. */
+  dx_uint lo = 0;
+  dx_uint hi = scan->types_sz;
+  while(lo < hi) {
+    dx_uint mid = lo + (hi - lo) / 2;
+    dx_uint cand = table_uint(scan, scan->types_off + 4 * mid);
+    if(cand == (dx_uint)str) return mid;
+    if((dx_uint)str < cand) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return -1;
+}
+
+static
+int compare_uint(dx_uint a, dx_uint b) {
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/* Compares a proto given by type indices against proto_ids[idx] in the order
+ * the proto_ids table is sorted in: return type, then the parameter lists
+ * with a shorter list sorting first among equal prefixes. */
+static
+int compare_proto(const DexIdScan* scan, dx_uint ret, const dx_uint* params,
+                  dx_uint params_sz, dx_uint idx, int* ok) {
+  dx_uint off = scan->protos_off + 12 * idx;
+  int res = compare_uint(ret, table_uint(scan, off + 4));
+  if(res) return res;
+  dx_uint list_off = table_uint(scan, off + 8);
+  dx_uint list_sz = 0;
+  if(list_off) {
+    if(!dxc_read_ok((read_context*)&scan->rd, list_off, 4) ||
+       (list_sz = table_uint(scan, list_off)) > scan->rd.data_sz / 2 ||
+       !dxc_read_ok((read_context*)&scan->rd, list_off + 4, list_sz * 2)) {
+      DXC_ERROR("parameter list outside of data section");
+      *ok = 0;
+      return 0;
+    }
+  }
+  dx_uint i;
+  for(i = 0; i < params_sz && i < list_sz; i++) {
+    res = compare_uint(params[i], table_ushort(scan, list_off + 4 + 2 * i));
+    if(res) return res;
+  }
+  return compare_uint(params_sz, list_sz);
+}
+
+static
+dx_int find_proto(const DexIdScan* scan, const char* const* prototype) {
+  if(!prototype[0]) return -1;
+  dx_int ret = dxc_scan_find_type(scan, prototype[0]);
+  if(ret < 0) return -1;
+  dx_uint params[MAX_PARAMETERS];
+  dx_uint params_sz;
+  for(params_sz = 0; prototype[params_sz + 1]; params_sz++) {
+    if(params_sz == MAX_PARAMETERS) return -1;
+    dx_int type = dxc_scan_find_type(scan, prototype[params_sz + 1]);
+    if(type < 0) return -1;
+    params[params_sz] = type;
+  }
+
+  dx_uint lo = 0;
+  dx_uint hi = scan->protos_sz;
+  while(lo < hi) {
+    dx_uint mid = lo + (hi - lo) / 2;
+    int ok = 1;
+    int res = compare_proto(scan, ret, params, params_sz, mid, &ok);
+    if(!ok) return -1;
+    if(res == 0) return mid;
+    if(res < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return -1;
+}
+
+/* field_ids and method_ids share a layout: a 16-bit class index, a 16-bit
+ * type or proto index and a 32-bit name index, sorted by class, then name,
+ * then the middle index. */
+static
+dx_int find_member(const DexIdScan* scan, dx_uint table_off, dx_uint table_sz,
+                   dx_uint class_idx, dx_uint name_idx, dx_uint other_idx) {
+  dx_uint lo = 0;
+  dx_uint hi = table_sz;
+  while(lo < hi) {
+    dx_uint mid = lo + (hi - lo) / 2;
+    dx_uint off = table_off + 8 * mid;
+    int res = compare_uint(class_idx, table_ushort(scan, off));
+    if(!res) res = compare_uint(name_idx, table_uint(scan, off + 4));
+    if(!res) res = compare_uint(other_idx, table_ushort(scan, off + 2));
+    if(res == 0) return mid;
+    if(res < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return -1;
+}
+
+dx_int dxc_scan_find_field(const DexIdScan* scan, const char* defining_class,
+                           const char* name, const char* type) {
+  dx_int class_idx = dxc_scan_find_type(scan, defining_class);
+  dx_int name_idx = class_idx < 0 ? -1 : dxc_scan_find_string(scan, name);
+  dx_int type_idx = name_idx < 0 ? -1 : dxc_scan_find_type(scan, type);
+  if(type_idx < 0) return -1;
+  return find_member(scan, scan->fields_off, scan->fields_sz,
+                     class_idx, name_idx, type_idx);
+}
+
+dx_int dxc_scan_find_method(const DexIdScan* scan, const char* defining_class,
+                            const char* name, const char* const* prototype) {
+  dx_int class_idx = dxc_scan_find_type(scan, defining_class);
+  dx_int name_idx = class_idx < 0 ? -1 : dxc_scan_find_string(scan, name);
+  dx_int proto_idx = name_idx < 0 ? -1 : find_proto(scan, prototype);
+  if(proto_idx < 0) return -1;
+  return find_member(scan, scan->methods_off, scan->methods_sz,
+                     class_idx, name_idx, proto_idx);
+}
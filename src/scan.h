@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef DEX_SCAN_H
+#define DEX_SCAN_H
+
+#include <dxcut/scan.h>
+
+#include "common.h"
+
+struct dex_id_scan_t {
+  /* Only buf and the data section bounds are used, so that the primitive
+   * decoders and range checks of the reader apply. */
+  read_context rd;
+  dx_uint size;
+
+  dx_uint strs_off;
+  dx_uint strs_sz;
+  dx_uint types_off;
+  dx_uint types_sz;
+  dx_uint protos_off;
+  dx_uint protos_sz;
+  dx_uint fields_off;
+  dx_uint fields_sz;
+  dx_uint methods_off;
+  dx_uint methods_sz;
+  dx_uint classes_off;
+  dx_uint classes_sz;
+};
+
+/* Fills in scan for the little-endian dex file in buf after checking that
+ * every id table lies within it.  Returns 0 if the file is malformed. */
+extern
+int dxc_init_id_scan(DexIdScan* scan, const void* buf, dx_uint size);
+
+#endif // DEX_SCAN_H
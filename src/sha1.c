@@ -0,0 +1,267 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "file.h"
+
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define ROL(x, n) ((x) << (n) | (x) >> (32 - (n)))
+
+static
+dx_uint read_be32(const dx_ubyte* p) {
+  return (dx_uint)p[0] << 24 | (dx_uint)p[1] << 16 |
+         (dx_uint)p[2] << 8 | p[3];
+}
+
+/* The message schedule is kept as a rolling window of 16 words and the five
+ * working variables rotate through the macro arguments instead of being
+ * shuffled after every round. */
+#define SHA1_W(i) (w[(i) & 15] = ROL(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ \
+                                     w[((i) + 2) & 15] ^ w[(i) & 15], 1))
+#define SHA1_R0(a, b, c, d, e, i) \
+  e += ((b & (c ^ d)) ^ d) + w[i] + 0x5A827999 + ROL(a, 5); b = ROL(b, 30);
+#define SHA1_R1(a, b, c, d, e, i) \
+  e += ((b & (c ^ d)) ^ d) + SHA1_W(i) + 0x5A827999 + ROL(a, 5); \
+  b = ROL(b, 30);
+#define SHA1_R2(a, b, c, d, e, i) \
+  e += (b ^ c ^ d) + SHA1_W(i) + 0x6ED9EBA1 + ROL(a, 5); b = ROL(b, 30);
+#define SHA1_R3(a, b, c, d, e, i) \
+  e += (((b | c) & d) | (b & c)) + SHA1_W(i) + 0x8F1BBCDC + ROL(a, 5); \
+  b = ROL(b, 30);
+#define SHA1_R4(a, b, c, d, e, i) \
+  e += (b ^ c ^ d) + SHA1_W(i) + 0xCA62C1D6 + ROL(a, 5); b = ROL(b, 30);
+#define SHA1_FIVE(R, i) \
+  R(a, b, c, d, e, (i)); R(e, a, b, c, d, (i) + 1); \
+  R(d, e, a, b, c, (i) + 2); R(c, d, e, a, b, (i) + 3); \
+  R(b, c, d, e, a, (i) + 4);
+
+static
+void sha1_blocks_portable(dx_uint* h, const dx_ubyte* data, size_t blocks) {
+  for(; blocks; blocks--, data += 64) {
+    dx_uint w[16];
+    int i;
+    for(i = 0; i < 16; i++) {
+      w[i] = read_be32(data + 4 * i);
+    }
+    dx_uint a = h[0];
+    dx_uint b = h[1];
+    dx_uint c = h[2];
+    dx_uint d = h[3];
+    dx_uint e = h[4];
+    SHA1_FIVE(SHA1_R0, 0) SHA1_FIVE(SHA1_R0, 5) SHA1_FIVE(SHA1_R0, 10)
+    SHA1_R0(a, b, c, d, e, 15) SHA1_R1(e, a, b, c, d, 16)
+    SHA1_R1(d, e, a, b, c, 17) SHA1_R1(c, d, e, a, b, 18)
+    SHA1_R1(b, c, d, e, a, 19)
+    for(i = 20; i < 40; i += 5) {
+      SHA1_FIVE(SHA1_R2, i)
+    }
+    for(i = 40; i < 60; i += 5) {
+      SHA1_FIVE(SHA1_R3, i)
+    }
+    for(i = 60; i < 80; i += 5) {
+      SHA1_FIVE(SHA1_R4, i)
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Four rounds using the SHA extensions. e_cur holds E plus the schedule words
+ * for these rounds once sha1nexte has run, and e_next saves the state needed to
+ * derive E for the following four rounds. Alongside, the schedule for later
+ * rounds is advanced with sha1msg1/sha1msg2. */
+#define SHANI_ROUNDS(e_cur, e_next, m_cur, m_next, m_xor, m_msg1, f) \
+  e_cur = _mm_sha1nexte_epu32(e_cur, m_cur); \
+  e_next = abcd; \
+  m_next = _mm_sha1msg2_epu32(m_next, m_cur); \
+  abcd = _mm_sha1rnds4_epu32(abcd, e_cur, f); \
+  m_msg1 = _mm_sha1msg1_epu32(m_msg1, m_cur); \
+  m_xor = _mm_xor_si128(m_xor, m_cur);
+
+__attribute__((target("sha,sse4.1")))
+static
+void sha1_blocks_shani(dx_uint* h, const dx_ubyte* data, size_t blocks) {
+  const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+                                      0x08090a0b0c0d0e0fULL);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)h), 0x1B);
+  __m128i e0 = _mm_set_epi32(h[4], 0, 0, 0);
+  __m128i e1;
+  __m128i m0, m1, m2, m3;
+
+  for(; blocks; blocks--, data += 64) {
+    __m128i abcd_save = abcd;
+    __m128i e0_save = e0;
+
+    /* Rounds 0-15 bring in the message words as they are loaded. */
+    m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), mask);
+    e0 = _mm_add_epi32(e0, m0);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+    m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+    e1 = _mm_sha1nexte_epu32(e1, m1);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+    m0 = _mm_sha1msg1_epu32(m0, m1);
+
+    m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+    e0 = _mm_sha1nexte_epu32(e0, m2);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    m1 = _mm_sha1msg1_epu32(m1, m2);
+    m0 = _mm_xor_si128(m0, m2);
+
+    m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+    SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 0)
+
+    /* Rounds 16-63. */
+    SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 0)
+    SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1)
+    SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 1)
+    SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 1)
+    SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 1)
+    SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1)
+    SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2)
+    SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 2)
+    SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 2)
+    SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 2)
+    SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2)
+    SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 3)
+
+    /* Rounds 64-79 finish off the schedule. */
+    e0 = _mm_sha1nexte_epu32(e0, m0);
+    e1 = abcd;
+    m1 = _mm_sha1msg2_epu32(m1, m0);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+    m3 = _mm_sha1msg1_epu32(m3, m0);
+    m2 = _mm_xor_si128(m2, m0);
+
+    e1 = _mm_sha1nexte_epu32(e1, m1);
+    e0 = abcd;
+    m2 = _mm_sha1msg2_epu32(m2, m1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+    m3 = _mm_xor_si128(m3, m1);
+
+    e0 = _mm_sha1nexte_epu32(e0, m2);
+    e1 = abcd;
+    m3 = _mm_sha1msg2_epu32(m3, m2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+    e1 = _mm_sha1nexte_epu32(e1, m3);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+    e0 = _mm_sha1nexte_epu32(e0, e0_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+
+  _mm_storeu_si128((__m128i*)h, _mm_shuffle_epi32(abcd, 0x1B));
+  h[4] = _mm_extract_epi32(e0, 3);
+}
+
+#endif
+
+typedef void (*sha1_blocks_func)(dx_uint* h, const dx_ubyte* data,
+                                 size_t blocks);
+
+static
+sha1_blocks_func select_sha1(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+     (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+     __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA)) {
+    return sha1_blocks_shani;
+  }
+#endif
+  return sha1_blocks_portable;
+}
+
+static
+void sha1_blocks(dx_uint* h, const dx_ubyte* data, size_t blocks) {
+  static sha1_blocks_func func = NULL;
+  sha1_blocks_func f = __atomic_load_n(&func, __ATOMIC_RELAXED);
+  if(!f) {
+    f = select_sha1();
+    __atomic_store_n(&func, f, __ATOMIC_RELAXED);
+  }
+  f(h, data, blocks);
+}
+
+void dxc_sha1_init(dxc_sha1_ctx* sha) {
+  sha->h[0] = 0x67452301;
+  sha->h[1] = 0xEFCDAB89;
+  sha->h[2] = 0x98BADCFE;
+  sha->h[3] = 0x10325476;
+  sha->h[4] = 0xC3D2E1F0;
+  sha->len = 0;
+}
+
+void dxc_sha1_update(dxc_sha1_ctx* sha, const void* vbuf, size_t size) {
+  const dx_ubyte* buf = (const dx_ubyte*)vbuf;
+  size_t used = sha->len & 63;
+  sha->len += size;
+  if(used) {
+    size_t n = 64 - used < size ? 64 - used : size;
+    memcpy(sha->buf + used, buf, n);
+    buf += n;
+    size -= n;
+    if(used + n < 64) return;
+    sha1_blocks(sha->h, sha->buf, 1);
+  }
+  if(size >= 64) {
+    sha1_blocks(sha->h, buf, size / 64);
+    buf += size & ~(size_t)63;
+    size &= 63;
+  }
+  memcpy(sha->buf, buf, size);
+}
+
+void dxc_sha1_final(dxc_sha1_ctx* sha, dx_ubyte* digest) {
+  dx_ulong bits = sha->len * 8;
+  size_t used = sha->len & 63;
+  sha->buf[used++] = 0x80;
+  if(used > 56) {
+    memset(sha->buf + used, 0, 64 - used);
+    sha1_blocks(sha->h, sha->buf, 1);
+    used = 0;
+  }
+  memset(sha->buf + used, 0, 56 - used);
+  int i;
+  for(i = 0; i < 8; i++) {
+    sha->buf[56 + i] = bits >> (56 - 8 * i) & 0xFF;
+  }
+  sha1_blocks(sha->h, sha->buf, 1);
+  for(i = 0; i < 20; i++) {
+    digest[i] = sha->h[i / 4] >> (24 - 8 * (i % 4)) & 0xFF;
+  }
+}
+
+void dxc_sha1(const void* buf, size_t size, dx_ubyte* digest) {
+  dxc_sha1_ctx sha;
+  dxc_sha1_init(&sha);
+  dxc_sha1_update(&sha, buf, size);
+  dxc_sha1_final(&sha, digest);
+}
@@ -18,28 +18,60 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+#include <dxcut/intern.h>
+
+#include "read.h"
 
 static
-ref_str* read_string_data(read_context* ctx, dx_uint off) {
-  dx_uint len = ctx->read_uleb(ctx, &off);
-  dx_uint orig_off = off;
-  dx_uint sz = 0;
-  while(dxc_in_data(ctx, off) && ctx->read_ubyte(ctx, &off)) sz++;
-  if(!dxc_in_data(ctx, off)) {
+const char* read_string_data(read_context* ctx, dx_uint off) {
+  dx_uint end = ctx->data_end;
+  if(!dxc_in_data(ctx, off) || off == end) {
     DXC_ERROR("string data item not in data section");
     return NULL;
   }
-  dx_uint i;
-  return dxc_induct_str(ctx->buf + orig_off);
+  /* Skip the utf16 length; the characters run up to the terminating NUL. */
+  while(off < end && (ctx->buf[off++] & 0x80));
+  const char* s = ctx->buf + off;
+  if(off == end || !memchr(s, 0, end - off)) {
+    DXC_ERROR("string data item not in data section");
+    return NULL;
+  }
+  return s;
 }
 
 int dxc_read_string_section(read_context* ctx, dx_uint pos, dx_uint size) {
-  ctx->strs = (ref_str**)calloc(size, sizeof(ref_str*));
+  ctx->strs = (ref_str**)dxc_ctx_calloc(ctx, size, sizeof(ref_str*));
+  if(!ctx->strs) {
+    DXC_ERROR("failed to alloc string table");
+    return 0;
+  }
+  /* Arena reads of a buffer the caller keeps copy the characters into the
+   * arena instead. */
+  if(ctx->immortal_ids && size && !ctx->intern &&
+     (!ctx->arena || ctx->map_base || ctx->swap_buf)) {
+    ctx->str_block = (ref_str*)calloc(size, sizeof(ref_str));
+    if(!ctx->str_block) {
+      DXC_ERROR("failed to alloc string table");
+      return 0;
+    }
+  }
   ctx->strs_sz = size;
   dx_uint i;
   for(i = 0; i < size; i++) {
-    dx_uint string_data_off = ctx->read_uint(ctx, &pos);
-    if(!(ctx->strs[i] = read_string_data(ctx, string_data_off))) {
+    dx_uint string_data_off = dxc_read_uint(ctx, &pos);
+    const char* s = read_string_data(ctx, string_data_off);
+    if(!s) {
+      return 0;
+    } else if(ctx->intern) {
+      if(!(ctx->strs[i] = dxc_intern_str(ctx->intern, s))) return 0;
+    } else if(ctx->str_block) {
+      ctx->strs[i] = ctx->str_block + i;
+      ctx->strs[i]->s = (char*)s;
+      dxc_fill_str_info(ctx->strs[i]);
+      ctx->strs[i]->cnt = DXC_REF_IMMORTAL;
+    } else if(!(ctx->strs[i] = dxc_ctx_induct_str(ctx, s))) {
       return 0;
     }
   }
@@ -0,0 +1,370 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "swap.h"
+
+#include <string.h>
+
+#include "aux.h"
+#include "common.h"
+
+typedef struct {
+  dx_ubyte* buf;
+  dx_uint size;
+  int from_big;
+} swapper;
+
+/* Every field is read in the byte order the image is currently in before it
+ * gets swapped, so the same walk converts in either direction. */
+
+static
+dx_ushort load16(const swapper* s, dx_uint off) {
+  const dx_ubyte* p = s->buf + off;
+  return s->from_big ? (dx_ushort)(p[0] << 8 | p[1]) :
+                       (dx_ushort)(p[1] << 8 | p[0]);
+}
+
+static
+dx_uint load32(const swapper* s, dx_uint off) {
+  const dx_ubyte* p = s->buf + off;
+  return s->from_big ?
+      (dx_uint)p[0] << 24 | (dx_uint)p[1] << 16 | (dx_uint)p[2] << 8 | p[3] :
+      (dx_uint)p[3] << 24 | (dx_uint)p[2] << 16 | (dx_uint)p[1] << 8 | p[0];
+}
+
+static
+int in_image(const swapper* s, dx_uint off, dx_uint width) {
+  return off <= s->size && width <= s->size - off;
+}
+
+/* The bulk conversions below are plain bswap loops which the compiler turns
+ * into vector shuffles. */
+static
+void swap16_array(dx_ubyte* p, dx_uint count) {
+  dx_uint i;
+  for(i = 0; i < count; i++, p += 2) {
+    dx_ushort v;
+    memcpy(&v, p, 2);
+    v = __builtin_bswap16(v);
+    memcpy(p, &v, 2);
+  }
+}
+
+static
+void swap32_array(dx_ubyte* p, dx_uint count) {
+  dx_uint i;
+  for(i = 0; i < count; i++, p += 4) {
+    dx_uint v;
+    memcpy(&v, p, 4);
+    v = __builtin_bswap32(v);
+    memcpy(p, &v, 4);
+  }
+}
+
+static
+dx_ushort swap16(swapper* s, dx_uint* off) {
+  dx_ushort v = load16(s, *off);
+  swap16_array(s->buf + *off, 1);
+  *off += 2;
+  return v;
+}
+
+static
+dx_uint swap32(swapper* s, dx_uint* off) {
+  dx_uint v = load32(s, *off);
+  swap32_array(s->buf + *off, 1);
+  *off += 4;
+  return v;
+}
+
+static
+int skip_uleb(const swapper* s, dx_uint* off, dx_uint* res) {
+  dx_uint v = 0;
+  dx_uint i;
+  for(i = 0; *off < s->size; i++) {
+    dx_ubyte b = s->buf[(*off)++];
+    if(i < 5) v |= (dx_uint)(b & 0x7F) << (i * 7);
+    if(~b & 0x80) {
+      if(res) *res = v;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static
+int skip_sleb(const swapper* s, dx_uint* off, dx_int* res) {
+  dx_uint v = 0;
+  dx_uint i;
+  for(i = 0; *off < s->size; i++) {
+    dx_ubyte b = s->buf[(*off)++];
+    if(i < 5) v |= (dx_uint)(b & 0x7F) << (i * 7);
+    if(~b & 0x80) {
+      if(b & 0x40 && i < 4) v |= ~0U << (7 * i + 7);
+      *res = (dx_int)v;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static
+int swap_code_item(swapper* s, dx_uint* off) {
+  if(!in_image(s, *off, 16)) return 0;
+  swap16(s, off);
+  swap16(s, off);
+  swap16(s, off);
+  dx_uint tries_size = swap16(s, off);
+  swap32(s, off);
+  dx_uint insns_size = swap32(s, off);
+  if(insns_size > s->size / 2 || !in_image(s, *off, insns_size * 2)) return 0;
+  swap16_array(s->buf + *off, insns_size);
+  *off += insns_size * 2;
+  if(!tries_size) return 1;
+
+  if(insns_size & 1) {
+    if(!in_image(s, *off, 2)) return 0;
+    swap16(s, off);
+  }
+  if(!in_image(s, *off, tries_size * 8)) return 0;
+  dx_uint i;
+  for(i = 0; i < tries_size; i++) {
+    swap32(s, off);
+    swap16(s, off);
+    swap16(s, off);
+  }
+
+  /* The handlers are all leb128 encoded; walk them to find the item's end. */
+  dx_uint handlers;
+  if(!skip_uleb(s, off, &handlers)) return 0;
+  for(i = 0; i < handlers; i++) {
+    dx_int size;
+    if(!skip_sleb(s, off, &size)) return 0;
+    dx_uint pairs = size < 0 ? (dx_uint)-size : (dx_uint)size;
+    dx_uint j;
+    for(j = 0; j < 2 * pairs; j++) {
+      if(!skip_uleb(s, off, NULL)) return 0;
+    }
+    if(size <= 0 && !skip_uleb(s, off, NULL)) return 0;
+  }
+  return 1;
+}
+
+static
+int swap_map_item(swapper* s, dx_uint type, dx_uint count, dx_uint off) {
+  dx_uint i;
+  switch(type) {
+    case 0x0001: /* string_id_item */
+    case 0x0002: /* type_id_item */
+    case 0x0003: /* proto_id_item */
+    case 0x0006: /* class_def_item */ {
+      dx_uint words = type == 0x0003 ? 3 : type == 0x0006 ? 8 : 1;
+      if(count > s->size / 4 / words ||
+         !in_image(s, off, count * words * 4)) return 0;
+      swap32_array(s->buf + off, count * words);
+      return 1;
+    }
+    case 0x0004: /* field_id_item */
+    case 0x0005: /* method_id_item */
+      if(count > s->size / 8 || !in_image(s, off, count * 8)) return 0;
+      for(i = 0; i < count; i++) {
+        swap16_array(s->buf + off, 2);
+        swap32_array(s->buf + off + 4, 1);
+        off += 8;
+      }
+      return 1;
+    case 0x1001: /* type_list */
+    case 0x1002: /* annotation_set_ref_list */
+    case 0x1003: /* annotation_set_item */
+      for(i = 0; i < count; i++) {
+        off = (off + 3) & ~3U;
+        if(!in_image(s, off, 4)) return 0;
+        dx_uint sz = swap32(s, &off);
+        dx_uint width = type == 0x1001 ? 2 : 4;
+        if(sz > s->size / width || !in_image(s, off, sz * width)) return 0;
+        if(width == 2) {
+          swap16_array(s->buf + off, sz);
+        } else {
+          swap32_array(s->buf + off, sz);
+        }
+        off += sz * width;
+      }
+      return 1;
+    case 0x2001: /* code_item */
+      for(i = 0; i < count; i++) {
+        off = (off + 3) & ~3U;
+        if(!swap_code_item(s, &off)) return 0;
+      }
+      return 1;
+    case 0x2006: /* annotations_directory_item */
+      for(i = 0; i < count; i++) {
+        off = (off + 3) & ~3U;
+        if(!in_image(s, off, 16)) return 0;
+        swap32(s, &off);
+        dx_uint entries = swap32(s, &off);
+        entries += swap32(s, &off);
+        entries += swap32(s, &off);
+        if(entries > s->size / 8 || !in_image(s, off, entries * 8)) return 0;
+        swap32_array(s->buf + off, entries * 2);
+        off += entries * 8;
+      }
+      return 1;
+    default:
+      /* The header and map list are handled separately, everything else is
+       * byte oriented. */
+      return 1;
+  }
+}
+
+static
+int swap_dex(swapper* s) {
+  if(!in_image(s, 0, 0x70)) {
+    DXC_ERROR("dex header leaves image");
+    return 0;
+  }
+  dx_uint off = 8;
+  swap32(s, &off);
+  off += 20;
+  dx_uint map_off = load32(s, 0x34);
+  swap32_array(s->buf + off, (0x70 - off) / 4);
+
+  if(!in_image(s, map_off, 4)) {
+    DXC_ERROR("dex map list leaves image");
+    return 0;
+  }
+  dx_uint map_size = swap32(s, &map_off);
+  if(map_size > s->size / 12 || !in_image(s, map_off, map_size * 12)) {
+    DXC_ERROR("dex map list leaves image");
+    return 0;
+  }
+  dx_uint i;
+  for(i = 0; i < map_size; i++) {
+    dx_uint type = swap16(s, &map_off);
+    swap16(s, &map_off);
+    dx_uint count = swap32(s, &map_off);
+    dx_uint item_off = swap32(s, &map_off);
+    if(!swap_map_item(s, type, count, item_off)) {
+      DXC_ERROR("dex section leaves image");
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static
+int swap_deps(swapper* s, dx_uint off, dx_uint len) {
+  dx_uint end = off + len;
+  if(len < 16) return 0;
+  swap32_array(s->buf + off, 3);
+  off += 12;
+  dx_uint count = swap32(s, &off);
+  dx_uint i;
+  for(i = 0; i < count; i++) {
+    if(off + 4 > end) return 0;
+    dx_uint ln = swap32(s, &off);
+    if(ln > end - off || end - off - ln < 20) return 0;
+    off += ln + 20;
+  }
+  return 1;
+}
+
+static
+int swap_aux(swapper* s, dx_uint off, dx_uint len) {
+  dx_uint end = off + len;
+  if(len < 4) return 0;
+  if(!load32(s, off)) {
+    /* The old format is just a class lookup table behind a zero word. */
+    if(len < 12) return 0;
+    swap32(s, &off);
+    dx_uint size = load32(s, off);
+    if(size > end - off) return 0;
+    swap32_array(s->buf + off, size / 4);
+    return 1;
+  }
+  while(end - off >= 4) {
+    dx_uint type = swap32(s, &off);
+    if(type == AUX_END) break;
+    if(end - off < 4) return 0;
+    dx_uint size = swap32(s, &off);
+    if(size > end - off) return 0;
+    /* Class lookup tables are made of words.  The other chunks are not
+     * interpreted by dxcut and are left as they are. */
+    if(type == AUX_CLASS_LOOKUP) {
+      swap32_array(s->buf + off, size / 4);
+    }
+    size = (size + 7) & ~7U;
+    if(size > end - off) break;
+    off += size;
+  }
+  return 1;
+}
+
+static
+int is_dex_magic(const dx_ubyte* p) {
+  return !memcmp(p, "dex\n", 4);
+}
+
+int dxc_is_big_endian_image(const char* buf, dx_uint size) {
+  swapper s;
+  s.buf = (dx_ubyte*)buf;
+  s.size = size;
+  s.from_big = 1;
+  dx_uint dex_off = 0;
+  if(size >= 0x28 && !memcmp(buf, "dey\n", 4)) {
+    if(load32(&s, 8) != 0x28) return 0;
+    dex_off = 0x28;
+  }
+  return in_image(&s, dex_off, 0x70) && is_dex_magic(s.buf + dex_off) &&
+         load32(&s, dex_off + 0x28) == 0x12345678;
+}
+
+int dxc_swap_image(char* buf, dx_uint size, int from_big) {
+  swapper s;
+  s.buf = (dx_ubyte*)buf;
+  s.size = size;
+  s.from_big = from_big;
+  if(size < 0x28 || memcmp(buf, "dey\n", 4)) {
+    return swap_dex(&s);
+  }
+
+  dx_uint off = 8;
+  dx_uint dex_off = swap32(&s, &off);
+  dx_uint dex_len = swap32(&s, &off);
+  dx_uint deps_off = swap32(&s, &off);
+  dx_uint deps_len = swap32(&s, &off);
+  dx_uint aux_off = swap32(&s, &off);
+  dx_uint aux_len = swap32(&s, &off);
+  swap32_array(s.buf + off, 2);
+  if(!in_image(&s, dex_off, dex_len) ||
+     (deps_off && !in_image(&s, deps_off, deps_len)) ||
+     (aux_off && !in_image(&s, aux_off, aux_len))) {
+    DXC_ERROR("odex section leaves image");
+    return 0;
+  }
+
+  swapper dex = s;
+  dex.buf += dex_off;
+  dex.size = dex_len;
+  if(!swap_dex(&dex)) {
+    return 0;
+  }
+  if((deps_off && !swap_deps(&s, deps_off, deps_len)) ||
+     (aux_off && !swap_aux(&s, aux_off, aux_len))) {
+    DXC_ERROR("malformed odex auxiliary sections");
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,33 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef DEX_SWAP_H
+#define DEX_SWAP_H
+
+#include <dxcut/dex.h>
+
+/* Returns 1 if the dex or odex image in buf is stored big-endian. */
+extern
+int dxc_is_big_endian_image(const char* buf, dx_uint size);
+
+/* Byte swaps every multi-byte field of a dex or odex image in place, walking
+ * the map list to find them.  from_big gives the byte order the image is
+ * currently in.  Checksums are left as they were.  Returns 0 if the image is
+ * malformed. */
+extern
+int dxc_swap_image(char* buf, dx_uint size, int from_big);
+
+#endif // DEX_SWAP_H
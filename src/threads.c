@@ -0,0 +1,91 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "threads.h"
+
+#include <stdlib.h>
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+/* Number of indices a thread claims at a time. */
+#define TASK_BATCH 8
+
+typedef struct {
+  dxc_task_func func;
+  void* arg;
+  dx_uint count;
+  dx_uint batch;
+  dx_uint next;
+  int failed;
+} task_queue;
+
+static
+void* run_queue(void* vq) {
+  task_queue* q = (task_queue*)vq;
+  while(!__atomic_load_n(&q->failed, __ATOMIC_RELAXED)) {
+    dx_uint i = __atomic_fetch_add(&q->next, q->batch, __ATOMIC_RELAXED);
+    if(i >= q->count) break;
+    dx_uint end = q->count - i < q->batch ? q->count : i + q->batch;
+    for(; i < end; i++) {
+      if(!q->func(q->arg, i)) {
+        __atomic_store_n(&q->failed, 1, __ATOMIC_RELAXED);
+        break;
+      }
+    }
+  }
+  return NULL;
+}
+
+int dxc_run_tasks(dx_uint nthreads, dx_uint count,
+                  dxc_task_func func, void* arg) {
+  return dxc_run_tasks_batched(nthreads, count, TASK_BATCH, func, arg);
+}
+
+int dxc_run_tasks_batched(dx_uint nthreads, dx_uint count, dx_uint batch,
+                          dxc_task_func func, void* arg) {
+  task_queue q;
+  q.func = func;
+  q.arg = arg;
+  q.count = count;
+  q.batch = batch ? batch : 1;
+  q.next = 0;
+  q.failed = 0;
+
+#ifndef WIN32
+  if(nthreads > (count + q.batch - 1) / q.batch) {
+    nthreads = (count + q.batch - 1) / q.batch;
+  }
+  if(nthreads > 1) {
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+    if(threads) {
+      dx_uint i, started;
+      /* The calling thread works the queue too. */
+      for(started = 0; started < nthreads - 1; started++) {
+        if(pthread_create(threads + started, NULL, run_queue, &q)) break;
+      }
+      run_queue(&q);
+      for(i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+      }
+      free(threads);
+      return !q.failed;
+    }
+  }
+#endif
+  run_queue(&q);
+  return !q.failed;
+}
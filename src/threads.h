@@ -0,0 +1,39 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef DEX_THREADS_H
+#define DEX_THREADS_H
+
+#include <dxcut/dex.h>
+
+typedef int (*dxc_task_func)(void* arg, dx_uint index);
+
+/* Calls func(arg, i) for each i in [0, count) spread over up to nthreads
+ * threads, handing out indices in small batches as threads become free.
+ * Stops handing out work once any call returns 0 and then returns 0 itself.
+ * Runs everything on the calling thread when nthreads <= 1 or threads are not
+ * available. */
+extern
+int dxc_run_tasks(dx_uint nthreads, dx_uint count,
+                  dxc_task_func func, void* arg);
+
+/* Same as dxc_run_tasks but threads claim batch indices at a time.  A batch
+ * of 1 suits a few tasks of very uneven cost. */
+extern
+int dxc_run_tasks_batched(dx_uint nthreads, dx_uint count, dx_uint batch,
+                          dxc_task_func func, void* arg);
+
+#endif // DEX_THREADS_H
@@ -20,12 +20,14 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdio.h>
 #include <string.h>
 
+#include "read.h"
+
 int dxc_read_type_section(read_context* ctx, dx_uint off, dx_uint size) {
   dx_uint i;
-  ctx->types = (ref_str**)calloc(size, sizeof(ref_str*));
+  ctx->types = (ref_str**)dxc_ctx_calloc(ctx, size, sizeof(ref_str*));
   ctx->types_sz = size;
   for(i = 0; i < size; i++) {
-    dx_uint index = ctx->read_uint(ctx, &off);
+    dx_uint index = dxc_read_uint(ctx, &off);
     if(index >= ctx->strs_sz)  {
       DXC_ERROR("type id string offset too large");
       return 0;
@@ -225,7 +225,7 @@ void rename_method(DexMethod* method, RenameContext* ctx, ref_str* cl) {
   dxc_free_strstr(mtd.prototype);
 
   rename_strstr(&method->prototype, ctx);
-  DexCode* code = method->code_body;
+  DexCode* code = dxc_method_code(method);
   if(code) {
     DexDebugInfo* dbg = code->debug_information;
     if(dbg) {
@@ -286,6 +286,7 @@ void dxc_rename_identifiers(DexFile* file,
   int i, j;
   RenameContext ctx;
 
+  if(!dxc_load_all_classes(file)) return;
   ctx.num_fields = num_fields;
   ctx.num_methods = num_methods;
   ctx.num_classes = num_classes;
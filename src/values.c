@@ -25,18 +25,19 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <dxcut/value.h>
 
 #include "annotations.h"
+#include "read.h"
 
 #define MAX_ARRAY_DEPTH 256
 
 int dxc_read_value_array(read_context* ctx, DexValue** values, dx_uint* offset,
                          dx_uint depth) {
-  dx_uint sz = ctx->read_uleb(ctx, offset);
+  dx_uint sz = dxc_read_uleb(ctx, offset);
   if(!dxc_in_data(ctx, *offset)) {
     DXC_ERROR("encoded value array is outside of the data section");
     return 0;
   }
   DexValue* res;
-  *values = res = (DexValue*)calloc(sz + 1, sizeof(DexValue));
+  *values = res = (DexValue*)dxc_ctx_calloc(ctx, sz + 1, sizeof(DexValue));
   if(!res) {
     DXC_ERROR("encoded array malloc failed");
     return 0;
@@ -61,7 +62,7 @@ int dxc_read_value(read_context* ctx, DexValue* value, dx_uint* offset,
     DXC_ERROR("encoded value not within data section");
     return 0;
   }
-  dx_ubyte b = ctx->read_ubyte(ctx, offset);
+  dx_ubyte b = dxc_read_ubyte(ctx, offset);
   dx_ubyte value_arg = b >> 5;
   dx_ubyte value_type = b & 0x1F;
   dx_uint rsz = 0;
@@ -125,7 +126,7 @@ int dxc_read_value(read_context* ctx, DexValue* value, dx_uint* offset,
     }
   } else if(value_type == VALUE_ANNOTATION) {
     if(!(value->value.val_annotation =
-        (DexAnnotation*)calloc(1, sizeof(DexAnnotation)))) {
+        (DexAnnotation*)dxc_ctx_calloc(ctx, 1, sizeof(DexAnnotation)))) {
       DXC_ERROR("encoded value annotation alloc failed");
       return 0;
     } else if(!dxc_read_encoded_annotation(ctx, value->value.val_annotation,
@@ -136,7 +137,7 @@ int dxc_read_value(read_context* ctx, DexValue* value, dx_uint* offset,
     dx_ubyte rbuf[8] = {0, 0, 0, 0, 0, 0, 0, 0};
     dx_uint i;
     for(i = 0; i < rsz; i++) {
-      rbuf[extright ? nsz - rsz + i : i] = ctx->read_ubyte(ctx, offset);
+      rbuf[extright ? nsz - rsz + i : i] = dxc_read_ubyte(ctx, offset);
     }
     if(issigned && (rbuf[rsz - 1] & 0x80)) for(i = rsz; i < nsz; i++) {
       rbuf[i] = 0xFF;
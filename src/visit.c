@@ -0,0 +1,448 @@
+/*
+Copyright (C) 2010 Mark Gordon
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <dxcut/visit.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "dalvik.h"
+#include "read.h"
+#include "scan.h"
+
+static dx_uint NO_INDEX = 0xFFFFFFFFU;
+
+#define VISIT_ERROR 0
+#define VISIT_OK 1
+#define VISIT_STOPPED 2
+
+typedef struct dex_visit_context_t {
+  DexIdScan ids;
+  const DexVisitor* visitor;
+} visit_context;
+
+static
+const char* get_string(const visit_context* ctx, dx_uint idx) {
+  return dxc_scan_string(&ctx->ids, idx);
+}
+
+static
+const char* get_type(const visit_context* ctx, dx_uint idx) {
+  return dxc_scan_type(&ctx->ids, idx);
+}
+
+static
+int get_field(const visit_context* ctx, dx_uint idx, DexFieldView* field) {
+  if(idx >= ctx->ids.fields_sz) {
+    DXC_ERROR("field index out of range");
+    return 0;
+  }
+  read_context* rd = (read_context*)&ctx->ids.rd;
+  dx_uint pos = ctx->ids.fields_off + 8 * idx;
+  dx_uint class_idx = dxc_read_ushort(rd, &pos);
+  dx_uint type_idx = dxc_read_ushort(rd, &pos);
+  dx_uint name_idx = dxc_read_uint(rd, &pos);
+  field->defining_class = get_type(ctx, class_idx);
+  field->type = get_type(ctx, type_idx);
+  field->name = get_string(ctx, name_idx);
+  return field->defining_class && field->type && field->name;
+}
+
+static
+int get_method(const visit_context* ctx, dx_uint idx, DexMethodView* method) {
+  if(idx >= ctx->ids.methods_sz) {
+    DXC_ERROR("method index out of range");
+    return 0;
+  }
+  read_context* rd = (read_context*)&ctx->ids.rd;
+  dx_uint pos = ctx->ids.methods_off + 8 * idx;
+  dx_uint class_idx = dxc_read_ushort(rd, &pos);
+  dx_uint proto_idx = dxc_read_ushort(rd, &pos);
+  dx_uint name_idx = dxc_read_uint(rd, &pos);
+  if(proto_idx >= ctx->ids.protos_sz) {
+    DXC_ERROR("proto index out of range");
+    return 0;
+  }
+  method->defining_class = get_type(ctx, class_idx);
+  method->name = get_string(ctx, name_idx);
+
+  pos = ctx->ids.protos_off + 12 * proto_idx + 4;
+  method->return_type = get_type(ctx, dxc_read_uint(rd, &pos));
+  method->ctx = ctx;
+  method->parameters_off = dxc_read_uint(rd, &pos);
+  method->parameters_size = 0;
+  if(method->parameters_off) {
+    pos = method->parameters_off;
+    if(!dxc_read_ok(rd, pos, 4)) {
+      DXC_ERROR("parameter list outside of data section");
+      return 0;
+    }
+    method->parameters_size = dxc_read_uint(rd, &pos);
+    if(!dxc_read_ok(rd, pos, method->parameters_size * 2) ||
+       method->parameters_size > rd->data_sz / 2) {
+      DXC_ERROR("parameter list outside of data section");
+      return 0;
+    }
+  }
+  return method->defining_class && method->name && method->return_type;
+}
+
+const char* dxc_visit_parameter(const DexMethodView* method, dx_uint i) {
+  if(i >= method->parameters_size) return NULL;
+  dx_uint pos = method->parameters_off + 4 + 2 * i;
+  return get_type(method->ctx,
+      dxc_read_ushort((read_context*)&method->ctx->ids.rd, &pos));
+}
+
+const char* dxc_visit_interface(const DexClassView* cl, dx_uint i) {
+  if(i >= cl->interfaces_size) return NULL;
+  dx_uint pos = cl->interfaces_off + 4 + 2 * i;
+  return get_type(cl->ctx,
+      dxc_read_ushort((read_context*)&cl->ctx->ids.rd, &pos));
+}
+
+dx_int dxc_visit_register(const DexInstructionView* insn, dx_uint index) {
+  DexInstruction tmp;
+  memset(&tmp, 0, sizeof(tmp));
+  tmp.opcode = insn->opcode;
+  tmp.hi_byte = insn->hi_byte;
+  tmp.param[0] = insn->param[0];
+  tmp.param[1] = insn->param[1];
+  return dxc_get_register(&tmp, index);
+}
+
+static
+int visit_instructions(visit_context* ctx, const DexMethodView* method,
+                       const dx_ushort* buf, dx_uint size) {
+  const DexVisitor* visitor = ctx->visitor;
+  DexInstructionView insn;
+  dx_uint i;
+  for(i = 0; i < size; i += insn.size) {
+    memset(&insn, 0, sizeof(insn));
+    insn.address = i;
+    insn.units = buf + i;
+    insn.opcode = buf[i] & 0xFF;
+    insn.hi_byte = buf[i] >> 8;
+    insn.special_type = SPECIAL_NONE;
+    if(!(insn.size = dxc_dalvik_width(buf, i, size))) {
+      return VISIT_ERROR;
+    }
+    if(insn.opcode != OP_PSUEDO || insn.hi_byte == PSUEDO_OP_NOP) {
+      const DexOpFormat* fmt = &dex_opcode_formats[insn.opcode];
+      if(insn.size > 1) insn.param[0] = buf[i + 1];
+      if(insn.size > 2) insn.param[1] = buf[i + 2];
+      insn.special_type = fmt->specialType;
+      if(fmt->specialType != SPECIAL_NONE) {
+        dx_ulong v;
+        if(!dxc_decode_special(fmt, buf + i, &v)) {
+          return VISIT_ERROR;
+        }
+        switch(fmt->specialType) {
+          case SPECIAL_CONSTANT:
+            insn.special.constant = v;
+            break;
+          case SPECIAL_TARGET:
+            insn.special.target = v;
+            break;
+          case SPECIAL_STRING:
+            if(!(insn.special.str = get_string(ctx, v))) return VISIT_ERROR;
+            break;
+          case SPECIAL_TYPE:
+            if(!(insn.special.type = get_type(ctx, v))) return VISIT_ERROR;
+            break;
+          case SPECIAL_FIELD:
+            if(!get_field(ctx, v, &insn.special.field)) return VISIT_ERROR;
+            break;
+          case SPECIAL_METHOD:
+            if(!get_method(ctx, v, &insn.special.method)) return VISIT_ERROR;
+            break;
+          case SPECIAL_INLINE:
+          case SPECIAL_OBJECT:
+          case SPECIAL_VTABLE:
+            insn.special.index = v;
+            break;
+          case SPECIAL_NONE:
+            break;
+        }
+      }
+    }
+    if(visitor->visit_instruction(visitor->user, method, &insn) ==
+       DXC_VISIT_STOP) {
+      return VISIT_STOPPED;
+    }
+  }
+  return VISIT_OK;
+}
+
+static
+int visit_code(visit_context* ctx, const DexMethodView* method, dx_uint off) {
+  read_context* rd = &ctx->ids.rd;
+  const DexVisitor* visitor = ctx->visitor;
+  if(!dxc_read_ok(rd, off, 16)) {
+    DXC_ERROR("code item not within data section");
+    return VISIT_ERROR;
+  }
+  DexCodeView code;
+  code.registers_size = dxc_read_ushort(rd, &off);
+  code.ins_size = dxc_read_ushort(rd, &off);
+  code.outs_size = dxc_read_ushort(rd, &off);
+  code.tries_size = dxc_read_ushort(rd, &off);
+  dxc_read_uint(rd, &off);
+  code.insns_size = dxc_read_uint(rd, &off);
+  if(code.insns_size > rd->data_sz / 2 ||
+     !dxc_read_ok(rd, off, code.insns_size * 2)) {
+    DXC_ERROR("code item not within data section");
+    return VISIT_ERROR;
+  }
+  code.insns = (const dx_ushort*)(rd->buf + off);
+
+  DexVisitResult res = DXC_VISIT_CONTINUE;
+  if(visitor->visit_code) {
+    res = visitor->visit_code(visitor->user, method, &code);
+  }
+  if(res == DXC_VISIT_STOP) return VISIT_STOPPED;
+  if(res == DXC_VISIT_SKIP || !visitor->visit_instruction) return VISIT_OK;
+  return visit_instructions(ctx, method, code.insns, code.insns_size);
+}
+
+static
+int visit_annotation_set(visit_context* ctx, const DexClassView* cl,
+                         DexAnnotationView* an, dx_uint off) {
+  read_context* rd = &ctx->ids.rd;
+  const DexVisitor* visitor = ctx->visitor;
+  if(!off) return VISIT_OK;
+  if(!dxc_read_ok(rd, off, 4)) {
+    DXC_ERROR("annotation set not within data section");
+    return VISIT_ERROR;
+  }
+  dx_uint sz = dxc_read_uint(rd, &off);
+  if(sz > rd->data_sz / 4 || !dxc_read_ok(rd, off, sz * 4)) {
+    DXC_ERROR("annotation set not within data section");
+    return VISIT_ERROR;
+  }
+  dx_uint i;
+  for(i = 0; i < sz; i++) {
+    dx_uint item_off = dxc_read_uint(rd, &off);
+    if(!dxc_read_ok(rd, item_off, 1)) {
+      DXC_ERROR("annotation item not within data section");
+      return VISIT_ERROR;
+    }
+    an->visibility = (DexAnnotationVisibility)dxc_read_ubyte(rd, &item_off);
+    dx_uint type_idx = dxc_read_uleb(rd, &item_off);
+    an->elements_size = dxc_read_uleb(rd, &item_off);
+    if(!dxc_in_data(rd, item_off) || !(an->type = get_type(ctx, type_idx))) {
+      DXC_ERROR("malformed annotation item");
+      return VISIT_ERROR;
+    }
+    an->elements = (const dx_ubyte*)rd->buf + item_off;
+    if(visitor->visit_annotation(visitor->user, cl, an) == DXC_VISIT_STOP) {
+      return VISIT_STOPPED;
+    }
+  }
+  return VISIT_OK;
+}
+
+static
+int visit_annotations(visit_context* ctx, const DexClassView* cl,
+                      dx_uint off) {
+  read_context* rd = &ctx->ids.rd;
+  if(!dxc_read_ok(rd, off, 16)) {
+    DXC_ERROR("annotation directory not within data section");
+    return VISIT_ERROR;
+  }
+  dx_uint class_off = dxc_read_uint(rd, &off);
+  dx_uint fields_sz = dxc_read_uint(rd, &off);
+  dx_uint methods_sz = dxc_read_uint(rd, &off);
+  dx_uint params_sz = dxc_read_uint(rd, &off);
+  if(fields_sz > rd->data_sz / 8 || methods_sz > rd->data_sz / 8 ||
+     params_sz > rd->data_sz / 8 ||
+     !dxc_read_ok(rd, off, (fields_sz + methods_sz + params_sz) * 8)) {
+    DXC_ERROR("annotation directory not within data section");
+    return VISIT_ERROR;
+  }
+
+  DexAnnotationView an;
+  DexFieldView field;
+  DexMethodView method;
+  memset(&an, 0, sizeof(an));
+  an.target = DXC_ANNOTATION_CLASS;
+  int res = visit_annotation_set(ctx, cl, &an, class_off);
+
+  dx_uint i;
+  an.target = DXC_ANNOTATION_FIELD;
+  an.field = &field;
+  for(i = 0; res == VISIT_OK && i < fields_sz; i++) {
+    if(!get_field(ctx, dxc_read_uint(rd, &off), &field)) return VISIT_ERROR;
+    res = visit_annotation_set(ctx, cl, &an, dxc_read_uint(rd, &off));
+  }
+
+  an.target = DXC_ANNOTATION_METHOD;
+  an.field = NULL;
+  an.method = &method;
+  for(i = 0; res == VISIT_OK && i < methods_sz; i++) {
+    if(!get_method(ctx, dxc_read_uint(rd, &off), &method)) return VISIT_ERROR;
+    res = visit_annotation_set(ctx, cl, &an, dxc_read_uint(rd, &off));
+  }
+
+  an.target = DXC_ANNOTATION_PARAMETER;
+  for(i = 0; res == VISIT_OK && i < params_sz; i++) {
+    if(!get_method(ctx, dxc_read_uint(rd, &off), &method)) return VISIT_ERROR;
+    dx_uint list_off = dxc_read_uint(rd, &off);
+    if(!dxc_read_ok(rd, list_off, 4)) {
+      DXC_ERROR("annotation set list not within data section");
+      return VISIT_ERROR;
+    }
+    dx_uint list_sz = dxc_read_uint(rd, &list_off);
+    if(list_sz > rd->data_sz / 4 || !dxc_read_ok(rd, list_off, list_sz * 4)) {
+      DXC_ERROR("annotation set list not within data section");
+      return VISIT_ERROR;
+    }
+    for(an.parameter = 0; res == VISIT_OK && an.parameter < list_sz;
+        an.parameter++) {
+      res = visit_annotation_set(ctx, cl, &an, dxc_read_uint(rd, &list_off));
+    }
+  }
+  return res;
+}
+
+static
+int visit_class_data(visit_context* ctx, const DexClassView* cl,
+                     dx_uint off) {
+  read_context* rd = &ctx->ids.rd;
+  const DexVisitor* visitor = ctx->visitor;
+  dx_uint counts[4];
+  dx_uint i;
+  for(i = 0; i < 4; i++) {
+    counts[i] = dxc_read_uleb(rd, &off);
+  }
+  dx_uint kind;
+  for(kind = 0; kind < 4; kind++) {
+    dx_uint idx = 0;
+    for(i = 0; i < counts[kind]; i++) {
+      idx += dxc_read_uleb(rd, &off);
+      dx_uint access_flags = dxc_read_uleb(rd, &off);
+      dx_uint code_off = kind < 2 ? 0 : dxc_read_uleb(rd, &off);
+      if(!dxc_in_data(rd, off)) {
+        DXC_ERROR("class data not within data section");
+        return VISIT_ERROR;
+      }
+
+      DexVisitResult res = DXC_VISIT_CONTINUE;
+      if(kind < 2) {
+        DexFieldView field;
+        if(!visitor->visit_field) continue;
+        if(!get_field(ctx, idx, &field)) return VISIT_ERROR;
+        res = visitor->visit_field(visitor->user, cl, &field, access_flags,
+                                   kind == 0);
+      } else {
+        DexMethodView method;
+        if(!visitor->visit_method && !visitor->visit_code &&
+           !visitor->visit_instruction) continue;
+        if(!get_method(ctx, idx, &method)) return VISIT_ERROR;
+        if(visitor->visit_method) {
+          res = visitor->visit_method(visitor->user, cl, &method,
+                                      access_flags, kind == 2);
+        }
+        if(res == DXC_VISIT_CONTINUE && code_off &&
+           (visitor->visit_code || visitor->visit_instruction)) {
+          int status = visit_code(ctx, &method, code_off);
+          if(status != VISIT_OK) return status;
+        }
+      }
+      if(res == DXC_VISIT_STOP) return VISIT_STOPPED;
+    }
+  }
+  return VISIT_OK;
+}
+
+static
+int visit_class(visit_context* ctx, dx_uint off) {
+  read_context* rd = (read_context*)&ctx->ids.rd;
+  const DexVisitor* visitor = ctx->visitor;
+  DexClassView cl;
+  dx_uint class_idx = dxc_read_uint(rd, &off);
+  cl.access_flags = dxc_read_uint(rd, &off);
+  dx_uint superclass_idx = dxc_read_uint(rd, &off);
+  cl.interfaces_off = dxc_read_uint(rd, &off);
+  dx_uint source_file_idx = dxc_read_uint(rd, &off);
+  dx_uint annotations_off = dxc_read_uint(rd, &off);
+  dx_uint class_data_off = dxc_read_uint(rd, &off);
+  cl.ctx = ctx;
+
+  if(!(cl.name = get_type(ctx, class_idx))) return VISIT_ERROR;
+  cl.super_class = NULL;
+  if(superclass_idx != NO_INDEX &&
+     !(cl.super_class = get_type(ctx, superclass_idx))) return VISIT_ERROR;
+  cl.source_file = NULL;
+  if(source_file_idx != NO_INDEX &&
+     !(cl.source_file = get_string(ctx, source_file_idx))) return VISIT_ERROR;
+  cl.interfaces_size = 0;
+  if(cl.interfaces_off) {
+    dx_uint pos = cl.interfaces_off;
+    if(!dxc_read_ok(rd, pos, 4)) {
+      DXC_ERROR("interface list not within data section");
+      return VISIT_ERROR;
+    }
+    cl.interfaces_size = dxc_read_uint(rd, &pos);
+    if(cl.interfaces_size > rd->data_sz / 2 ||
+       !dxc_read_ok(rd, pos, cl.interfaces_size * 2)) {
+      DXC_ERROR("interface list not within data section");
+      return VISIT_ERROR;
+    }
+  }
+
+  DexVisitResult res = DXC_VISIT_CONTINUE;
+  if(visitor->visit_class) {
+    res = visitor->visit_class(visitor->user, &cl);
+  }
+  if(res == DXC_VISIT_STOP) return VISIT_STOPPED;
+  if(res == DXC_VISIT_CONTINUE) {
+    int status = VISIT_OK;
+    if(annotations_off && visitor->visit_annotation) {
+      status = visit_annotations(ctx, &cl, annotations_off);
+    }
+    if(status == VISIT_OK && class_data_off) {
+      if(!dxc_read_ok(rd, class_data_off, 4)) {
+        DXC_ERROR("class data not within data section");
+        return VISIT_ERROR;
+      }
+      status = visit_class_data(ctx, &cl, class_data_off);
+    }
+    if(status != VISIT_OK) return status;
+  }
+  if(visitor->end_class &&
+     visitor->end_class(visitor->user, &cl) == DXC_VISIT_STOP) {
+    return VISIT_STOPPED;
+  }
+  return VISIT_OK;
+}
+
+int dxc_visit_buffer(const void* buf, dx_uint size, const DexVisitor* visitor) {
+  visit_context ctx;
+  if(!dxc_init_id_scan(&ctx.ids, buf, size)) return 0;
+  ctx.visitor = visitor;
+
+  dx_uint classes_sz = ctx.ids.classes_sz;
+  dx_uint classes_off = ctx.ids.classes_off;
+  dx_uint i;
+  for(i = 0; i < classes_sz; i++) {
+    int status = visit_class(&ctx, classes_off + 32 * i);
+    if(status == VISIT_ERROR) return 0;
+    if(status == VISIT_STOPPED) break;
+  }
+  return 1;
+}
@@ -20,13 +20,31 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <dxcut/dxcut.h>
 
 #include "common.h"
+#include "dalvik.h"
 #include "file.h"
 #include "fields.h"
 #include "methods.h"
 #include "mutf8.h"
+#include "read.h"
+#include "swap.h"
+#include "threads.h"
 
 static const dx_uint NO_INDEX = 0xFFFFFFFFU;
 
+/* A hash set over the entries of one pool array so that duplicates are
+ * dropped as they are added.  Each slot holds the hash of an entry and its
+ * index plus one, zero marking a free slot.  The capacity is a power of two
+ * and kept at least twice the number of entries. */
+typedef struct {
+  dx_uint hash;
+  dx_uint index;
+} pool_slot;
+
+typedef struct {
+  pool_slot* slots;
+  dx_uint slots_cap;
+} pool_set;
+
 typedef struct {
   ref_str** strs;
   ref_str** types;
@@ -43,14 +61,22 @@ typedef struct {
   dx_uint protos_cap;
   dx_uint fields_cap;
   dx_uint methods_cap;
+  pool_set strs_set;
+  pool_set types_set;
+  pool_set protos_set;
+  pool_set fields_set;
+  pool_set methods_set;
+  // Set when some code that must be written could not be read.
+  int failed;
 } constant_pool;
 
 static
 int compare_proto(ref_strstr* aa, ref_strstr* bb) {
+  if(aa == bb) return 0;
   ref_str** a = aa->s;
   ref_str** b = bb->s;
   for(; *a && *b; a++, b++) {
-    int res = mutf8_compare((*a)->s, (*b)->s);
+    int res = mutf8_ref_compare(*a, *b);
     if(res) return res;
   }
   if(*a == NULL) return *b ? -1 : 0;
@@ -59,24 +85,24 @@ int compare_proto(ref_strstr* aa, ref_strstr* bb) {
 
 static
 int compare_field(raw_field a, raw_field b) {
-  int res = mutf8_compare(a.defining_class->s, b.defining_class->s);
+  int res = mutf8_ref_compare(a.defining_class, b.defining_class);
   if(res) return res;
-  res = mutf8_compare(a.name->s, b.name->s);
+  res = mutf8_ref_compare(a.name, b.name);
   if(res) return res;
-  return mutf8_compare(a.type->s, b.type->s);
+  return mutf8_ref_compare(a.type, b.type);
 }
 
 static
 int compare_method(raw_method a, raw_method b) {
-  int res = mutf8_compare(a.defining_class->s, b.defining_class->s);
+  int res = mutf8_ref_compare(a.defining_class, b.defining_class);
   if(res) return res;
-  res = mutf8_compare(a.name->s, b.name->s);
+  res = mutf8_ref_compare(a.name, b.name);
   if(res) return res;
   return compare_proto(a.prototype, b.prototype);
 }
 
 static int compare_mutf8_ptr(const void* a, const void* b) {
-  return mutf8_compare((*(ref_str**)a)->s, (*(ref_str**)b)->s);
+  return mutf8_ref_compare(*(ref_str**)a, *(ref_str**)b);
 }
 static int compare_proto_ptr(const void* a, const void* b) {
   return compare_proto(*(ref_strstr**)a, *(ref_strstr**)b);
@@ -88,78 +114,193 @@ static int compare_method_ptr(const void* a, const void* b) {
   return compare_method(*(raw_method*)a, *(raw_method*)b);
 }
 
-#define add_pool(A, sz, cap, val, cpy_func) \
+static
+int equal_proto(ref_strstr* a, ref_strstr* b) {
+  if(a == b) return 1;
+  ref_str** x = a->s;
+  ref_str** y = b->s;
+  for(; *x && *y; x++, y++) {
+    if(!dxc_str_equal(*x, *y)) return 0;
+  }
+  return !*x && !*y;
+}
+
+static
+int equal_field(raw_field a, raw_field b) {
+  return dxc_str_equal(a.defining_class, b.defining_class) &&
+         dxc_str_equal(a.name, b.name) && dxc_str_equal(a.type, b.type);
+}
+
+static
+int equal_method(raw_method a, raw_method b) {
+  return dxc_str_equal(a.defining_class, b.defining_class) &&
+         dxc_str_equal(a.name, b.name) &&
+         equal_proto(a.prototype, b.prototype);
+}
+
+static
+dx_uint mix_hash(dx_uint h, dx_uint v) {
+  return h ^ (v + 0x9E3779B9U + (h << 6) + (h >> 2));
+}
+
+static
+dx_uint hash_proto(ref_strstr* proto) {
+  dx_uint h = 0;
+  ref_str** s;
+  for(s = proto->s; *s; s++) h = mix_hash(h, dxc_str_hash(*s));
+  return h;
+}
+
+static
+dx_uint hash_field(raw_field fld) {
+  return mix_hash(mix_hash(dxc_str_hash(fld.defining_class),
+                           dxc_str_hash(fld.name)), dxc_str_hash(fld.type));
+}
+
+static
+dx_uint hash_method(raw_method mtd) {
+  return mix_hash(mix_hash(dxc_str_hash(mtd.defining_class),
+                           dxc_str_hash(mtd.name)), hash_proto(mtd.prototype));
+}
+
+static
+void init_pool_set(pool_set* set) {
+  set->slots_cap = 16;
+  set->slots = (pool_slot*)calloc(set->slots_cap, sizeof(pool_slot));
+}
+
+static
+void grow_pool_set(pool_set* set) {
+  dx_uint cap = set->slots_cap * 2;
+  pool_slot* slots = (pool_slot*)calloc(cap, sizeof(pool_slot));
+  dx_uint i;
+  for(i = 0; i < set->slots_cap; i++) {
+    if(!set->slots[i].index) continue;
+    dx_uint j = set->slots[i].hash & (cap - 1);
+    while(slots[j].index) j = (j + 1) & (cap - 1);
+    slots[j] = set->slots[i];
+  }
+  free(set->slots);
+  set->slots = slots;
+  set->slots_cap = cap;
+}
+
+/* Appends a copy of val to the pool array A unless an equal entry is already
+ * in set. */
+#define add_pool(A, sz, cap, set, val, hash_func, equal_func, cpy_func) \
+  if(sz * 2 >= set.slots_cap) grow_pool_set(&set); \
+  dx_uint h = hash_func(val); \
+  dx_uint j; \
+  dx_uint mask = set.slots_cap - 1; \
+  for(j = h & mask; set.slots[j].index; j = (j + 1) & mask) { \
+    if(set.slots[j].hash == h && equal_func(A[set.slots[j].index - 1], val)) { \
+      return; \
+    } \
+  } \
   if(sz == cap) { \
     cap = cap * 3 / 2 + 1; \
     A = (typeof(A))realloc(A, sizeof(*A) * cap); \
   } \
-  A[sz++] = cpy_func(val);
+  A[sz++] = cpy_func(val); \
+  set.slots[j].hash = h; \
+  set.slots[j].index = sz;
 
 static
 void add_str(constant_pool* pool, ref_str* str) {
-  add_pool(pool->strs, pool->strs_size, pool->strs_cap, str, dxc_copy_str);
+  add_pool(pool->strs, pool->strs_size, pool->strs_cap, pool->strs_set, str,
+           dxc_str_hash, dxc_str_equal, dxc_copy_str);
 }
 
 static
 void add_type(constant_pool* pool, ref_str* type) {
-  add_pool(pool->types, pool->types_size, pool->types_cap, type, dxc_copy_str);
+  add_pool(pool->types, pool->types_size, pool->types_cap, pool->types_set,
+           type, dxc_str_hash, dxc_str_equal, dxc_copy_str);
 }
 
 static
 void add_proto(constant_pool* pool, ref_strstr* proto) {
-  add_pool(pool->protos, pool->protos_size, pool->protos_cap, proto,
-           dxc_copy_strstr);
+  add_pool(pool->protos, pool->protos_size, pool->protos_cap,
+           pool->protos_set, proto, hash_proto, equal_proto, dxc_copy_strstr);
 }
 
 static
 void add_field(constant_pool* pool, raw_field field) {
-  add_pool(pool->fields, pool->fields_size, pool->fields_cap, field,
+  add_pool(pool->fields, pool->fields_size, pool->fields_cap,
+           pool->fields_set, field, hash_field, equal_field,
            dxc_copy_raw_field);
 }
 
 static
 void add_method(constant_pool* pool, raw_method method) {
-  add_pool(pool->methods, pool->methods_size, pool->methods_cap, method,
+  add_pool(pool->methods, pool->methods_size, pool->methods_cap,
+           pool->methods_set, method, hash_method, equal_method,
            dxc_copy_raw_method);
 }
 
-#undef find_pool
+#undef add_pool
+
+/* Once the pool arrays are sorted their sets are refilled with the final
+ * indices, making every lookup of the encoder a hash probe. */
+#define index_pool(A, sz, set, hash_func) { \
+  memset(set.slots, 0, sizeof(pool_slot) * set.slots_cap); \
+  dx_uint mask = set.slots_cap - 1; \
+  dx_uint i; \
+  for(i = 0; i < sz; i++) { \
+    dx_uint h = hash_func(A[i]); \
+    dx_uint j; \
+    for(j = h & mask; set.slots[j].index; j = (j + 1) & mask); \
+    set.slots[j].hash = h; \
+    set.slots[j].index = i + 1; \
+  } \
+}
 
-#define find_pool(A, sz, val, cmp) \
-  dx_uint lo = 0; \
-  dx_uint hi = sz; \
-  while(lo < hi) { \
-    dx_uint mid = lo + (hi - lo) / 2; \
-    int r = cmp(val, A[mid]); \
-    if(!r) return mid; \
-    if(r < 0) hi = mid; \
-    else lo = mid + 1; \
+static
+void index_pools(constant_pool* pool) {
+  index_pool(pool->strs, pool->strs_size, pool->strs_set, dxc_str_hash);
+  index_pool(pool->types, pool->types_size, pool->types_set, dxc_str_hash);
+  index_pool(pool->protos, pool->protos_size, pool->protos_set, hash_proto);
+  index_pool(pool->fields, pool->fields_size, pool->fields_set, hash_field);
+  index_pool(pool->methods, pool->methods_size, pool->methods_set,
+             hash_method);
+}
+
+#undef index_pool
+
+#define find_pool(A, set, val, hash_func, equal_func) \
+  dx_uint h = hash_func(val); \
+  dx_uint mask = set.slots_cap - 1; \
+  dx_uint j; \
+  for(j = h & mask; set.slots[j].index; j = (j + 1) & mask) { \
+    if(set.slots[j].hash == h && equal_func(A[set.slots[j].index - 1], val)) { \
+      return set.slots[j].index - 1; \
+    } \
   } \
   return NO_INDEX;
 
 static
 dx_uint find_str(constant_pool* pool, ref_str* str) {
-  find_pool(pool->strs, pool->strs_size, str, mutf8_ref_compare);
+  find_pool(pool->strs, pool->strs_set, str, dxc_str_hash, dxc_str_equal);
 }
 
 static
 dx_uint find_type(constant_pool* pool, ref_str* type) {
-  find_pool(pool->types, pool->types_size, type, mutf8_ref_compare);
+  find_pool(pool->types, pool->types_set, type, dxc_str_hash, dxc_str_equal);
 }
 
 static
 dx_uint find_proto(constant_pool* pool, ref_strstr* proto) {
-  find_pool(pool->protos, pool->protos_size, proto, compare_proto);
+  find_pool(pool->protos, pool->protos_set, proto, hash_proto, equal_proto);
 }
 
 static
 dx_uint find_field(constant_pool* pool, raw_field field) {
-  find_pool(pool->fields, pool->fields_size, field, compare_field);
+  find_pool(pool->fields, pool->fields_set, field, hash_field, equal_field);
 }
 
 static
 dx_uint find_method(constant_pool* pool, raw_method method) {
-  find_pool(pool->methods, pool->methods_size, method, compare_method);
+  find_pool(pool->methods, pool->methods_set, method, hash_method,
+            equal_method);
 }
 
 #undef find_pool
@@ -238,16 +379,36 @@ typedef struct {
   }* resolve;
 } data_item;
 
+/* Maps the id table indices of one input onto the pool being written, for
+ * code that is copied from its input rather than decoded.  Entries are looked
+ * up on first use and NO_INDEX until then. */
+typedef struct {
+  read_context* src;
+  dx_uint* strs;
+  dx_uint* types;
+  dx_uint* fields;
+  dx_uint* methods;
+} source_remap;
+
 typedef struct {
   constant_pool pool;
   data_item* dat;
 
   int dat_sz;
   int dat_cap;
+
+  source_remap* remaps;
+  int remaps_sz;
+
+  // The sum of some of the DexWriteFlags.
+  dx_uint flags;
+
+  // Set when some code that must be written could not be read.
+  int failed;
 } write_context;
 
-void init_ctx(write_context* ctx) {
-  constant_pool* pool = &ctx->pool;
+static
+void init_pool(constant_pool* pool) {
   pool->strs_size = pool->types_size = pool->protos_size =
       pool->fields_size = pool->methods_size = 0;
   pool->strs_cap = pool->types_cap = pool->protos_cap =
@@ -257,30 +418,67 @@ void init_ctx(write_context* ctx) {
   pool->protos = (ref_strstr**)malloc(sizeof(ref_strstr*) * pool->protos_cap);
   pool->fields = (raw_field*)malloc(sizeof(raw_field) * pool->fields_cap);
   pool->methods = (raw_method*)malloc(sizeof(raw_method) * pool->methods_cap);
+  init_pool_set(&pool->strs_set);
+  init_pool_set(&pool->types_set);
+  init_pool_set(&pool->protos_set);
+  init_pool_set(&pool->fields_set);
+  init_pool_set(&pool->methods_set);
+  pool->failed = 0;
+}
+
+static
+void free_pool(constant_pool* pool) {
+  dx_uint i;
+  for(i = 0; i < pool->strs_size; i++) dxc_free_str(pool->strs[i]);
+  for(i = 0; i < pool->types_size; i++) dxc_free_str(pool->types[i]);
+  for(i = 0; i < pool->protos_size; i++) dxc_free_strstr(pool->protos[i]);
+  for(i = 0; i < pool->fields_size; i++) {
+    dxc_free_raw_field(pool->fields[i]);
+  }
+  for(i = 0; i < pool->methods_size; i++) {
+    dxc_free_raw_method(pool->methods[i]);
+  }
+  free(pool->strs);
+  free(pool->types);
+  free(pool->protos);
+  free(pool->fields);
+  free(pool->methods);
+  free(pool->strs_set.slots);
+  free(pool->types_set.slots);
+  free(pool->protos_set.slots);
+  free(pool->fields_set.slots);
+  free(pool->methods_set.slots);
+}
+
+void init_ctx(write_context* ctx) {
+  init_pool(&ctx->pool);
   ctx->dat_sz = 0;
   ctx->dat_cap = 128;
   ctx->dat = (data_item*)malloc(sizeof(data_item) * ctx->dat_cap);
+  ctx->remaps = NULL;
+  ctx->remaps_sz = 0;
+  ctx->flags = 0;
+  ctx->failed = 0;
+}
+
+static
+void free_remaps(write_context* ctx) {
+  int j;
+  for(j = 0; j < ctx->remaps_sz; j++) {
+    free(ctx->remaps[j].strs);
+    free(ctx->remaps[j].types);
+    free(ctx->remaps[j].fields);
+    free(ctx->remaps[j].methods);
+  }
+  free(ctx->remaps);
 }
 
 // Isn't responsible for freeing the data_items in dat.
 static
 void free_ctx(write_context ctx) {
   free(ctx.dat);
-  dx_uint i;
-  for(i = 0; i < ctx.pool.strs_size; i++) dxc_free_str(ctx.pool.strs[i]);
-  for(i = 0; i < ctx.pool.types_size; i++) dxc_free_str(ctx.pool.types[i]);
-  for(i = 0; i < ctx.pool.protos_size; i++) dxc_free_strstr(ctx.pool.protos[i]);
-  for(i = 0; i < ctx.pool.fields_size; i++) {
-    dxc_free_raw_field(ctx.pool.fields[i]);
-  }
-  for(i = 0; i < ctx.pool.methods_size; i++) {
-    dxc_free_raw_method(ctx.pool.methods[i]);
-  }
-  free(ctx.pool.strs);
-  free(ctx.pool.types);
-  free(ctx.pool.protos);
-  free(ctx.pool.fields);
-  free(ctx.pool.methods);
+  free_pool(&ctx.pool);
+  free_remaps(&ctx);
 }
 
 static
@@ -288,7 +486,7 @@ data_item init_data_item(int type) {
   data_item ret;
   ret.type = type;
   ret.data_sz = 0;
-  ret.data_cap = 4;
+  ret.data_cap = 16;
   ret.data = (char*)malloc(ret.data_cap);
   ret.resolve = NULL;
   return ret;
@@ -487,11 +685,145 @@ void pop_code(DexCode* code, constant_pool* pool) {
   }
 }
 
+/* Adds the operands of the instructions in buf, pool indices into src, to the
+ * pool.  Returns 0 if the instructions are malformed. */
+static
+int pop_raw_insns(read_context* src, const dx_ushort* buf, dx_uint size,
+                  constant_pool* pool) {
+  dx_uint i;
+  dx_uint width;
+  for(i = 0; i < size; i += width) {
+    if(!(width = dxc_dalvik_width(buf, i, size))) return 0;
+    if((buf[i] & 0x00FF) == OP_PSUEDO && (buf[i] >> 8) != PSUEDO_OP_NOP) {
+      continue;
+    }
+    const DexOpFormat* fmt = &dex_opcode_formats[buf[i] & 0x00FF];
+    dx_ulong v;
+    switch(fmt->specialType) {
+      case SPECIAL_STRING:
+        if(!dxc_decode_special(fmt, buf + i, &v) || v >= src->strs_sz) {
+          return 0;
+        }
+        add_str(pool, src->strs[v]);
+        break;
+      case SPECIAL_TYPE:
+        if(!dxc_decode_special(fmt, buf + i, &v) || v >= src->types_sz) {
+          return 0;
+        }
+        add_type(pool, src->types[v]);
+        break;
+      case SPECIAL_FIELD:
+        if(!dxc_decode_special(fmt, buf + i, &v) || v >= src->fields_sz) {
+          return 0;
+        }
+        add_field(pool, src->fields[v]);
+        break;
+      case SPECIAL_METHOD:
+        if(!dxc_decode_special(fmt, buf + i, &v) || v >= src->methods_sz) {
+          return 0;
+        }
+        add_method(pool, src->methods[v]);
+        break;
+      default:
+        break;
+    }
+  }
+  return 1;
+}
+
+/* The layout of a code_item in the input, see parse_raw_code. */
+typedef struct {
+  dx_ushort registers_size;
+  dx_ushort ins_size;
+  dx_ushort outs_size;
+  dx_ushort tries_size;
+  dx_uint debug_info_off;
+  dx_uint insns_size;
+  dx_uint insns_off;
+  dx_uint tries_off;
+  dx_uint handlers_off;
+} raw_code;
+
+static
+int parse_raw_code(read_context* src, dx_uint off, raw_code* rc) {
+  if(!dxc_read_ok(src, off, 16)) return 0;
+  rc->registers_size = dxc_read_ushort(src, &off);
+  rc->ins_size = dxc_read_ushort(src, &off);
+  rc->outs_size = dxc_read_ushort(src, &off);
+  rc->tries_size = dxc_read_ushort(src, &off);
+  rc->debug_info_off = dxc_read_uint(src, &off);
+  if(src->flags & DXC_READ_NO_DEBUG_INFO) rc->debug_info_off = 0;
+  rc->insns_size = dxc_read_uint(src, &off);
+  if(rc->insns_size > src->data_sz / 2 ||
+     !dxc_read_ok(src, off, rc->insns_size * 2)) {
+    return 0;
+  }
+  rc->insns_off = off;
+  rc->tries_off = off + rc->insns_size * 2 + (rc->insns_size & 1) * 2;
+  rc->handlers_off = rc->tries_off + rc->tries_size * 8;
+  return !rc->tries_size || dxc_read_ok(src, rc->tries_off,
+                                        rc->tries_size * 8);
+}
+
+static
+int copy_raw_debug(read_context* src, dx_uint off, constant_pool* pool,
+                   source_remap* m, data_item* d);
+
+static
+int copy_raw_handler(read_context* src, dx_uint off, constant_pool* pool,
+                     source_remap* m, data_item* d);
+
+/* Adds the references of the undecoded code item at off in src to the pool,
+ * checking it along the way.  Returns 0 if it is malformed. */
+static
+int pop_raw_code(read_context* src, dx_uint off, constant_pool* pool) {
+  raw_code rc;
+  if(!parse_raw_code(src, off, &rc)) return 0;
+  if(rc.debug_info_off &&
+     !copy_raw_debug(src, rc.debug_info_off, pool, NULL, NULL)) {
+    return 0;
+  }
+  if(!pop_raw_insns(src, (const dx_ushort*)(src->buf + rc.insns_off),
+                    rc.insns_size, pool)) {
+    return 0;
+  }
+  dx_uint i;
+  dx_uint toff = rc.tries_off;
+  for(i = 0; i < rc.tries_size; i++) {
+    toff += 6;
+    dx_uint hoff = rc.handlers_off + dxc_read_ushort(src, &toff);
+    if(!copy_raw_handler(src, hoff, pool, NULL, NULL)) return 0;
+  }
+  return 1;
+}
+
+static
+void pop_compact_code(DexCompactCode* code, constant_pool* pool) {
+  if(code->debug_information) {
+    pop_debug_information(code->debug_information, pool);
+  }
+  pop_array(code->tries, pool, dxc_is_sentinel_try_block, pop_try_block);
+  pop_raw_insns(code->source, code->insns, code->insns_size, pool);
+}
+
 static
 void pop_method(DexMethod* mtd, constant_pool* pool) {
   add_str(pool, mtd->name);
   add_proto(pool, mtd->prototype);
-  if(mtd->code_body) pop_code(mtd->code_body, pool);
+  /* Code that was never decoded cannot have been modified and is copied from
+   * the input when written, so leave it undecoded here as well. */
+  if(!mtd->code_body && mtd->compact_code) {
+    pop_compact_code(mtd->compact_code, pool);
+  } else if(mtd->code_body || !mtd->code_off ||
+            !pop_raw_code(mtd->code_source, mtd->code_off, pool)) {
+    DexCode* code = dxc_method_code(mtd);
+    if(code) {
+      pop_code(code, pool);
+    } else if(mtd->code_off || mtd->compact_code) {
+      /* The method has code that can neither be copied nor decoded. */
+      pool->failed = 1;
+    }
+  }
   pop_array(mtd->annotations, pool, dxc_is_sentinel_annotation, pop_annotation);
   DexAnnotation** anns;
   for(anns = mtd->parameter_annotations; *anns; anns++) {
@@ -537,13 +869,72 @@ void pop_class(DexClass* cl, constant_pool* pool) {
   }
 }
 
+/* Adds every entry of from to pool and frees from. */
+static
+void merge_pool(constant_pool* pool, constant_pool* from) {
+  dx_uint i;
+  for(i = 0; i < from->strs_size; i++) add_str(pool, from->strs[i]);
+  for(i = 0; i < from->types_size; i++) add_type(pool, from->types[i]);
+  for(i = 0; i < from->protos_size; i++) add_proto(pool, from->protos[i]);
+  for(i = 0; i < from->fields_size; i++) add_field(pool, from->fields[i]);
+  for(i = 0; i < from->methods_size; i++) add_method(pool, from->methods[i]);
+  if(from->failed) pool->failed = 1;
+  free_pool(from);
+}
+
+typedef struct {
+  DexClass* classes;
+  dx_uint count;
+  dx_uint per_shard;
+  constant_pool* shards;
+} pop_task;
+
+static
+int pop_shard_task(void* vtask, dx_uint i) {
+  pop_task* task = (pop_task*)vtask;
+  dx_uint j = i * task->per_shard;
+  dx_uint end = j + task->per_shard;
+  if(end > task->count) end = task->count;
+  for(; j < end; j++) pop_class(task->classes + j, task->shards + i);
+  return 1;
+}
+
+/* Adds the references of every class to the pool.  With several threads each
+ * one collects a contiguous run of classes into a pool of its own, already
+ * free of duplicates, and the runs are merged afterwards. */
+static
+void pop_classes(constant_pool* pool, DexClass* classes, dx_uint nthreads) {
+  dx_uint count;
+  for(count = 0; !dxc_is_sentinel_class(classes + count); count++);
+  dx_uint nshards = nthreads * 2;
+  if(nshards > count) nshards = count;
+  if(nthreads <= 1 || nshards <= 1) {
+    pop_array(classes, pool, dxc_is_sentinel_class, pop_class);
+    return;
+  }
+  pop_task task;
+  task.classes = classes;
+  task.count = count;
+  task.per_shard = (count + nshards - 1) / nshards;
+  nshards = (count + task.per_shard - 1) / task.per_shard;
+  task.shards = (constant_pool*)malloc(sizeof(constant_pool) * nshards);
+  dx_uint i;
+  for(i = 0; i < nshards; i++) init_pool(task.shards + i);
+  /* Each class only decodes its own code; the shared parts are the reference
+   * counts of the strings it adds. */
+  dxc_share_refs_begin();
+  dxc_run_tasks_batched(nthreads, nshards, 1, pop_shard_task, &task);
+  dxc_share_refs_end();
+  for(i = 0; i < nshards; i++) merge_pool(pool, task.shards + i);
+  free(task.shards);
+}
+
 static
 ref_str* getShorty(ref_strstr* s) {
   int sz = 0;
   ref_str** t;
   for(t = s->s; *t; t++) sz++;
-  ref_str* ret = (ref_str*)malloc(4 + sz + 1);
-  ret->cnt = 1;
+  ref_str* ret = dxc_alloc_str(sz);
   char* rets;
   for(rets = ret->s, t = s->s; *t; t++, rets++) {
     if((*t)->s[0] == '[') *rets = 'L';
@@ -553,13 +944,23 @@ ref_str* getShorty(ref_strstr* s) {
   return ret;
 }
 
+/* Makes room for sz more bytes at the end of d and returns where they go. */
 static
-void write_ubyte(data_item* d, dx_ubyte x) {
-  if(d->data_sz == d->data_cap) {
-    d->data_cap = d->data_cap * 3 / 2 + 1;
+char* extend_data(data_item* d, dx_uint sz) {
+  if(d->data_sz + sz > d->data_cap) {
+    while(d->data_sz + sz > d->data_cap) {
+      d->data_cap = d->data_cap * 3 / 2 + 1;
+    }
     d->data = (char*)realloc(d->data, d->data_cap);
   }
-  d->data[d->data_sz++] = x;
+  char* ret = d->data + d->data_sz;
+  d->data_sz += sz;
+  return ret;
+}
+
+static
+void write_ubyte(data_item* d, dx_ubyte x) {
+  *extend_data(d, 1) = x;
 }
 
 static
@@ -567,8 +968,9 @@ void write_byte(data_item* d, dx_byte x) { write_ubyte(d, x); }
 
 static
 void write_ushort(data_item* d, dx_ushort x) {
-  write_ubyte(d, x & 0xFF);
-  write_ubyte(d, x >> 8 & 0xFF);
+  char* p = extend_data(d, 2);
+  p[0] = x & 0xFF;
+  p[1] = x >> 8 & 0xFF;
 }
 
 static
@@ -576,10 +978,11 @@ void write_short(data_item* d, dx_short x) { write_ushort(d, x); }
 
 static
 void write_uint(data_item* d, dx_uint x) {
-  write_ubyte(d, x & 0xFF);
-  write_ubyte(d, x >> 8 & 0xFF);
-  write_ubyte(d, x >> 16 & 0xFF);
-  write_ubyte(d, x >> 24 & 0xFF);
+  char* p = extend_data(d, 4);
+  p[0] = x & 0xFF;
+  p[1] = x >> 8 & 0xFF;
+  p[2] = x >> 16 & 0xFF;
+  p[3] = x >> 24 & 0xFF;
 }
 
 static
@@ -587,37 +990,45 @@ void write_int(data_item* d, dx_int x) { write_uint(d, x); }
 
 static
 void write_ulong(data_item* d, dx_ulong x) {
-  write_ubyte(d, x & 0xFF);
-  write_ubyte(d, x >> 8 & 0xFF);
-  write_ubyte(d, x >> 16 & 0xFF);
-  write_ubyte(d, x >> 24 & 0xFF);
-  write_ubyte(d, x >> 32 & 0xFF);
-  write_ubyte(d, x >> 40 & 0xFF);
-  write_ubyte(d, x >> 48 & 0xFF);
-  write_ubyte(d, x >> 56 & 0xFF);
+  char* p = extend_data(d, 8);
+  int i;
+  for(i = 0; i < 8; i++) p[i] = x >> 8 * i & 0xFF;
 }
 
 static
 void write_long(data_item* d, dx_long x) { write_ulong(d, x); }
 
+static
+void write_bytes(data_item* d, const char* x, dx_uint sz) {
+  memcpy(extend_data(d, sz), x, sz);
+}
+
+/* A leb128 takes at most 5 bytes; room for all of them is made up front and
+ * the unused ones given back. */
 static
 void write_uleb(data_item* d, dx_uint x) {
+  char* p = extend_data(d, 5);
+  int n = 0;
   do {
-    write_ubyte(d, 0x80 | (x & 0x7F));
+    p[n++] = 0x80 | (x & 0x7F);
     x = x >> 7;
   } while(x);
-  d->data[d->data_sz - 1] ^= 0x80;
+  p[n - 1] ^= 0x80;
+  d->data_sz -= 5 - n;
 }
 
 static
 void write_sleb(data_item* d, dx_int x) {
+  char* p = extend_data(d, 5);
+  int n = 0;
   while(1) {
-    write_ubyte(d, 0x80 | (x & 0x7F));
+    p[n++] = 0x80 | (x & 0x7F);
     x = x >> 6;
     if(x == 0 || x == -1) break;
     x = x >> 1;
   }
-  d->data[d->data_sz - 1] ^= 0x80;
+  p[n - 1] ^= 0x80;
+  d->data_sz -= 5 - n;
 }
 
 static
@@ -1224,9 +1635,156 @@ dx_uint write_debug_info_item(write_context* ctx, DexDebugInfo* dbg) {
   return add_data(ctx, d);
 }
 
+static
+dx_uint remap_str(constant_pool* pool, source_remap* m, dx_uint idx) {
+  if(m->strs[idx] == NO_INDEX) m->strs[idx] = find_str(pool, m->src->strs[idx]);
+  return m->strs[idx];
+}
+
+static
+dx_uint remap_type(constant_pool* pool, source_remap* m, dx_uint idx) {
+  if(m->types[idx] == NO_INDEX) {
+    m->types[idx] = find_type(pool, m->src->types[idx]);
+  }
+  return m->types[idx];
+}
+
+/* Walks the debug_info_item at off in src.  When d is NULL the references are
+ * added to pool, otherwise the item is written to d with its indices mapped
+ * through m.  Entries come out the way write_debug_info_item would write the
+ * decoded item.  Returns 0 if the item is malformed. */
+static
+int copy_raw_debug(read_context* src, dx_uint off, constant_pool* pool,
+                   source_remap* m, data_item* d) {
+  if(!dxc_in_data(src, off)) return 0;
+  dx_uint line_start = dxc_read_uleb(src, &off);
+  dx_uint parameters = dxc_read_uleb(src, &off);
+  if(!dxc_in_data(src, off) || parameters > src->data_sz) return 0;
+  if(d) {
+    write_uleb(d, line_start);
+    write_uleb(d, parameters);
+  }
+  int keep_names = !(src->flags & DXC_READ_NO_PARAMETER_NAMES);
+  dx_uint i;
+  for(i = 0; i < parameters; i++) {
+    dx_uint idx = dxc_read_ulebp1(src, &off);
+    if(!dxc_in_data(src, off) ||
+       (idx != NO_INDEX && idx >= src->strs_sz)) {
+      return 0;
+    }
+    if(idx == NO_INDEX || !keep_names || !src->strs[idx]->s[0]) {
+      idx = NO_INDEX;
+    } else if(!d) {
+      add_str(pool, src->strs[idx]);
+    }
+    if(d) write_ulebp1(d, idx == NO_INDEX ? NO_INDEX : remap_str(pool, m, idx));
+  }
+  while(1) {
+    if(!dxc_read_ok(src, off, 1)) return 0;
+    dx_ubyte opcode = dxc_read_ubyte(src, &off);
+    if(d) write_ubyte(d, opcode);
+    dx_uint vals[4] = {0, 0, 0, 0};
+    dx_uint vals_sz = 0;
+    switch(opcode) {
+      case DBG_END_SEQUENCE:
+        return 1;
+      case DBG_ADVANCE_PC:
+      case DBG_END_LOCAL:
+      case DBG_RESTART_LOCAL:
+        vals[vals_sz++] = dxc_read_uleb(src, &off);
+        if(d) write_uleb(d, vals[0]);
+        break;
+      case DBG_ADVANCE_LINE:
+        vals[vals_sz++] = dxc_read_sleb(src, &off);
+        if(d) write_sleb(d, vals[0]);
+        break;
+      case DBG_START_LOCAL:
+      case DBG_START_LOCAL_EXTENDED:
+        vals[vals_sz++] = dxc_read_uleb(src, &off);
+        vals[vals_sz++] = dxc_read_ulebp1(src, &off);
+        vals[vals_sz++] = dxc_read_ulebp1(src, &off);
+        if(opcode == DBG_START_LOCAL_EXTENDED) {
+          vals[vals_sz++] = dxc_read_ulebp1(src, &off);
+        }
+        if((vals[1] != NO_INDEX && vals[1] >= src->strs_sz) ||
+           (vals[2] != NO_INDEX && vals[2] >= src->types_sz) ||
+           (vals_sz > 3 && vals[3] != NO_INDEX && vals[3] >= src->strs_sz)) {
+          return 0;
+        }
+        if(!d) {
+          if(vals[1] != NO_INDEX) add_str(pool, src->strs[vals[1]]);
+          if(vals[2] != NO_INDEX) add_type(pool, src->types[vals[2]]);
+          if(vals_sz > 3 && vals[3] != NO_INDEX) {
+            add_str(pool, src->strs[vals[3]]);
+          }
+          break;
+        }
+        write_uleb(d, vals[0]);
+        write_ulebp1(d, vals[1] == NO_INDEX ? NO_INDEX :
+                        remap_str(pool, m, vals[1]));
+        write_ulebp1(d, vals[2] == NO_INDEX ? NO_INDEX :
+                        remap_type(pool, m, vals[2]));
+        if(vals_sz > 3) {
+          write_ulebp1(d, vals[3] == NO_INDEX ? NO_INDEX :
+                          remap_str(pool, m, vals[3]));
+        }
+        break;
+      case DBG_SET_FILE:
+        vals[vals_sz++] = dxc_read_ulebp1(src, &off);
+        if(vals[0] != NO_INDEX && vals[0] >= src->strs_sz) return 0;
+        if(!d) {
+          if(vals[0] != NO_INDEX) add_str(pool, src->strs[vals[0]]);
+        } else {
+          write_ulebp1(d, vals[0] == NO_INDEX ? NO_INDEX :
+                          remap_str(pool, m, vals[0]));
+        }
+        break;
+      default:
+        break;
+    }
+    if(!dxc_in_data(src, off)) return 0;
+  }
+}
+
+/* Walks the encoded_catch_handler at off in src, adding its catch types to
+ * pool when d is NULL and otherwise writing it to d with the types mapped
+ * through m.  Returns 0 if the handler is malformed. */
+static
+int copy_raw_handler(read_context* src, dx_uint off, constant_pool* pool,
+                     source_remap* m, data_item* d) {
+  if(!dxc_in_data(src, off)) return 0;
+  dx_int hsz = dxc_read_sleb(src, &off);
+  if(!dxc_in_data(src, off)) return 0;
+  int has_catch_all = hsz <= 0;
+  if(has_catch_all) hsz = -hsz;
+  if((dx_uint)hsz > src->data_sz) return 0;
+  if(d) write_sleb(d, has_catch_all ? -hsz : hsz);
+  dx_int i;
+  for(i = 0; i < hsz; i++) {
+    dx_uint type_idx = dxc_read_uleb(src, &off);
+    dx_uint addr = dxc_read_uleb(src, &off);
+    if(!dxc_in_data(src, off) || type_idx >= src->types_sz) return 0;
+    if(d) {
+      write_uleb(d, remap_type(pool, m, type_idx));
+      write_uleb(d, addr);
+    } else {
+      add_type(pool, src->types[type_idx]);
+    }
+  }
+  if(has_catch_all) {
+    dx_uint addr = dxc_read_uleb(src, &off);
+    if(!dxc_in_data(src, off)) return 0;
+    if(d) write_uleb(d, addr);
+  }
+  return 1;
+}
+
+static
+void write_tries(write_context* ctx, data_item* d, DexTryBlock* tries,
+                 dx_uint try_sz);
+
 static
 dx_uint write_code_item(write_context* ctx, DexCode* code) {
-  constant_pool* pool = &ctx->pool;
   data_item d = init_data_item(TYPE_CODE_ITEM);
 
   dx_uint try_sz = 0;
@@ -1243,25 +1801,31 @@ dx_uint write_code_item(write_context* ctx, DexCode* code) {
     write_uint(&d, 0);
   }
   write_dalvik(ctx, &d, code->insns, code->insns_count);
-  
-  if(!try_sz) {
-    return add_data(ctx, d);
-  }
+  write_tries(ctx, &d, code->tries, try_sz);
+  return add_data(ctx, d);
+}
+
+static
+void write_tries(write_context* ctx, data_item* d, DexTryBlock* tries,
+                 dx_uint try_sz) {
+  constant_pool* pool = &ctx->pool;
+  if(!try_sz) return;
 
+  DexTryBlock* ptr;
   IdIndexPair* try_data = (IdIndexPair*)malloc(sizeof(IdIndexPair) * try_sz);
   IdIndexPair* pos;
-  for(ptr = code->tries, pos = try_data;
+  for(ptr = tries, pos = try_data;
       !dxc_is_sentinel_try_block(ptr); ptr++, pos++) {
     pos->id = ptr->start_addr;
     pos->index = pos - try_data;
   }
   qsort(try_data, try_sz, sizeof(IdIndexPair), compare_idindexpair);
 
-  align(&d, 4);
+  align(d, 4);
   data_item catch_handler = init_data_item(0);
   write_uleb(&catch_handler, try_sz);
   for(pos = try_data; pos != try_data + try_sz; pos++) {
-    ptr = code->tries + pos->index;
+    ptr = tries + pos->index;
     dx_uint hsz = 0;
     DexHandler* hnd;
     for(hnd = ptr->handlers; !dxc_is_sentinel_handler(hnd); hnd++) hsz++;
@@ -1271,9 +1835,9 @@ dx_uint write_code_item(write_context* ctx, DexCode* code) {
       fflush(stderr);
     }
 
-    write_uint(&d, ptr->start_addr);
-    write_ushort(&d, ptr->insn_count);
-    write_ushort(&d, catch_handler.data_sz);
+    write_uint(d, ptr->start_addr);
+    write_ushort(d, ptr->insn_count);
+    write_ushort(d, catch_handler.data_sz);
 
     write_sleb(&catch_handler, ptr->catch_all_handler ?
                -(dx_int)hsz : (dx_int)hsz);
@@ -1285,12 +1849,215 @@ dx_uint write_code_item(write_context* ctx, DexCode* code) {
       write_uleb(&catch_handler, ptr->catch_all_handler->addr);
     }
   }
-  concat_data_and_free(&d, &catch_handler);
+  concat_data_and_free(d, &catch_handler);
   free(try_data);
+}
 
+static
+source_remap* get_remap(write_context* ctx, read_context* src) {
+  int i;
+  for(i = 0; i < ctx->remaps_sz; i++) {
+    if(ctx->remaps[i].src == src) return ctx->remaps + i;
+  }
+  ctx->remaps = (source_remap*)realloc(ctx->remaps,
+                                       sizeof(source_remap) * (i + 1));
+  source_remap* m = ctx->remaps + ctx->remaps_sz++;
+  m->src = src;
+  m->strs = (dx_uint*)malloc(sizeof(dx_uint) * src->strs_sz);
+  m->types = (dx_uint*)malloc(sizeof(dx_uint) * src->types_sz);
+  m->fields = (dx_uint*)malloc(sizeof(dx_uint) * src->fields_sz);
+  m->methods = (dx_uint*)malloc(sizeof(dx_uint) * src->methods_sz);
+  memset(m->strs, 0xFF, sizeof(dx_uint) * src->strs_sz);
+  memset(m->types, 0xFF, sizeof(dx_uint) * src->types_sz);
+  memset(m->fields, 0xFF, sizeof(dx_uint) * src->fields_sz);
+  memset(m->methods, 0xFF, sizeof(dx_uint) * src->methods_sz);
+  return m;
+}
+
+/* Writes the instructions in buf with their operands mapped through m.  Only
+ * the operand bits change, so the instructions are copied as they are
+ * otherwise.  Returns 0 without writing anything if a new index does not fit
+ * the operand it replaces. */
+static
+int write_raw_dalvik(write_context* ctx, source_remap* m, data_item* d,
+                     const dx_ushort* buf, dx_uint size) {
+  constant_pool* pool = &ctx->pool;
+  dx_ushort* units = (dx_ushort*)malloc(sizeof(dx_ushort) * (size ? size : 1));
+  memcpy(units, buf, sizeof(dx_ushort) * size);
+  dx_uint i;
+  dx_uint width;
+  for(i = 0; i < size; i += width) {
+    width = dxc_dalvik_width(buf, i, size);
+    if((buf[i] & 0x00FF) == OP_PSUEDO && (buf[i] >> 8) != PSUEDO_OP_NOP) {
+      continue;
+    }
+    const DexOpFormat* fmt = &dex_opcode_formats[buf[i] & 0x00FF];
+    dx_ulong v;
+    switch(fmt->specialType) {
+      case SPECIAL_STRING:
+      case SPECIAL_TYPE:
+      case SPECIAL_FIELD:
+      case SPECIAL_METHOD:
+        break;
+      default:
+        continue;
+    }
+    dxc_decode_special(fmt, buf + i, &v);
+    switch(fmt->specialType) {
+      case SPECIAL_STRING:
+        v = remap_str(pool, m, v);
+        break;
+      case SPECIAL_TYPE:
+        v = remap_type(pool, m, v);
+        break;
+      case SPECIAL_FIELD:
+        if(m->fields[v] == NO_INDEX) {
+          m->fields[v] = find_field(pool, m->src->fields[v]);
+        }
+        v = m->fields[v];
+        break;
+      default:
+        if(m->methods[v] == NO_INDEX) {
+          m->methods[v] = find_method(pool, m->src->methods[v]);
+        }
+        v = m->methods[v];
+        break;
+    }
+    /* Pool operands always start in the second code unit. */
+    if(fmt->specialPos != 4 || (fmt->specialSize != 4 &&
+                                fmt->specialSize != 8) ||
+       v >= (1ULL << fmt->specialSize * 4)) {
+      free(units);
+      return 0;
+    }
+    units[i + 1] = v & 0xFFFF;
+    if(fmt->specialSize == 8) units[i + 2] = v >> 16 & 0xFFFF;
+  }
+  write_uint(d, size);
+  for(i = 0; i < size; i++) {
+    write_ushort(d, units[i]);
+  }
+  free(units);
+  return 1;
+}
+
+/* Writes the compact code of a method whose code was never expanded.  Returns
+ * NO_INDEX if an operand no longer fits its encoding. */
+static
+dx_uint write_compact_code_item(write_context* ctx, DexCompactCode* code) {
+  source_remap* m = get_remap(ctx, code->source);
+  data_item insns = init_data_item(0);
+  if(!write_raw_dalvik(ctx, m, &insns, code->insns, code->insns_size)) {
+    free_data_item(insns);
+    return NO_INDEX;
+  }
+
+  data_item d = init_data_item(TYPE_CODE_ITEM);
+  dx_uint try_sz = 0;
+  DexTryBlock* ptr;
+  for(ptr = code->tries; !dxc_is_sentinel_try_block(ptr); ptr++) try_sz++;
+
+  write_ushort(&d, code->registers_size);
+  write_ushort(&d, code->ins_size);
+  write_ushort(&d, code->outs_size);
+  write_ushort(&d, uint2ushort(try_sz));
+  if(code->debug_information) {
+    write_resolve(&d, write_debug_info_item(ctx, code->debug_information));
+  } else {
+    write_uint(&d, 0);
+  }
+  concat_data_and_free(&d, &insns);
+  write_tries(ctx, &d, code->tries, try_sz);
+  return add_data(ctx, d);
+}
+
+/* Writes the undecoded code item at off in src, copying its instructions and
+ * try ranges and re-encoding only the debug info and handlers, whose leb128
+ * indices can change width.  Returns NO_INDEX if an operand no longer fits
+ * its encoding. */
+static
+dx_uint write_raw_code_item(write_context* ctx, read_context* src,
+                            dx_uint off) {
+  constant_pool* pool = &ctx->pool;
+  source_remap* m = get_remap(ctx, src);
+  raw_code rc;
+  if(!parse_raw_code(src, off, &rc)) return NO_INDEX;
+  data_item insns = init_data_item(0);
+  if(!write_raw_dalvik(ctx, m, &insns,
+                       (const dx_ushort*)(src->buf + rc.insns_off),
+                       rc.insns_size)) {
+    free_data_item(insns);
+    return NO_INDEX;
+  }
+
+  data_item d = init_data_item(TYPE_CODE_ITEM);
+  write_ushort(&d, rc.registers_size);
+  write_ushort(&d, rc.ins_size);
+  write_ushort(&d, rc.outs_size);
+  write_ushort(&d, rc.tries_size);
+  if(rc.debug_info_off) {
+    data_item dbg = init_data_item(TYPE_DEBUG_INFO_ITEM);
+    copy_raw_debug(src, rc.debug_info_off, pool, m, &dbg);
+    write_resolve(&d, add_data(ctx, dbg));
+  } else {
+    write_uint(&d, 0);
+  }
+  concat_data_and_free(&d, &insns);
+  if(!rc.tries_size) {
+    return add_data(ctx, d);
+  }
+
+  /* Tries go out sorted by address with a handler list each, as
+   * write_tries does for decoded code. */
+  IdIndexPair* try_data = (IdIndexPair*)malloc(sizeof(IdIndexPair) *
+                                               rc.tries_size);
+  dx_uint i;
+  for(i = 0; i < rc.tries_size; i++) {
+    dx_uint toff = rc.tries_off + 8 * i;
+    try_data[i].id = dxc_read_uint(src, &toff);
+    try_data[i].index = i;
+  }
+  qsort(try_data, rc.tries_size, sizeof(IdIndexPair), compare_idindexpair);
+
+  align(&d, 4);
+  data_item catch_handler = init_data_item(0);
+  write_uleb(&catch_handler, rc.tries_size);
+  for(i = 0; i < rc.tries_size; i++) {
+    dx_uint toff = rc.tries_off + 8 * try_data[i].index;
+    write_uint(&d, dxc_read_uint(src, &toff));
+    write_ushort(&d, dxc_read_ushort(src, &toff));
+    write_ushort(&d, catch_handler.data_sz);
+    copy_raw_handler(src, rc.handlers_off + dxc_read_ushort(src, &toff),
+                     pool, m, &catch_handler);
+  }
+  concat_data_and_free(&d, &catch_handler);
+  free(try_data);
   return add_data(ctx, d);
 }
 
+/* Writes the code of mtd, copying code that was never decoded from its input
+ * with the pool indices remapped and falling back to decoding it when that is
+ * not possible.  Returns NO_INDEX if the method has no code, or if its code
+ * could not be read in which case ctx is marked as failed. */
+static
+dx_uint write_method_code(write_context* ctx, DexMethod* mtd) {
+  dx_uint rid = NO_INDEX;
+  if(!mtd->code_body && mtd->compact_code) {
+    rid = write_compact_code_item(ctx, mtd->compact_code);
+  } else if(!mtd->code_body && mtd->code_off) {
+    rid = write_raw_code_item(ctx, mtd->code_source, mtd->code_off);
+  }
+  if(rid == NO_INDEX) {
+    DexCode* code = dxc_method_code(mtd);
+    if(code) {
+      rid = write_code_item(ctx, code);
+    } else if(mtd->code_off || mtd->compact_code) {
+      ctx->failed = 1;
+    }
+  }
+  return rid;
+}
+
 static
 dx_uint write_class_data(write_context* ctx, DexClass* cl, DexValue** svalues) {
   constant_pool* pool = &ctx->pool;
@@ -1434,8 +2201,9 @@ dx_uint write_class_data(write_context* ctx, DexClass* cl, DexValue** svalues) {
     dx_uint next_id = direct_method_offs[i].id;
     write_uleb(&d, next_id - last_id);
     write_uleb(&d, mtd->access_flags);
-    if(mtd->code_body) {
-      write_uleb_resolve(&d, write_code_item(ctx, mtd->code_body));
+    dx_uint code_rid = write_method_code(ctx, mtd);
+    if(code_rid != NO_INDEX) {
+      write_uleb_resolve(&d, code_rid);
     } else {
       write_uleb(&d, 0);
     }
@@ -1447,8 +2215,9 @@ dx_uint write_class_data(write_context* ctx, DexClass* cl, DexValue** svalues) {
     dx_uint next_id = virtual_method_offs[i].id;
     write_uleb(&d, next_id - last_id);
     write_uleb(&d, mtd->access_flags);
-    if(mtd->code_body) {
-      write_uleb_resolve(&d, write_code_item(ctx, mtd->code_body));
+    dx_uint code_rid = write_method_code(ctx, mtd);
+    if(code_rid != NO_INDEX) {
+      write_uleb_resolve(&d, code_rid);
     } else {
       write_uleb(&d, 0);
     }
@@ -1479,15 +2248,13 @@ dx_uint write_type_list(write_context* ctx, ref_str** type_list) {
 static
 dx_uint write_string_data(write_context* ctx, ref_str* s) {
   data_item d = init_data_item(TYPE_STRING_DATA_ITEM);
-  dx_uint code_points = mutf8_code_points(s->s);
+  dx_uint code_points = dxc_str_utf16_len(s);
   if(code_points == (dx_uint)-1) {
     fprintf(stderr, "Invalid MUTF-8 encoding\n");
     fflush(stderr);
   }
   write_uleb(&d, code_points);
-  char* ptr;
-  for(ptr = s->s; *ptr; ptr++) write_ubyte(&d, *ptr);
-  write_ubyte(&d, 0);
+  write_bytes(&d, s->s, dxc_str_len(s) + 1);
   return add_data(ctx, d);
 }
 
@@ -1568,8 +2335,44 @@ void write_class(write_context* ctx, DexClass* cl) {
   add_data(ctx, d);
 }
 
+typedef struct {
+  DexClass** order;
+  dx_uint count;
+  dx_uint per_shard;
+  write_context* shards;
+} write_task;
+
+static
+int write_shard_task(void* vtask, dx_uint i) {
+  write_task* task = (write_task*)vtask;
+  dx_uint j = i * task->per_shard;
+  dx_uint end = j + task->per_shard;
+  if(end > task->count) end = task->count;
+  for(; j < end; j++) write_class(task->shards + i, task->order[j]);
+  return 1;
+}
+
+/* Moves the items of shard to the end of ctx, pointing their references at
+ * the items' new indices. */
 static
-void write_classes(write_context* ctx, DexClass* classes) {
+void merge_shard(write_context* ctx, write_context* shard) {
+  dx_uint base = ctx->dat_sz;
+  int i;
+  for(i = 0; i < shard->dat_sz; i++) {
+    data_item d = shard->dat[i];
+    dx_uint k;
+    for(k = 0; d.resolve && k < d.resolve->sz; k++) {
+      d.resolve->dat[k].index += base;
+    }
+    add_data(ctx, d);
+  }
+  if(shard->failed) ctx->failed = 1;
+  free(shard->dat);
+  free_remaps(shard);
+}
+
+static
+void write_classes(write_context* ctx, DexClass* classes, dx_uint nthreads) {
   constant_pool* pool = &ctx->pool;
   int sz = 0;
   DexClass* cl;
@@ -1579,6 +2382,10 @@ void write_classes(write_context* ctx, DexClass* classes) {
     cl_type[find_type(pool, cl->name)] = cl;
   }
 
+  // Order the classes so that each comes after its super class and
+  // interfaces.
+  DexClass** order = (DexClass**)malloc(sizeof(DexClass*) * (sz + 1));
+  dx_uint count = 0;
   IdIndexPair* stck = (IdIndexPair*)calloc(sizeof(IdIndexPair), sz + 1);
   for(cl = classes; !dxc_is_sentinel_class(cl); cl++) {
     int spos = 0;
@@ -1603,60 +2410,183 @@ void write_classes(write_context* ctx, DexClass* classes) {
         stck[++spos].id = find_type(pool, cl->interfaces->s[index]);
         stck[spos].index = -1;
       } else {
-        write_class(ctx, cl);
+        order[count++] = cl;
         cl_type[id] = NULL;
         spos--;
       }
     }
   }
-
   free(stck);
   free(cl_type);
-}
 
-static
-void write_to_file(FILE* fout, data_item d) {
-  if(d.data_sz != fwrite(d.data, 1, d.data_sz, fout)) {
+  /* Once the pool is complete a class's items only depend on pool indices.
+   * With several threads contiguous runs of classes are encoded into contexts
+   * of their own that share the pool, and their items are then appended in
+   * order, giving the same items in the same order as encoding serially. */
+  dx_uint nshards = nthreads * 2;
+  if(nshards > count) nshards = count;
+  dx_uint i;
+  if(nthreads <= 1 || nshards <= 1) {
+    for(i = 0; i < count; i++) write_class(ctx, order[i]);
+    free(order);
+    return;
+  }
+  write_task task;
+  task.order = order;
+  task.count = count;
+  task.per_shard = (count + nshards - 1) / nshards;
+  nshards = (count + task.per_shard - 1) / task.per_shard;
+  task.shards = (write_context*)malloc(sizeof(write_context) * nshards);
+  for(i = 0; i < nshards; i++) {
+    write_context* shard = task.shards + i;
+    shard->pool = ctx->pool;
+    shard->dat_sz = 0;
+    shard->dat_cap = 128;
+    shard->dat = (data_item*)malloc(sizeof(data_item) * shard->dat_cap);
+    shard->remaps = NULL;
+    shard->remaps_sz = 0;
+    shard->flags = ctx->flags;
+    shard->failed = 0;
+  }
+  dxc_share_refs_begin();
+  dxc_run_tasks_batched(nthreads, nshards, 1, write_shard_task, &task);
+  dxc_share_refs_end();
+  for(i = 0; i < nshards; i++) merge_shard(ctx, task.shards + i);
+  free(task.shards);
+  free(order);
+}
+
+static
+void write_to_file(FILE* fout, const char* buf, dx_uint size) {
+  if(size != fwrite(buf, 1, size, fout)) {
     fprintf(stderr, "failed to write all of file contents\n");
     fflush(stderr);
   }
 }
 
-#define make_unique(A, sz, compare_func_raw, compare_func, free_func) { \
-  qsort(A, sz, sizeof(*A), compare_func_raw); \
-  for(i = pos = 0; i < sz; i++) { \
-    if(!pos || compare_func(A[pos - 1], A[i])) { \
-      A[pos++] = A[i]; \
-    } else { \
-      free_func(A[i]); \
-    } \
-  } \
-  sz = pos; \
-}
-
 typedef struct {
   int type;
   int offset;
   int size;
 } layout_list_item;
 
-typedef struct  {
+/* A slot of the table that finds identical data items.  index is one more
+ * than the item's index in the write context, zero marking a free slot. */
+typedef struct {
+  dx_ulong hash;
   int index;
-  int crc;
-} ord_data_item;
+} dedup_slot;
 
+/* Hashes the type and the bytes of a data item, eight bytes at a time. */
 static
-int compare_crcs(const void* a, const void* b) {
-  ord_data_item* da = (ord_data_item*)a;
-  ord_data_item* db = (ord_data_item*)b;
-  if(da->crc < db->crc) return -1;
-  if(da->crc > db->crc) return 1;
-  return 0;
+dx_ulong hash_data_item(const data_item* d) {
+  dx_ulong h = 0x9E3779B97F4A7C15ULL ^ d->type ^ (dx_ulong)d->data_sz << 32;
+  dx_uint i;
+  dx_ulong v;
+  for(i = 0; i + 8 <= d->data_sz; i += 8) {
+    memcpy(&v, d->data + i, 8);
+    h = (h ^ v) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 32;
+  }
+  v = 0;
+  memcpy(&v, d->data + i, d->data_sz - i);
+  h = (h ^ v) * 0xC4CEB9FE1A85EC53ULL;
+  return h ^ h >> 29;
 }
 
 // TODO: Do this right.
 #include "opt_write.h"
 
+static
+void store_be32(char* p, dx_uint v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static
+void store_le32(char* p, dx_uint v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static
+dx_uint load_le32(const char* p) {
+  const dx_ubyte* q = (const dx_ubyte*)p;
+  return q[0] | q[1] << 8 | q[2] << 16 | (dx_uint)q[3] << 24;
+}
+
+/* Appends the deps and aux sections of an odex file to the dex file in buf
+ * and fills in the odex header in front of it.  Returns 0 if buf could not
+ * grow. */
+static
+int write_odex_sections(write_context* ctx, DexFile* dex, char** buf,
+                        dx_uint* size, dx_uint dex_file_size, dx_uint class_sz,
+                        dx_uint class_off, dx_uint type_off, dx_uint str_off) {
+  // write_aux reads the id tables through a view of the dex data.
+  data_item file;
+  memset(&file, 0, sizeof(file));
+  file.data = *buf + 0x28 + 0x70;
+  data_item deps_section = write_deps(ctx, dex);
+  data_item aux_section = write_aux(ctx, dex, &file, class_sz, class_off,
+                                    type_off, str_off);
+
+  data_item opt_header = init_data_item(0);
+  char opt_magic[8];
+  snprintf(opt_magic, 8, "dey\n%03d", dex->metadata->odex_version);
+  write_bytes(&opt_header, opt_magic, 8);
+  write_uint(&opt_header, 0x28);
+  write_uint(&opt_header, dex_file_size);
+  write_uint(&opt_header, 0x28 + dex_file_size);
+  write_uint(&opt_header, deps_section.data_sz);
+
+  /* The aux seciton must be aligned on 8 byte boundaries. */
+  while((dex_file_size + deps_section.data_sz) & 7) {
+    write_ubyte(&deps_section, 0);
+  }
+
+  write_uint(&opt_header, 0x28 + dex_file_size + deps_section.data_sz);
+  write_uint(&opt_header, aux_section.data_sz);
+  write_uint(&opt_header, dex->metadata->flags);
+
+  dx_uint opt_sz = deps_section.data_sz + aux_section.data_sz;
+  char* grown = (char*)realloc(*buf, *size + opt_sz);
+  if(grown) {
+    memcpy(grown + *size, deps_section.data, deps_section.data_sz);
+    memcpy(grown + *size + deps_section.data_sz, aux_section.data,
+           aux_section.data_sz);
+    write_uint(&opt_header, dxc_checksum(grown + *size, opt_sz));
+    memcpy(grown, opt_header.data, opt_header.data_sz);
+    *buf = grown;
+    *size += opt_sz;
+  }
+  free_data_item(deps_section);
+  free_data_item(aux_section);
+  free_data_item(opt_header);
+  return grown != NULL;
+}
+
+/* Writes out an odex file byte swapped to big-endian.  The checksums are taken
+ * over the bytes as they end up in the file, so they are recomputed after the
+ * swap. */
+static
+void write_big_endian(FILE* fout, char* buf, dx_uint size) {
+  dx_uint dex_off = load_le32(buf + 8);
+  dx_uint dex_len = load_le32(buf + 12);
+  dx_uint deps_off = load_le32(buf + 16);
+  dx_uint aux_off = load_le32(buf + 24);
+  dx_uint aux_len = load_le32(buf + 28);
+  if(!dxc_swap_image(buf, size, 0)) return;
+  store_be32(buf + dex_off + 8,
+             dxc_checksum(buf + dex_off + 12, dex_len - 12));
+  store_be32(buf + 36,
+             dxc_checksum(buf + deps_off, aux_off + aux_len - deps_off));
+  write_to_file(fout, buf, size);
+}
+
 static
 void perform_resolve(write_context* ctx, data_item* d, int* offsets) {
   dx_uint i;
@@ -1689,29 +2619,40 @@ void perform_resolve(write_context* ctx, data_item* d, int* offsets) {
 }
 
 void dxc_write_file(DexFile* dex, FILE* fout) {
+  dxc_write_file_ex(dex, fout, NULL);
+}
+
+void dxc_write_file_ex(DexFile* dex, FILE* fout, const DexWriteOptions* opts) {
+  if(!dxc_load_all_classes(dex)) {
+    DXC_ERROR("failed to decode classes for writing");
+    return;
+  }
   write_context ctx;
   init_ctx(&ctx);
+  if(opts) ctx.flags = opts->flags;
   constant_pool* pool = &ctx.pool;
-  pop_array(dex->classes, pool, dxc_is_sentinel_class, pop_class);
+  dx_uint nthreads = opts ? opts->nthreads : 1;
+  pop_classes(pool, dex->classes, nthreads);
+  if(pool->failed) {
+    DXC_ERROR("failed to decode code for writing");
+    free_ctx(ctx);
+    return;
+  }
 
-  int pos;
+  /* The id items pull in the strings, types and prototypes they refer to.
+   * The sets drop duplicates as they go so each array is sorted just once, in
+   * the order the format requires. */
   dx_uint i;
-  make_unique(pool->methods, pool->methods_size, compare_method_ptr,
-              compare_method, dxc_free_raw_method);
   for(i = 0; i < pool->methods_size; i++) {
     add_type(pool, pool->methods[i].defining_class);
     add_str(pool, pool->methods[i].name);
     add_proto(pool, pool->methods[i].prototype);
   }
-  make_unique(pool->fields, pool->fields_size, compare_field_ptr,
-              compare_field, dxc_free_raw_field);
   for(i = 0; i < pool->fields_size; i++) {
     add_type(pool, pool->fields[i].defining_class);
     add_str(pool, pool->fields[i].name);
     add_type(pool, pool->fields[i].type);
   }
-  make_unique(pool->protos, pool->protos_size, compare_proto_ptr,
-              compare_proto, dxc_free_strstr);
   for(i = 0; i < pool->protos_size; i++) {
     ref_str** s;
     for(s = pool->protos[i]->s; *s; s++) {
@@ -1721,16 +2662,26 @@ void dxc_write_file(DexFile* dex, FILE* fout) {
     add_str(pool, shrty);
     dxc_free_str(shrty);
   }
-  make_unique(pool->types, pool->types_size, compare_mutf8_ptr,
-              mutf8_ref_compare, dxc_free_str);
   for(i = 0; i < pool->types_size; i++) {
     add_str(pool, pool->types[i]);
   }
-  make_unique(pool->strs, pool->strs_size, compare_mutf8_ptr,
-              mutf8_ref_compare, dxc_free_str);
+  qsort(pool->methods, pool->methods_size, sizeof(raw_method),
+        compare_method_ptr);
+  qsort(pool->fields, pool->fields_size, sizeof(raw_field), compare_field_ptr);
+  qsort(pool->protos, pool->protos_size, sizeof(ref_strstr*),
+        compare_proto_ptr);
+  qsort(pool->types, pool->types_size, sizeof(ref_str*), compare_mutf8_ptr);
+  qsort(pool->strs, pool->strs_size, sizeof(ref_str*), compare_mutf8_ptr);
+  index_pools(pool);
 
   write_constant_pool(&ctx);
-  write_classes(&ctx, dex->classes);
+  write_classes(&ctx, dex->classes, nthreads);
+  if(ctx.failed) {
+    DXC_ERROR("failed to decode code for writing");
+    for(i = 0; i < (dx_uint)ctx.dat_sz; i++) free_data_item(ctx.dat[i]);
+    free_ctx(ctx);
+    return;
+  }
 
   int* alignment_mp = (int*)malloc(sizeof(int) * TYPE_LAST);
   alignment_mp[TYPE_HEADER_ITEM] = 4;
@@ -1789,52 +2740,58 @@ void dxc_write_file(DexFile* dex, FILE* fout) {
     }
   }
 
-  ord_data_item* data_ord =
-      (ord_data_item*)malloc(sizeof(ord_data_item) * max_reassign_sz);
+  // Lay out the data items a type at a time, giving items identical to an
+  // earlier one of the same type that item's offset.  Code items are only
+  // shared when asked for.
+  dx_uint dedup_cap = 1;
+  while(dedup_cap < 2 * max_reassign_sz) dedup_cap <<= 1;
+  dedup_slot* dedup = (dedup_slot*)malloc(sizeof(dedup_slot) * dedup_cap);
   dx_uint iter;
   for(iter = 0; iter < sizeof(resolve_order) / sizeof(DexItemTypes); iter++) {
     i = resolve_order[iter];
     if(!type_list_sz[i]) continue;
+    int share = i != TYPE_CODE_ITEM || (ctx.flags & DXC_WRITE_SHARE_CODE_ITEMS);
+    dx_uint mask = 1;
+    while(mask < 2 * type_list_sz[i]) mask <<= 1;
+    memset(dedup, 0, sizeof(dedup_slot) * mask);
+    mask--;
+    int pos = 0;
+    int algn = alignment_mp[i];
     dx_uint j;
     for(j = 0; j < type_list_sz[i]; j++) {
       int jj = type_map[i][j];
-      perform_resolve(&ctx, ctx.dat + jj, offsets);
-      offsets[jj] = -1;
-      data_ord[j].index = jj;
-      data_ord[j].crc = dxc_checksum(ctx.dat[jj].data, ctx.dat[jj].data_sz);
-    }
-    qsort(data_ord, type_list_sz[i], sizeof(ord_data_item), compare_crcs);
-    if(i == TYPE_CODE_ITEM) {
-    } else for(j = 0; j < type_list_sz[i]; j++) {
-      int jj = data_ord[j].index;
-      if(offsets[jj] != -1) continue;
-      dx_uint k;
-      for(k = j + 1;
-          k < type_list_sz[i] && data_ord[j].crc == data_ord[k].crc; k++) {
-        int kk = data_ord[k].index;
-        if(ctx.dat[jj].data_sz == ctx.dat[kk].data_sz && offsets[kk] == -1 &&
-           !memcmp(ctx.dat[jj].data, ctx.dat[kk].data, ctx.dat[jj].data_sz)) {
-          offsets[kk] = jj;
+      data_item* d = ctx.dat + jj;
+      perform_resolve(&ctx, d, offsets);
+      int dup = -1;
+      if(share) {
+        dx_ulong h = hash_data_item(d);
+        dx_uint k;
+        for(k = h & mask; dedup[k].index; k = (k + 1) & mask) {
+          data_item* e = ctx.dat + dedup[k].index - 1;
+          if(dedup[k].hash == h && e->data_sz == d->data_sz &&
+             !memcmp(e->data, d->data, d->data_sz)) {
+            dup = dedup[k].index - 1;
+            break;
+          }
+        }
+        if(dup == -1) {
+          dedup[k].hash = h;
+          dedup[k].index = jj + 1;
         }
       }
-    }
-    int pos = 0;
-    int algn = alignment_mp[i];
-    for(j = 0; j < type_list_sz[i]; j++) {
-      int jj = data_ord[j].index;
-      if(offsets[jj] == -1) {
+      if(dup == -1) {
         type_map[i][pos++] = jj;
         while(off % algn != 0) off++;
         offsets[jj] = off;
-        off += ctx.dat[jj].data_sz;
+        off += d->data_sz;
       } else {
-        offsets[jj] = offsets[offsets[jj]];
-        free_data_item(ctx.dat[jj]);
+        offsets[jj] = offsets[dup];
+        free_data_item(*d);
       }
     }
     type_list_sz[i] = pos;
   }
-  free(data_ord);
+  free(dedup);
   while(off % 4 != 0) off++;
 
   for(i = TYPE_STRING_ID_ITEM; i <= TYPE_CLASS_DEF_ITEM; i++) {
@@ -1903,67 +2860,10 @@ void dxc_write_file(DexFile* dex, FILE* fout) {
     }
   }
 
-  // Write out the file (except for the header) to one contiguous memory buffer.
-  data_item file = init_data_item(0);
-  for(i = TYPE_STRING_ID_ITEM; i <= TYPE_CLASS_DEF_ITEM; i++) {
-    int algn = alignment_mp[i];
-    dx_uint j;
-    for(j = 0; j < type_list_sz[i]; j++) {
-      while(file.data_sz % algn != 0) write_ubyte(&file, 0);
-      concat_data_and_free(&file, ctx.dat + type_map[i][j]);
-    }
-  }
-  for(iter = 0; iter < sizeof(resolve_order) / sizeof(DexItemTypes); iter++) {
-    int i = resolve_order[iter];
-    int algn = alignment_mp[i];
-    dx_uint j;
-    for(j = 0; j < type_list_sz[i]; j++) {
-      while(file.data_sz % algn != 0) write_ubyte(&file, 0);
-      concat_data_and_free(&file, ctx.dat + type_map[i][j]);
-    }
-  }
-  while(file.data_sz % 4 != 0) write_ubyte(&file, 0);
-  concat_data_and_free(&file, &map_data);
-
-  dx_uint dex_file_size = 0x70 + file.data_sz;
-  if(dex->metadata) {
-    data_item deps_section = write_deps(&ctx, dex);
-    data_item aux_section = write_aux(&ctx, dex, &file,
-        type_list_sz[TYPE_CLASS_DEF_ITEM], class_off, type_off, str_off);
-    data_item opt_header = init_data_item(0);
-  
-    char opt_magic[8];
-    snprintf(opt_magic, 8, "dey\n%03d", dex->metadata->odex_version);
-    for(i = 0; i < 8; i++) {
-      write_ubyte(&opt_header, opt_magic[i]);
-    }
-
-    write_uint(&opt_header, 0x28);
-    write_uint(&opt_header, dex_file_size);
-    write_uint(&opt_header, 0x28 + dex_file_size);
-    write_uint(&opt_header, deps_section.data_sz);
-
-    /* The aux seciton must be aligned on 8 byte boundaries. */
-    while((dex_file_size + deps_section.data_sz) & 7) {
-      write_ubyte(&deps_section, 0);
-    }
-
-    write_uint(&opt_header, 0x28 + dex_file_size + deps_section.data_sz);
-    write_uint(&opt_header, aux_section.data_sz);
-    write_uint(&opt_header, dex->metadata->flags);
-    
-    concat_data_and_free(&deps_section, &aux_section);
-    write_uint(&opt_header,
-               dxc_checksum(deps_section.data, deps_section.data_sz));
-    concat_data_and_free(&file, &deps_section);
-
-    write_to_file(fout, opt_header);
-    free_data_item(opt_header);
-  }
-
-  // Compute the header, this is sort of complicated as the contents depend
-  // on the contents of the rest of the file including some of the header
-  // itself.
+  // Compute the header fields that follow the signature.  The magic,
+  // checksum and signature cover the rest of the file and are filled in once
+  // everything else is in place.
+  dx_uint dex_file_size = map_off + map_data.data_sz;
   data_item header = init_data_item(TYPE_HEADER_ITEM);
   write_uint(&header, dex_file_size);
   write_uint(&header, 0x70); // header_size
@@ -1984,36 +2884,58 @@ void dxc_write_file(DexFile* dex, FILE* fout) {
   write_uint(&header, method_off);
   write_uint(&header, type_list_sz[TYPE_CLASS_DEF_ITEM]);
   write_uint(&header, class_off);
-  write_uint(&header, 0x70 + file.data_sz - data_off);
+  write_uint(&header, dex_file_size - data_off);
   write_uint(&header, data_off);
 
-  dx_uint hdr_sz = header.data_sz;
-  concat_data_and_free(&header, &file);
-  file = header;
-  header = init_data_item(TYPE_HEADER_ITEM);
-  
-  dx_ubyte* sha1 = dex->metadata ? dex->metadata->id :
-                   dxc_calc_sha1(file.data, hdr_sz + dex_file_size - 0x70);
-  for(i = 0; i < 20; i++) {
-    write_ubyte(&header, sha1[i]);
+  // Every item already has its offset so the dex file is written straight
+  // into one buffer of its final size, freeing each item as it is copied.
+  dx_uint base = dex->metadata ? 0x28 : 0;
+  dx_uint size = base + dex_file_size;
+  char* buf = (char*)calloc(size, 1);
+  for(i = TYPE_STRING_ID_ITEM; i < TYPE_LAST; i++) {
+    dx_uint j;
+    for(j = 0; j < type_list_sz[i]; j++) {
+      data_item* d = ctx.dat + type_map[i][j];
+      if(buf) memcpy(buf + base + offsets[type_map[i][j]], d->data, d->data_sz);
+      free_data_item(*d);
+    }
+  }
+  if(buf) {
+    memcpy(buf + base + map_off, map_data.data, map_data.data_sz);
+    memcpy(buf + base + 32, header.data, header.data_sz);
   }
-  if(!dex->metadata) free(sha1);
+  free_data_item(map_data);
+  free_data_item(header);
 
-  hdr_sz += header.data_sz;
-  concat_data_and_free(&header, &file);
-  file = header;
-  header = init_data_item(TYPE_HEADER_ITEM);
+  if(buf && dex->metadata &&
+     !write_odex_sections(&ctx, dex, &buf, &size, dex_file_size,
+                          type_list_sz[TYPE_CLASS_DEF_ITEM], class_off,
+                          type_off, str_off)) {
+    free(buf);
+    buf = NULL;
+  }
+  if(buf) {
+    char* dex_buf = buf + base;
+    memcpy(dex_buf, "dex\n035\x0", 8);
+    if(dex->metadata) {
+      memcpy(dex_buf + 12, dex->metadata->id, 20);
+    } else {
+      dxc_sha1_ctx sha;
+      dxc_sha1_init(&sha);
+      dxc_sha1_update(&sha, dex_buf + 32, dex_file_size - 32);
+      dxc_sha1_final(&sha, (dx_ubyte*)dex_buf + 12);
+    }
+    store_le32(dex_buf + 8, dxc_checksum(dex_buf + 12, dex_file_size - 12));
 
-  dx_uint crc = dxc_checksum(file.data, hdr_sz + dex_file_size - 0x70);
-  for(i = 0; i < 8; i++) {
-    write_ubyte(&header, "dex\n035\x0"[i]);
+    if(dex->metadata && (dex->metadata->flags & DEX_FLAG_BIG)) {
+      write_big_endian(fout, buf, size);
+    } else {
+      write_to_file(fout, buf, size);
+    }
+    free(buf);
+  } else {
+    DXC_ERROR("failed to alloc output buffer");
   }
-  write_uint(&header, crc);
-
-  write_to_file(fout, header);
-  free_data_item(header);
-  write_to_file(fout, file);
-  free_data_item(file);
 
   free(alignment_mp);
   for(i = 0; i < TYPE_LAST; i++) {
@@ -2026,4 +2948,3 @@ void dxc_write_file(DexFile* dex, FILE* fout) {
   free_ctx(ctx);
 }
 
-#undef make_unique